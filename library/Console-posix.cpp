@@ -47,6 +47,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -60,6 +61,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <termios.h>
 #include <errno.h>
 #include <deque>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #ifdef HAVE_CUCHAR
 #include <cuchar>
 #else
@@ -202,6 +209,8 @@ static std::string toLocaleMB(const u32string& wstr)
 
 namespace DFHack
 {
+    class AsyncOutput;
+
     class Private
     {
     public:
@@ -212,11 +221,9 @@ namespace DFHack
             in_batch = false;
             supported_terminal = false;
             state = con_unclaimed;
+            async = NULL;
         };
-        virtual ~Private()
-        {
-            //sync();
-        }
+        virtual ~Private();
     private:
         bool read_char(unsigned char & out)
         {
@@ -271,6 +278,25 @@ namespace DFHack
             }
         }
 
+        /// Write a block of already colorized text, redrawing the prompt once
+        void print_block(const std::string &block)
+        {
+            if (state == con_lineedit)
+            {
+                disable_raw();
+                fputs("\x1b[1G\x1b[0K", dfout_C);
+                fwrite(block.data(), 1, block.size(), dfout_C);
+                reset_color();
+                enable_raw();
+                prompt_refresh();
+            }
+            else
+            {
+                fwrite(block.data(), 1, block.size(), dfout_C);
+                fflush(dfout_C);
+            }
+        }
+
         void begin_batch()
         {
             assert(!in_batch);
@@ -834,13 +860,341 @@ namespace DFHack
         // thread exit mechanism
         int exit_pipe[2];
         fd_set descriptor_set;
+        // async output pipeline, created on first use
+        AsyncOutput *async;
+    };
+
+    /// One piece of text queued by the async output pipeline
+    struct OutputChunk
+    {
+        uint64_t seq;
+        color_ostream::color_value color;
+        std::string text;
     };
+
+    /// Single producer, single consumer ring of queued output. Every thread
+    /// that prints in async mode owns one; only the console thread pops.
+    class OutputRing
+    {
+    public:
+        static constexpr size_t CAPACITY = 1024; // must be a power of two
+
+        static constexpr uint64_t NO_SEQ = UINT64_MAX;
+
+        OutputRing() : head(0), tail(0), dropped(0), inflight(NO_SEQ), orphaned(false) {}
+
+        bool push(OutputChunk &chunk)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) >= CAPACITY)
+                return false;
+            slots[t & (CAPACITY - 1)] = std::move(chunk);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop(OutputChunk &chunk)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire))
+                return false;
+            chunk = std::move(slots[h & (CAPACITY - 1)]);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+        size_t size()
+        {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        std::atomic<size_t> head, tail;
+        std::atomic<size_t> dropped;
+        // while the owning thread is queueing a chunk, a lower bound of its
+        // seq; the console thread holds back everything from there on
+        std::atomic<uint64_t> inflight;
+        // set when the owning thread exits; the ring is freed once drained
+        std::atomic<bool> orphaned;
+    private:
+        OutputChunk slots[CAPACITY];
+    };
+
+    /// Queues console output from any thread and writes it to the terminal
+    /// from a dedicated thread in batches, one lock and one write per batch.
+    class AsyncOutput
+    {
+    public:
+        AsyncOutput(Private *d, recursive_mutex *wlock)
+            : d(d), wlock(wlock), id(next_id.fetch_add(1) + 1),
+              next_seq(0), total_dropped(0), running(false),
+              stopping(false), idle(false), exited(false),
+              flush_waiters(0), written_seq(0)
+        {}
+        ~AsyncOutput()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            if (running)
+                return;
+            stopping = false;
+            exited = false;
+            running = true;
+            worker = std::thread(&AsyncOutput::run, this);
+        }
+
+        /// Stop the console thread, writing out anything still queued
+        void stop()
+        {
+            if (!running)
+                return;
+            {
+                std::lock_guard<std::mutex> g(wake_mutex);
+                stopping = true;
+                wake_cond.notify_one();
+            }
+            worker.join();
+            running = false;
+        }
+
+        /// Wake the console thread if it is waiting; cheap when it is busy
+        void wake()
+        {
+            if (idle.exchange(false))
+            {
+                std::lock_guard<std::mutex> g(wake_mutex);
+                wake_cond.notify_one();
+            }
+        }
+
+        /// Block until everything queued so far has been written
+        void flush()
+        {
+            if (!running || std::this_thread::get_id() == worker.get_id())
+                return;
+            uint64_t target = next_seq.load();
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            flush_waiters++;
+            wake_cond.notify_one();
+            flushed_cond.wait(lock, [&]() { return written_seq >= target || exited; });
+            flush_waiters--;
+        }
+
+        /// Queue text for output. Returns false if the pipeline is not
+        /// running and the caller has to write synchronously.
+        bool push(color_ostream::color_value color, const std::string &text)
+        {
+            if (!running)
+                return false;
+            OutputRing *ring = local_ring();
+            // Publish a lower bound of the seq before taking it, so the
+            // console thread cannot write out any later chunk before this
+            // one is queued (see drain).
+            ring->inflight = next_seq.load();
+            OutputChunk chunk{next_seq.fetch_add(1), color, text};
+            bool queued = push_chunk(ring, chunk, is_important(color));
+            ring->inflight = OutputRing::NO_SEQ;
+            return queued;
+        }
+
+        size_t get_dropped()
+        {
+            return total_dropped;
+        }
+
+    private:
+        bool push_chunk(OutputRing *ring, OutputChunk &chunk, bool important)
+        {
+            if (ring->push(chunk))
+            {
+                if (ring->size() >= OutputRing::CAPACITY / 2)
+                    wake();
+                return true;
+            }
+
+            // Overloaded: errors and warnings wait for the console thread to
+            // catch up, everything else gets a short grace period and is
+            // then dropped.
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+            do
+            {
+                if (!running || stopping)
+                    return false;
+                wake();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                if (!important && std::chrono::steady_clock::now() > deadline)
+                {
+                    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            } while (!ring->push(chunk));
+            return true;
+        }
+
+        static bool is_important(color_ostream::color_value color)
+        {
+            return color == COLOR_LIGHTRED || color == COLOR_RED || color == COLOR_YELLOW;
+        }
+
+        struct RingHolder
+        {
+            uint64_t owner = 0;
+            std::shared_ptr<OutputRing> ring;
+            ~RingHolder()
+            {
+                if (ring)
+                    ring->orphaned = true;
+            }
+        };
+
+        OutputRing *local_ring()
+        {
+            static thread_local RingHolder holder;
+            if (holder.owner != id)
+            {
+                if (holder.ring)
+                    holder.ring->orphaned = true;
+                holder.ring = std::make_shared<OutputRing>();
+                holder.owner = id;
+                std::lock_guard<std::mutex> g(rings_mutex);
+                rings.push_back(holder.ring);
+            }
+            return holder.ring.get();
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            while (!stopping)
+            {
+                if (!flush_waiters)
+                {
+                    idle = true;
+                    wake_cond.wait_for(lock, std::chrono::milliseconds(20));
+                    idle = false;
+                }
+                drain_pass(lock, false);
+            }
+            drain_pass(lock, true);
+            exited = true;
+            flushed_cond.notify_all();
+        }
+
+        /// Drain with wake_mutex released, then wake up any flush() callers
+        void drain_pass(std::unique_lock<std::mutex> &lock, bool final)
+        {
+            lock.unlock();
+            uint64_t limit = drain(final);
+            lock.lock();
+            written_seq = std::max(written_seq, limit);
+            flushed_cond.notify_all();
+        }
+
+        /// Write out the queued chunks in seq order. A thread may take a seq
+        /// and be preempted before queueing the chunk, so only the chunks
+        /// below the lowest seq still being queued are written; the rest
+        /// wait in `pending` for a later pass. Returns that limit.
+        uint64_t drain(bool final)
+        {
+            size_t dropped = 0;
+            uint64_t limit = final ? OutputRing::NO_SEQ : next_seq.load();
+            {
+                std::lock_guard<std::mutex> g(rings_mutex);
+                for (auto it = rings.begin(); it != rings.end(); )
+                {
+                    OutputRing *ring = it->get();
+                    bool orphaned = ring->orphaned;
+                    // read before popping, so a chunk queued in between is
+                    // either popped now or still counted as in flight
+                    limit = std::min(limit, ring->inflight.load());
+                    OutputChunk chunk;
+                    while (ring->pop(chunk))
+                        pending.push_back(std::move(chunk));
+                    dropped += ring->dropped.exchange(0);
+                    if (orphaned && !ring->size())
+                        it = rings.erase(it);
+                    else
+                        ++it;
+                }
+            }
+
+            std::sort(pending.begin(), pending.end(),
+                [](const OutputChunk &a, const OutputChunk &b) { return a.seq < b.seq; });
+            auto end = pending.begin();
+            while (end != pending.end() && end->seq < limit)
+                ++end;
+            if (end == pending.begin() && !dropped)
+                return limit;
+
+            block.clear();
+            int cur_color = -2;
+            for (auto it = pending.begin(); it != end; ++it)
+            {
+                if (it->color != cur_color)
+                {
+                    block += getANSIColor(it->color);
+                    cur_color = it->color;
+                }
+                block += it->text;
+            }
+            pending.erase(pending.begin(), end);
+            if (dropped)
+            {
+                total_dropped += dropped;
+                block += getANSIColor(COLOR_DARKGREY);
+                block += "[console overloaded: " + std::to_string(dropped) + " output chunks dropped]\n";
+                block += RESETCOLOR;
+            }
+
+            lock_guard<recursive_mutex> g(*wlock);
+            d->print_block(block);
+            return limit;
+        }
+
+        static std::atomic<uint64_t> next_id;
+
+        Private *d;
+        recursive_mutex *wlock;
+        const uint64_t id;
+        std::atomic<uint64_t> next_seq;
+        std::atomic<size_t> total_dropped;
+        std::atomic<bool> running, stopping, idle;
+        // guarded by wake_mutex
+        bool exited;
+        int flush_waiters;
+        // every chunk with a lower seq has been written or dropped
+        uint64_t written_seq;
+
+        std::mutex rings_mutex;
+        std::vector<std::shared_ptr<OutputRing>> rings;
+
+        std::thread worker;
+        std::mutex wake_mutex;
+        std::condition_variable wake_cond;
+        std::condition_variable flushed_cond;
+
+        // owned by the console thread: chunks not yet written, in seq order
+        // after each pass, and a scratch buffer
+        std::vector<OutputChunk> pending;
+        std::string block;
+    };
+
+    std::atomic<uint64_t> AsyncOutput::next_id(0);
+
+    Private::~Private()
+    {
+        delete async;
+    }
 }
 
+// set while the current thread holds wlock for a synchronous batch
+static thread_local bool batch_locked = false;
+
 Console::Console()
 {
     d = 0;
     inited = false;
+    async_output = false;
     // we can't create the mutex at this time. the SDL functions aren't hooked yet.
     wlock = new recursive_mutex();
 }
@@ -890,6 +1244,9 @@ bool Console::shutdown(void)
 {
     if(!d)
         return true;
+    async_output = false;
+    if (d->async)
+        d->async->stop();
     d->reset_color();
     lock_guard <recursive_mutex> g(*wlock);
     close(d->exit_pipe[1]);
@@ -902,7 +1259,12 @@ void Console::begin_batch()
 {
     //color_ostream::begin_batch();
 
+    // in async mode the per-thread queue already keeps the batch together
+    if (async_output)
+        return;
+
     wlock->lock();
+    batch_locked = true;
 
     if (inited)
         d->begin_batch();
@@ -910,14 +1272,27 @@ void Console::begin_batch()
 
 void Console::end_batch()
 {
+    if (!batch_locked)
+    {
+        if (d && d->async)
+            d->async->wake();
+        return;
+    }
+
     if (inited)
         d->end_batch();
 
+    batch_locked = false;
     wlock->unlock();
 }
 
 void Console::flush_proxy()
 {
+    if (async_output && !batch_locked)
+    {
+        d->async->flush();
+        return;
+    }
     lock_guard <recursive_mutex> g(*wlock);
     if (inited)
         d->flush();
@@ -925,6 +1300,8 @@ void Console::flush_proxy()
 
 void Console::add_text(color_value color, const std::string &text)
 {
+    if (async_output && !batch_locked && d->async->push(color, text))
+        return;
     lock_guard <recursive_mutex> g(*wlock);
     if (inited)
         d->print_text(color, text);
@@ -994,6 +1371,33 @@ void Console::msleep (unsigned int msec)
     usleep((msec % 1000000) * 1000);
 }
 
+bool Console::set_async_output(bool enable)
+{
+    if (!inited)
+        return false;
+    if (enable)
+    {
+        lock_guard <recursive_mutex> g(*wlock);
+        if (!d->async)
+            d->async = new AsyncOutput(d, wlock);
+        d->async->start();
+        async_output = true;
+    }
+    else if (async_output)
+    {
+        // the console thread keeps running so that text queued by threads
+        // that have not yet seen the switch still gets written out
+        async_output = false;
+        d->async->wake();
+    }
+    return true;
+}
+
+size_t Console::get_dropped_output()
+{
+    return (d && d->async) ? d->async->get_dropped() : 0;
+}
+
 bool Console::hide()
 {
     //Warmist: don't know if it's possible...
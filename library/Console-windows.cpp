@@ -417,6 +417,7 @@ Console::Console()
     d = 0;
     wlock = 0;
     inited = false;
+    async_output = false;
 }
 
 Console::~Console()
@@ -616,3 +617,14 @@ bool Console::show()
     ShowWindow( GetConsoleWindow(), SW_RESTORE );
     return true;
 }
+
+bool Console::set_async_output(bool enable)
+{
+    // not implemented for the Windows console
+    return !enable;
+}
+
+size_t Console::get_dropped_output()
+{
+    return 0;
+}
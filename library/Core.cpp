@@ -24,10 +24,12 @@ distribution.
 
 #include "Internal.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <map>
 #include <set>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <iterator>
@@ -35,6 +37,7 @@ distribution.
 #include <forward_list>
 #include <type_traits>
 #include <cstdarg>
+#include <chrono>
 using namespace std;
 
 #include "Error.h"
@@ -46,6 +49,7 @@ using namespace std;
 #include "Module.h"
 #include "VersionInfoFactory.h"
 #include "VersionInfo.h"
+#include "VTableInterpose.h"
 #include "PluginManager.h"
 #include "ModuleFactory.h"
 #include "modules/EventManager.h"
@@ -139,8 +143,42 @@ struct Core::Private
 
     bool last_autosave_request{false};
     bool was_load_save{false};
+
+    std::mutex suspend_stats_mutex;
+    std::map<std::string, SuspendClientStats> suspend_stats;
+
+    SuspendClientStats &suspendStatsFor(const std::string &client);
 };
 
+// Clients that come and go (e.g. dfhack-run connections) would otherwise
+// grow the table forever; the least busy ones are dropped instead.
+static const size_t MAX_SUSPEND_CLIENTS = 64;
+
+static thread_local std::string suspend_client;
+static thread_local std::chrono::steady_clock::time_point suspend_start;
+
+Core::SuspendClientStats &Core::Private::suspendStatsFor(const std::string &client)
+{
+    const std::string &key = client.empty() ? std::string("other") : client;
+    auto it = suspend_stats.find(key);
+    if (it != suspend_stats.end())
+        return it->second;
+
+    if (suspend_stats.size() >= MAX_SUSPEND_CLIENTS)
+    {
+        auto least = std::min_element(suspend_stats.begin(), suspend_stats.end(),
+            [](const std::pair<const std::string, SuspendClientStats> &a,
+               const std::pair<const std::string, SuspendClientStats> &b) {
+                return a.second.total_us < b.second.total_us;
+            });
+        suspend_stats.erase(least);
+    }
+
+    auto &stats = suspend_stats[key];
+    stats.client = key;
+    return stats;
+}
+
 struct CommandDepthCounter
 {
     static const int MAX_DEPTH = 20;
@@ -153,61 +191,7 @@ thread_local int CommandDepthCounter::depth = 0;
 
 void Core::cheap_tokenise(string const& input, vector<string> &output)
 {
-    string *cur = NULL;
-    size_t i = 0;
-
-    // Check the first non-space character
-    while (i < input.size() && isspace(input[i])) i++;
-
-    // Special verbatim argument mode?
-    if (i < input.size() && input[i] == ':')
-    {
-        // Read the command
-        std::string cmd;
-        i++;
-        while (i < input.size() && !isspace(input[i]))
-            cmd.push_back(input[i++]);
-        if (!cmd.empty())
-            output.push_back(cmd);
-
-        // Find the argument
-        while (i < input.size() && isspace(input[i])) i++;
-
-        if (i < input.size())
-            output.push_back(input.substr(i));
-
-        return;
-    }
-
-    // Otherwise, parse in the regular quoted mode
-    for (; i < input.size(); i++)
-    {
-        unsigned char c = input[i];
-        if (isspace(c)) {
-            cur = NULL;
-        } else {
-            if (!cur) {
-                output.push_back("");
-                cur = &output.back();
-            }
-
-            if (c == '"') {
-                for (i++; i < input.size(); i++) {
-                    c = input[i];
-                    if (c == '"')
-                        break;
-                    else if (c == '\\') {
-                        if (++i < input.size())
-                            cur->push_back(input[i]);
-                    }
-                    else
-                        cur->push_back(c);
-                }
-            } else {
-                cur->push_back(c);
-            }
-        }
-    }
+    tokenize_command_line(&output, input);
 }
 
 struct IODATA
@@ -229,6 +213,7 @@ void fHKthread(void * iodata)
         return;
     }
     bool keep_going = true;
+    Core::setSuspendClient("hotkey");
     while(keep_going)
     {
         std::string stuff = core->getHotkeyCmd(keep_going); // waits on mutex!
@@ -455,6 +440,8 @@ static const std::set<std::string> built_in_commands = {
     "cls" ,
     "die" ,
     "kill-lua" ,
+    "interpose" ,
+    "suspend-budget" ,
     "script" ,
     "hide" ,
     "show" ,
@@ -939,7 +926,9 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                 "  fpause                      - Force DF to pause.\n"
                 "  die                         - Force DF to close immediately\n"
                 "  kill-lua                    - Stop an active Lua script\n"
+                "  interpose [list|profile|reset] - Show or profile vmethod hooks\n"
                 "  keybinding                  - Modify bindings of commands to keys\n"
+                "  suspend-budget [MS|reset]   - Show who holds the game, or limit it per frame\n"
                 "  script FILENAME             - Run the commands specified in a file.\n"
                 "  sc-script                   - Automatically run specified scripts on state change events\n"
                 "  plug [PLUGIN|v]             - List plugin state and detailed description.\n"
@@ -1194,6 +1183,134 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, v
                     " profiling and coverage monitoring.\n");
             }
         }
+        else if (builtin == "interpose")
+        {
+            string cmd = parts.empty() ? "list" : parts[0];
+            size_t filter_pos = (cmd == "profile") ? 2 : 1;
+            string filter = parts.size() > filter_pos ? parts[filter_pos] : "";
+            if (cmd == "profile" && parts.size() < 2)
+            {
+                con.printerr("Usage: interpose profile on|off [FILTER]\n");
+                return CR_WRONG_USAGE;
+            }
+
+            CoreSuspender suspend;
+
+            std::vector<VMethodInterposeLinkBase*> links;
+            for (auto link : VMethodInterposeLinkBase::get_all())
+            {
+                if (filter.empty() || strstr(link->name(), filter.c_str()))
+                    links.push_back(link);
+            }
+            std::sort(links.begin(), links.end(),
+                [](VMethodInterposeLinkBase *a, VMethodInterposeLinkBase *b) {
+                    return strcmp(a->name(), b->name()) < 0;
+                });
+
+            if (cmd == "list")
+            {
+                con.print("%-50s %12s %16s %10s\n", "hook", "calls", "cycles", "avg");
+                for (auto link : links)
+                {
+                    if (!link->is_applied())
+                        continue;
+                    auto stats = link->get_stats();
+                    if (!stats || !link->is_profiling())
+                    {
+                        con.print("%-50s %12s\n", link->name(),
+                                  link->can_profile() ? "-" : "n/a");
+                        continue;
+                    }
+                    con.print("%-50s %12llu %16llu %10llu\n", link->name(),
+                              (unsigned long long)stats->calls,
+                              (unsigned long long)stats->cycles,
+                              (unsigned long long)(stats->calls ? stats->cycles / stats->calls : 0));
+                }
+            }
+            else if (cmd == "profile")
+            {
+                bool enable;
+                if (parts[1] == "on")
+                    enable = true;
+                else if (parts[1] == "off")
+                    enable = false;
+                else
+                {
+                    con.printerr("Usage: interpose profile on|off [FILTER]\n");
+                    return CR_WRONG_USAGE;
+                }
+                int count = 0;
+                for (auto link : links)
+                {
+                    if (link->set_profiling(enable))
+                        count++;
+                }
+                con.print("Profiling %s for %d hooks.\n", enable ? "enabled" : "disabled", count);
+            }
+            else if (cmd == "reset")
+            {
+                for (auto link : links)
+                    link->reset_stats();
+            }
+            else
+            {
+                con.printerr("Usage: interpose [list|profile on|off|reset] [FILTER]\n");
+                return CR_WRONG_USAGE;
+            }
+        }
+        else if (builtin == "suspend-budget")
+        {
+            if (parts.size() > 1)
+            {
+                con.printerr("Usage: suspend-budget [MILLISECONDS|off|reset]\n");
+                return CR_WRONG_USAGE;
+            }
+            if (parts.size() == 1)
+            {
+                if (parts[0] == "reset")
+                    resetSuspendStats();
+                else if (parts[0] == "off")
+                    setSuspendBudget(0);
+                else
+                {
+                    // strtod accepts "nan" and "inf", which cannot be
+                    // converted to an integer budget
+                    const double max_ms = 60000;
+                    char *end = nullptr;
+                    double ms = strtod(parts[0].c_str(), &end);
+                    if (!end || *end || !std::isfinite(ms) || ms < 0 || ms > max_ms)
+                    {
+                        con.printerr("Invalid budget: %s\n", parts[0].c_str());
+                        return CR_WRONG_USAGE;
+                    }
+                    setSuspendBudget(int64_t(ms * 1000));
+                }
+            }
+
+            int64_t budget = getSuspendBudget();
+            if (budget > 0)
+                con.print("Suspension budget: %.3f ms per frame\n", budget / 1000.0);
+            else
+                con.print("Suspension budget: unlimited\n");
+
+            auto stats = getSuspendStats();
+            std::sort(stats.begin(), stats.end(),
+                [](const SuspendClientStats &a, const SuspendClientStats &b) {
+                    return a.total_us > b.total_us;
+                });
+            con.print("%-30s %10s %12s %10s %10s %10s\n",
+                      "client", "holds", "total ms", "avg ms", "max ms", "deferred");
+            for (auto &entry : stats)
+            {
+                con.print("%-30s %10llu %12.3f %10.3f %10.3f %10llu\n",
+                          entry.client.c_str(),
+                          (unsigned long long)entry.count,
+                          entry.total_us / 1000.0,
+                          entry.count ? entry.total_us / 1000.0 / entry.count : 0.0,
+                          entry.max_us / 1000.0,
+                          (unsigned long long)entry.deferred);
+            }
+        }
         else if (builtin == "script")
         {
             if(parts.size() == 1)
@@ -1470,6 +1587,8 @@ void fIOthread(void * iodata)
     Core * core = iod->core;
     PluginManager * plug_mgr = ((IODATA*) iodata)->plug_mgr;
 
+    Core::setSuspendClient("console");
+
     CommandHistory main_history;
     main_history.load("dfhack.history");
 
@@ -1544,7 +1663,10 @@ Core::Core() :
     CoreSuspendMutex{},
     CoreWakeup{},
     ownerThread{},
-    toolCount{0}
+    toolCount{0},
+    suspendBudget{0},
+    suspendUsed{0},
+    suspendFrame{0}
 {
     // init the console. This must be always the first step!
     plug_mgr = 0;
@@ -1730,7 +1852,11 @@ bool Core::Init()
         }
     }
     else if(con.init(false))
+    {
         cerr << "Console is running.\n";
+        if (getenv("DFHACK_ASYNC_CONSOLE") && !con.set_async_output(true))
+            cerr << "Asynchronous console output is not supported.\n";
+    }
     else
         cerr << "Console has failed to initialize!\n";
 /*
@@ -1974,6 +2100,89 @@ bool Core::isSuspended(void)
     return ownerThread.load() == std::this_thread::get_id();
 }
 
+void Core::setSuspendBudget(int64_t usec)
+{
+    suspendBudget.store(std::max<int64_t>(usec, 0), std::memory_order_relaxed);
+    // release anything waiting for the old budget
+    startSuspendFrame();
+}
+
+std::vector<Core::SuspendClientStats> Core::getSuspendStats()
+{
+    std::lock_guard<std::mutex> lock(d->suspend_stats_mutex);
+    std::vector<SuspendClientStats> rv;
+    for (auto &entry : d->suspend_stats)
+        rv.push_back(entry.second);
+    return rv;
+}
+
+void Core::resetSuspendStats()
+{
+    std::lock_guard<std::mutex> lock(d->suspend_stats_mutex);
+    d->suspend_stats.clear();
+}
+
+void Core::setSuspendClient(const std::string &name)
+{
+    suspend_client = name;
+}
+
+void Core::startSuspendFrame()
+{
+    suspendUsed.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(suspendFrameMutex);
+        suspendFrame.fetch_add(1, std::memory_order_relaxed);
+    }
+    suspendNextFrame.notify_all();
+}
+
+void Core::waitSuspendBudget()
+{
+    int64_t budget = suspendBudget.load(std::memory_order_relaxed);
+    if (budget <= 0 || isSuspended())
+        return;
+
+    std::unique_lock<std::mutex> lock(suspendFrameMutex);
+    if (suspendUsed.load(std::memory_order_relaxed) < budget || errorstate)
+        return;
+
+    {
+        std::lock_guard<std::mutex> stats_lock(d->suspend_stats_mutex);
+        d->suspendStatsFor(suspend_client).deferred++;
+    }
+
+    uint32_t frame = suspendFrame.load(std::memory_order_relaxed);
+    suspendNextFrame.wait(lock, [&]() -> bool {
+        return suspendFrame.load(std::memory_order_relaxed) != frame || errorstate;
+    });
+}
+
+void Core::onSuspendAcquired()
+{
+    suspend_start = std::chrono::steady_clock::now();
+}
+
+void Core::onSuspendReleased()
+{
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - suspend_start).count();
+
+    {
+        std::lock_guard<std::mutex> lock(d->suspend_stats_mutex);
+        auto &stats = d->suspendStatsFor(suspend_client);
+        stats.count++;
+        stats.total_us += elapsed;
+        stats.max_us = std::max(stats.max_us, elapsed);
+    }
+
+    int64_t budget = suspendBudget.load(std::memory_order_relaxed);
+    int64_t used = suspendUsed.fetch_add(elapsed, std::memory_order_relaxed) + elapsed;
+    // This thread still holds the core, so the main thread cannot miss this
+    if (budget > 0 && used >= budget)
+        CoreWakeup.notify_one();
+}
+
 int Core::TileUpdate()
 {
     if(!started)
@@ -2080,6 +2289,9 @@ void Core::doUpdate(color_ostream &out, bool first_update)
     out << std::flush;
 }
 
+void jobs_beginUpdate();
+void jobs_endUpdate();
+
 // should always be from simulation thread!
 int Core::Update()
 {
@@ -2103,12 +2315,24 @@ int Core::Update()
             Lua::Core::Reset(con, "core init");
         }
 
+        // DF may have changed the job list since the last update
+        jobs_beginUpdate();
+
         doUpdate(out, first_update);
     }
 
-    // Let all commands run that require CoreSuspender
+    // Let all commands run that require CoreSuspender, within the budget
+    startSuspendFrame();
     CoreWakeup.wait(MainThread::suspend(),
-            [this]() -> bool {return this->toolCount.load() == 0;});
+            [this]() -> bool {
+                if (this->toolCount.load() == 0)
+                    return true;
+                int64_t budget = this->suspendBudget.load(std::memory_order_relaxed);
+                return budget > 0 && this->suspendUsed.load(std::memory_order_relaxed) >= budget;
+            });
+
+    // DF runs again from here, and may free jobs at any time
+    jobs_endUpdate();
 
     return 0;
 };
@@ -2116,6 +2340,9 @@ int Core::Update()
 extern bool buildings_do_onupdate;
 void buildings_onStateChange(color_ostream &out, state_change_event event);
 void buildings_onUpdate(color_ostream &out);
+void materials_onStateChange(color_ostream &out, state_change_event event);
+void items_onStateChange(color_ostream &out, state_change_event event);
+void translation_onStateChange(color_ostream &out, state_change_event event);
 
 static int buildings_timer = 0;
 
@@ -2314,6 +2541,9 @@ void Core::onStateChange(color_ostream &out, state_change_event event)
     EventManager::onStateChange(out, event);
 
     buildings_onStateChange(out, event);
+    materials_onStateChange(out, event);
+    items_onStateChange(out, event);
+    translation_onStateChange(out, event);
 
     plug_mgr->OnStateChange(out, event);
 
@@ -2349,6 +2579,9 @@ int Core::Shutdown ( void )
         return true;
     errorstate = 1;
 
+    // Release tools waiting for the next frame's suspension budget
+    startSuspendFrame();
+
     // Make sure we release main thread if this is called from main thread
     if (MainThread::suspend().owns_lock())
         MainThread::suspend().unlock();
@@ -25,6 +25,7 @@ distribution.
 #include "Internal.h"
 
 #include <cstring>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <map>
@@ -55,6 +56,7 @@ distribution.
 #include "modules/MapCache.h"
 #include "modules/Maps.h"
 #include "modules/Materials.h"
+#include "modules/Persistence.h"
 #include "modules/Random.h"
 #include "modules/Screen.h"
 #include "modules/Translation.h"
@@ -492,6 +494,45 @@ static int dfhack_persistent_deleteTilemask(lua_State *state)
     return 1;
 }
 
+static int dfhack_persistent_exportJSON(lua_State *state)
+{
+    std::string path = luaL_checkstring(state, 1);
+
+    std::ofstream file(path);
+    lua_pushboolean(state, file && Persistence::exportJSON(file));
+    return 1;
+}
+
+static int dfhack_persistent_importJSON(lua_State *state)
+{
+    bool ok;
+    if (lua_isnoneornil(state, 1))
+    {
+        // the copy written by the last save of the loaded world
+        auto file = Persistence::readSaveData("legacy-data");
+        ok = file && Persistence::importJSON(file);
+    }
+    else
+    {
+        std::ifstream file(luaL_checkstring(state, 1));
+        ok = file && Persistence::importJSON(file);
+    }
+    lua_pushboolean(state, ok);
+    return 1;
+}
+
+static int dfhack_persistent_exportBinary(lua_State *state)
+{
+    lua_pushboolean(state, Persistence::exportBinary(luaL_checkstring(state, 1)));
+    return 1;
+}
+
+static int dfhack_persistent_importBinary(lua_State *state)
+{
+    lua_pushboolean(state, Persistence::importBinary(luaL_checkstring(state, 1)));
+    return 1;
+}
+
 static const luaL_Reg dfhack_persistent_funcs[] = {
     { "get", dfhack_persistent_get },
     { "delete", dfhack_persistent_delete },
@@ -499,6 +540,10 @@ static const luaL_Reg dfhack_persistent_funcs[] = {
     { "save", dfhack_persistent_save },
     { "getTilemask", dfhack_persistent_getTilemask },
     { "deleteTilemask", dfhack_persistent_deleteTilemask },
+    { "exportJSON", dfhack_persistent_exportJSON },
+    { "importJSON", dfhack_persistent_importJSON },
+    { "exportBinary", dfhack_persistent_exportBinary },
+    { "importBinary", dfhack_persistent_importBinary },
     { NULL, NULL }
 };
 
@@ -718,8 +763,30 @@ static int dfhack_matinfo_matches(lua_State *state)
     return 1;
 }
 
+static int dfhack_matinfo_getRawIndex(lua_State *state)
+{
+    static const char *const kinds[] = { "inorganic", "plant", "creature", NULL };
+    int kind = luaL_checkoption(state, 1, NULL, kinds);
+    std::string id = luaL_checkstring(state, 2);
+
+    int index = -1;
+    switch (kind)
+    {
+    case 0: index = findInorganicIndex(id); break;
+    case 1: index = findPlantIndex(id); break;
+    case 2: index = findCreatureIndex(id); break;
+    }
+
+    if (index < 0)
+        lua_pushnil(state);
+    else
+        lua_pushinteger(state, index);
+    return 1;
+}
+
 static const luaL_Reg dfhack_matinfo_funcs[] = {
     { "find", dfhack_matinfo_find },
+    { "getRawIndex", dfhack_matinfo_getRawIndex },
     { "decode", dfhack_matinfo_decode },
     { "getToken", dfhack_matinfo_getToken },
     { "toString", dfhack_matinfo_toString },
@@ -1812,6 +1879,25 @@ static int items_getContainedItems(lua_State *state)
     return 1;
 }
 
+static int items_getValues(lua_State *state)
+{
+    luaL_checktype(state, 1, LUA_TTABLE);
+    int count = lua_rawlen(state, 1);
+
+    std::vector<df::item*> items(count);
+    for (int i = 0; i < count; i++)
+    {
+        lua_rawgeti(state, 1, i+1);
+        items[i] = Lua::CheckDFObject<df::item>(state, -1);
+        lua_pop(state, 1);
+    }
+
+    std::vector<int> values;
+    Items::getValues(items, &values);
+    Lua::PushVector(state, values);
+    return 1;
+}
+
 static int items_moveToBuilding(lua_State *state)
 {
     MapExtras::MapCache mc;
@@ -1827,6 +1913,7 @@ static int items_moveToBuilding(lua_State *state)
 static const luaL_Reg dfhack_items_funcs[] = {
     { "getPosition", items_getPosition },
     { "getContainedItems", items_getContainedItems },
+    { "getValues", items_getValues },
     { "moveToBuilding", items_moveToBuilding },
     { NULL, NULL }
 };
@@ -2503,11 +2590,23 @@ namespace console {
     void flush() {
         Core::getInstance().getConsole() << std::flush;
     }
+    bool setAsyncOutput(bool enable) {
+        return Core::getInstance().getConsole().set_async_output(enable);
+    }
+    bool isAsyncOutput() {
+        return Core::getInstance().getConsole().is_async_output();
+    }
+    size_t getDroppedOutput() {
+        return Core::getInstance().getConsole().get_dropped_output();
+    }
 }
 
 static const LuaWrapper::FunctionReg dfhack_console_module[] = {
     WRAPM(console, clear),
     WRAPM(console, flush),
+    WRAPM(console, setAsyncOutput),
+    WRAPM(console, isAsyncOutput),
+    WRAPM(console, getDroppedOutput),
     { NULL, NULL }
 };
 
@@ -24,7 +24,10 @@ distribution.
 
 #include "Internal.h"
 
+#include <chrono>
+#include <climits>
 #include <csignal>
+#include <deque>
 #include <string>
 #include <vector>
 #include <map>
@@ -1853,6 +1856,359 @@ int dfhack_timeout_active(lua_State *L)
     return 1;
 }
 
+/*
+ * Cooperative task scheduler
+ *
+ * Tasks are coroutines resumed from onUpdate until the per-frame time budget
+ * runs out. A count hook on each task thread forces a yield once the budget
+ * is spent, so long loops get spread over several frames without any changes
+ * to the code.
+ */
+
+namespace {
+    struct LuaTask {
+        enum State { READY, SLEEP_FRAMES, SLEEP_TICKS, WAIT_EVENT, DEAD };
+
+        lua_State *thread;
+        State state;
+        int wake_at;
+    };
+}
+
+static int next_task_id = 1;
+static std::map<int,LuaTask> tasks;
+static std::deque<int> ready_tasks;
+static int running_task = 0;
+static std::chrono::steady_clock::time_point task_deadline;
+static int task_budget_us = 5000;
+
+// id -> thread, keeps the coroutines alive
+int DFHACK_TASKS_TOKEN = 0;
+// id -> table of values to resume the task with
+int DFHACK_TASK_ARGS_TOKEN = 0;
+// id -> event key the task waits for
+int DFHACK_TASK_EVENTS_TOKEN = 0;
+
+static const int TASK_HOOK_COUNT = 1000;
+
+static void task_hook(lua_State *L, lua_Debug *ar)
+{
+    if (lstop)
+    {
+        interrupt_hook(L, ar);
+        return;
+    }
+
+    // Only preempt the task itself, not coroutines it runs internally
+    auto it = tasks.find(running_task);
+    if (it != tasks.end() && it->second.thread == L && lua_isyieldable(L) &&
+        std::chrono::steady_clock::now() >= task_deadline)
+        lua_yield(L, 0);
+}
+
+static LuaTask *get_running_task(lua_State *L, const char *fn)
+{
+    auto it = tasks.find(running_task);
+    if (it == tasks.end() || it->second.thread != L)
+        luaL_error(L, "%s can only be called from a task", fn);
+    return &it->second;
+}
+
+static void set_task_args(lua_State *L, int id, int first, int count)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASK_ARGS_TOKEN);
+    lua_createtable(L, count, 1);
+    for (int i = 0; i < count; i++)
+    {
+        lua_pushvalue(L, first+i);
+        lua_rawseti(L, -2, i+1);
+    }
+    lua_pushinteger(L, count);
+    lua_setfield(L, -2, "n");
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+}
+
+static void make_task_ready(lua_State *L, int id, LuaTask &task)
+{
+    if (task.state == LuaTask::WAIT_EVENT)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASK_EVENTS_TOKEN);
+        lua_pushnil(L);
+        lua_rawseti(L, -2, id);
+        lua_pop(L, 1);
+    }
+    task.state = LuaTask::READY;
+    ready_tasks.push_back(id);
+}
+
+static void forget_task(lua_State *L, int id)
+{
+    for (auto token : { &DFHACK_TASKS_TOKEN, &DFHACK_TASK_ARGS_TOKEN, &DFHACK_TASK_EVENTS_TOKEN })
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, token);
+        lua_pushnil(L);
+        lua_rawseti(L, -2, id);
+        lua_pop(L, 1);
+    }
+    tasks.erase(id);
+}
+
+static int dfhack_tasks_spawn(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int nargs = lua_gettop(L) - 1;
+
+    int id = next_task_id++;
+    set_task_args(L, id, 2, nargs);
+
+    lua_pushvalue(L, 1);
+    lua_State *thread = Lua::NewCoroutine(L);
+    lua_sethook(thread, task_hook, LUA_MASKCOUNT, TASK_HOOK_COUNT);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASKS_TOKEN);
+    lua_swap(L);
+    lua_rawseti(L, -2, id);
+
+    tasks[id] = LuaTask{ thread, LuaTask::READY, 0 };
+    ready_tasks.push_back(id);
+
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int dfhack_tasks_yield(lua_State *L)
+{
+    get_running_task(L, "dfhack.tasks.yield()");
+    return lua_yield(L, 0);
+}
+
+static int dfhack_tasks_sleep(lua_State *L)
+{
+    using df::global::world;
+
+    int delta = luaL_checkint(L, 1);
+    int mode = luaL_checkoption(L, 2, "frames", timeout_modes);
+    LuaTask *task = get_running_task(L, "dfhack.tasks.sleep()");
+
+    static const int mode_ticks[] = { 1, 1, 1200, 33600, 403200 };
+    int now = (mode == 0) ? frame_idx : (world ? world->frame_counter : 0);
+    if (delta <= 0 || delta > (INT_MAX - now) / mode_ticks[mode])
+        luaL_error(L, "Invalid sleep time: %d", delta);
+    delta *= mode_ticks[mode];
+
+    // a task that cancelled itself stays cancelled
+    if (task->state == LuaTask::DEAD)
+        return lua_yield(L, 0);
+
+    if (mode == 0)
+    {
+        task->state = LuaTask::SLEEP_FRAMES;
+        task->wake_at = frame_idx + delta;
+    }
+    else
+    {
+        if (!Core::getInstance().isWorldLoaded())
+        {
+            lua_pushboolean(L, false);
+            return 1;
+        }
+        task->state = LuaTask::SLEEP_TICKS;
+        task->wake_at = world->frame_counter + delta;
+    }
+    return lua_yield(L, 0);
+}
+
+static int dfhack_tasks_wait(lua_State *L)
+{
+    luaL_checkany(L, 1);
+    if (lua_isnil(L, 1))
+        luaL_argerror(L, 1, "event key expected");
+    LuaTask *task = get_running_task(L, "dfhack.tasks.wait()");
+    if (task->state == LuaTask::DEAD)
+        return lua_yield(L, 0);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASK_EVENTS_TOKEN);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, running_task);
+    lua_settop(L, 0);
+
+    task->state = LuaTask::WAIT_EVENT;
+    return lua_yield(L, 0);
+}
+
+static int signal_tasks(lua_State *L, int key_idx, int first, int count)
+{
+    key_idx = lua_absindex(L, key_idx);
+    int woken = 0;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASK_EVENTS_TOKEN);
+    for (auto &entry : tasks)
+    {
+        if (entry.second.state != LuaTask::WAIT_EVENT)
+            continue;
+
+        lua_rawgeti(L, -1, entry.first);
+        bool match = lua_rawequal(L, -1, key_idx);
+        lua_pop(L, 1);
+        if (!match)
+            continue;
+
+        set_task_args(L, entry.first, first, count);
+        make_task_ready(L, entry.first, entry.second);
+        woken++;
+    }
+    lua_pop(L, 1);
+
+    return woken;
+}
+
+static int dfhack_tasks_signal(lua_State *L)
+{
+    luaL_checkany(L, 1);
+    lua_pushinteger(L, signal_tasks(L, 1, 2, lua_gettop(L) - 1));
+    return 1;
+}
+
+static int dfhack_tasks_cancel(lua_State *L)
+{
+    int id = luaL_checkint(L, 1);
+    auto it = tasks.find(id);
+    if (it == tasks.end() || it->second.state == LuaTask::DEAD)
+    {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    // A running task is removed once it yields
+    if (id == running_task)
+        it->second.state = LuaTask::DEAD;
+    else
+        forget_task(L, id);
+
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int dfhack_tasks_status(lua_State *L)
+{
+    static const char *const names[] = { "ready", "sleeping", "sleeping", "waiting", NULL };
+
+    auto it = tasks.find(luaL_checkint(L, 1));
+    if (it == tasks.end() || it->second.state == LuaTask::DEAD)
+        lua_pushnil(L);
+    else if (it->first == running_task)
+        lua_pushstring(L, "running");
+    else
+        lua_pushstring(L, names[it->second.state]);
+    return 1;
+}
+
+static int dfhack_tasks_current(lua_State *L)
+{
+    auto it = tasks.find(running_task);
+    if (it != tasks.end() && it->second.thread == L)
+        lua_pushinteger(L, running_task);
+    else
+        lua_pushnil(L);
+    return 1;
+}
+
+static int dfhack_tasks_budget(lua_State *L)
+{
+    lua_pushnumber(L, task_budget_us / 1000.0);
+    if (!lua_isnoneornil(L, 1))
+    {
+        lua_Number ms = luaL_checknumber(L, 1);
+        luaL_argcheck(L, ms > 0, 1, "budget must be positive");
+        task_budget_us = int(ms * 1000);
+    }
+    return 1;
+}
+
+static const luaL_Reg dfhack_tasks_funcs[] = {
+    { "spawn", dfhack_tasks_spawn },
+    { "yield", dfhack_tasks_yield },
+    { "sleep", dfhack_tasks_sleep },
+    { "wait", dfhack_tasks_wait },
+    { "signal", dfhack_tasks_signal },
+    { "cancel", dfhack_tasks_cancel },
+    { "status", dfhack_tasks_status },
+    { "current", dfhack_tasks_current },
+    { "budget", dfhack_tasks_budget },
+    { NULL, NULL }
+};
+
+static void wake_sleeping_tasks(lua_State *L, LuaTask::State state, int now)
+{
+    for (auto &entry : tasks)
+    {
+        if (entry.second.state == state && entry.second.wake_at <= now)
+        {
+            lua_pushboolean(L, true);
+            set_task_args(L, entry.first, lua_gettop(L), 1);
+            lua_pop(L, 1);
+            make_task_ready(L, entry.first, entry.second);
+        }
+    }
+}
+
+static void run_tasks(color_ostream &out, lua_State *L)
+{
+    using df::global::world;
+
+    wake_sleeping_tasks(L, LuaTask::SLEEP_FRAMES, frame_idx);
+    if (world)
+        wake_sleeping_tasks(L, LuaTask::SLEEP_TICKS, world->frame_counter);
+
+    task_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(task_budget_us);
+
+    // Every task that is ready at this point runs at most once per frame
+    size_t count = ready_tasks.size();
+    for (size_t i = 0; i < count && std::chrono::steady_clock::now() < task_deadline; i++)
+    {
+        int id = ready_tasks.front();
+        ready_tasks.pop_front();
+
+        auto it = tasks.find(id);
+        if (it == tasks.end() || it->second.state != LuaTask::READY)
+            continue;
+
+        // Fetch the values to resume with
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TASK_ARGS_TOKEN);
+        lua_rawgeti(L, -1, id);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, id);
+        lua_remove(L, -2);
+
+        int nargs = 0;
+        if (lua_istable(L, -1))
+        {
+            lua_getfield(L, -1, "n");
+            nargs = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            luaL_checkstack(L, nargs, "resuming task");
+            for (int j = 1; j <= nargs; j++)
+                lua_rawgeti(L, -j, j);
+        }
+        lua_remove(L, -nargs-1);
+
+        lua_State *thread = it->second.thread;
+
+        running_task = id;
+        int rv = Lua::SafeResume(out, L, thread, nargs, 0);
+        running_task = 0;
+
+        it = tasks.find(id);
+        if (it == tasks.end())
+            continue;
+        if (rv != LUA_YIELD || it->second.state == LuaTask::DEAD)
+            forget_task(L, id);
+        else if (it->second.state == LuaTask::READY)
+            ready_tasks.push_back(id);
+    }
+}
+
 static void cancel_timers(std::multimap<int,int> &timers)
 {
     using Lua::Core::State;
@@ -1877,12 +2233,29 @@ void DFHack::Lua::Core::onStateChange(color_ostream &out, int code) {
     case SC_MAP_UNLOADED:
     case SC_WORLD_UNLOADED:
         cancel_timers(tick_timers);
+        // tasks sleeping on game time wake up with a false result
+        for (auto &entry : tasks)
+        {
+            if (entry.second.state == LuaTask::SLEEP_TICKS)
+            {
+                lua_pushboolean(State, false);
+                set_task_args(State, entry.first, lua_gettop(State), 1);
+                lua_pop(State, 1);
+                make_task_ready(State, entry.first, entry.second);
+            }
+        }
         break;
 
     default:;
     }
 
     Lua::Push(State, code);
+    if (!tasks.empty())
+    {
+        Lua::StackUnwinder frame(State);
+        lua_pushvalue(State, -1);
+        signal_tasks(State, -1, lua_gettop(State), 1);
+    }
     Lua::Event::Invoke(out, State, (void*)onStateChange, 1);
 }
 
@@ -1912,7 +2285,7 @@ void DFHack::Lua::Core::onUpdate(color_ostream &out)
 {
     using df::global::world;
 
-    if (frame_timers.empty() && tick_timers.empty())
+    if (frame_timers.empty() && tick_timers.empty() && tasks.empty())
         return;
 
     Lua::StackUnwinder frame(State);
@@ -1922,6 +2295,9 @@ void DFHack::Lua::Core::onUpdate(color_ostream &out)
 
     if (world)
         run_timers(out, State, tick_timers, frame[1], world->frame_counter);
+
+    if (!tasks.empty())
+        run_tasks(out, State);
 }
 
 bool DFHack::Lua::Core::Init(color_ostream &out)
@@ -1941,6 +2317,12 @@ static void Lua::Core::InitCoreContext(color_ostream &out)
 {
     lua_newtable(State);
     lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUTS_TOKEN);
+    lua_newtable(State);
+    lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TASKS_TOKEN);
+    lua_newtable(State);
+    lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TASK_ARGS_TOKEN);
+    lua_newtable(State);
+    lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TASK_EVENTS_TOKEN);
 
     // Register events
     lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_DFHACK_TOKEN);
@@ -1953,6 +2335,9 @@ static void Lua::Core::InitCoreContext(color_ostream &out)
     lua_pushcfunction(State, dfhack_timeout_active);
     lua_setfield(State, -2, "timeout_active");
 
+    luaL_newlib(State, dfhack_tasks_funcs);
+    lua_setfield(State, -2, "tasks");
+
     lua_pop(State, 1);
 
     if (getenv("DFHACK_ENABLE_LUACOV"))
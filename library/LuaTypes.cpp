@@ -27,6 +27,7 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "MemAccess.h"
 #include "Core.h"
@@ -1652,3 +1653,553 @@ void LuaWrapper::push_adhoc_pointer(lua_State *state, void *ptr, type_identity *
 
     push_object_internal(state, id, ptr);
 }
+
+/**************************************
+ *         Bulk field access          *
+ **************************************/
+
+static const struct_field_info *find_struct_field(struct_identity *type, const std::string &name)
+{
+    for (struct_identity *p = type; p; p = p->getParent())
+    {
+        auto fields = p->getFields();
+        if (!fields)
+            continue;
+
+        for (int i = 0; fields[i].mode != struct_field_info::END; ++i)
+        {
+            if (fields[i].mode == struct_field_info::OBJ_METHOD ||
+                fields[i].mode == struct_field_info::CLASS_METHOD)
+                continue;
+            if (name == fields[i].name)
+                return &fields[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool is_struct_type(type_identity *type)
+{
+    switch (type->type())
+    {
+    case IDTYPE_STRUCT:
+    case IDTYPE_CLASS:
+    case IDTYPE_UNION:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool FieldPath::resolve(struct_identity *root, const std::string &path, std::string *error)
+{
+    std::vector<std::string> names;
+    split_string(&names, path, ".");
+
+    offsets.assign(1, 0);
+    kind = VALUE;
+    type = NULL;
+
+    struct_identity *cur = root;
+    bitfield_identity *bits = NULL;
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        const std::string &name = names[i];
+        bool last = (i+1 == names.size());
+
+        if (bits)
+        {
+            auto items = bits->getBits();
+            for (int j = 0; j < bits->getNumBits(); j++)
+            {
+                if (items[j].name && name == items[j].name)
+                {
+                    kind = BIT;
+                    bit_index = j;
+                    bit_size = std::max(1, items[j].size);
+                    break;
+                }
+            }
+            if (kind != BIT)
+            {
+                *error = "no bit '" + name + "' in " + bits->getFullName();
+                return false;
+            }
+            if (!last)
+            {
+                *error = "cannot index into bitfield member '" + name + "'";
+                return false;
+            }
+            return true;
+        }
+
+        auto field = find_struct_field(cur, name);
+        if (!field)
+        {
+            *error = "no field '" + name + "' in " + cur->getFullName();
+            return false;
+        }
+
+        offsets.back() += field->offset;
+
+        switch (field->mode)
+        {
+        case struct_field_info::PRIMITIVE:
+        case struct_field_info::SUBSTRUCT:
+            if (field->type->type() == IDTYPE_BITFIELD)
+            {
+                if (last)
+                {
+                    *error = "bitfield '" + name + "' needs a member name";
+                    return false;
+                }
+                bits = (bitfield_identity*)field->type;
+                continue;
+            }
+            if (last)
+            {
+                if (!field->type->isPrimitive())
+                {
+                    *error = "field '" + name + "' is not a primitive value";
+                    return false;
+                }
+                type = field->type;
+                return true;
+            }
+            if (!is_struct_type(field->type))
+            {
+                *error = "cannot index into field '" + name + "'";
+                return false;
+            }
+            cur = (struct_identity*)field->type;
+            continue;
+
+        case struct_field_info::STATIC_STRING:
+            if (!last)
+            {
+                *error = "cannot index into field '" + name + "'";
+                return false;
+            }
+            kind = STATIC_STRING;
+            count = field->count;
+            return true;
+
+        case struct_field_info::POINTER:
+            if (last || !field->type || !is_struct_type(field->type))
+            {
+                *error = "pointer field '" + name + "' must lead to a struct member";
+                return false;
+            }
+            offsets.push_back(0);
+            cur = (struct_identity*)field->type;
+            continue;
+
+        default:
+            *error = "field '" + name + "' cannot be read in bulk";
+            return false;
+        }
+    }
+
+    *error = "empty field path";
+    return false;
+}
+
+uint8_t *FieldPath::locate(void *obj) const
+{
+    uint8_t *ptr = (uint8_t*)obj;
+
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        if (i > 0)
+        {
+            ptr = *(uint8_t**)ptr;
+            if (!ptr)
+                return NULL;
+        }
+        ptr += offsets[i];
+    }
+
+    return ptr;
+}
+
+void FieldPath::push(lua_State *state, int fname_idx, void *obj) const
+{
+    uint8_t *ptr = obj ? locate(obj) : NULL;
+    if (!ptr)
+    {
+        lua_pushnil(state);
+        return;
+    }
+
+    switch (kind)
+    {
+    case VALUE:
+        type->lua_read(state, fname_idx, ptr);
+        return;
+
+    case STATIC_STRING:
+        lua_pushlstring(state, (char*)ptr, strnlen((char*)ptr, count));
+        return;
+
+    case BIT:
+    {
+        int value = getBitfieldField(ptr, bit_index, bit_size);
+        if (bit_size <= 1)
+            lua_pushboolean(state, value != 0);
+        else
+            lua_pushinteger(state, value);
+        return;
+    }
+    }
+}
+
+void FieldPath::write(lua_State *state, int fname_idx, void *obj, int val_index) const
+{
+    uint8_t *ptr = obj ? locate(obj) : NULL;
+    if (!ptr)
+        field_error(state, fname_idx, "NULL pointer on the path", "write");
+
+    switch (kind)
+    {
+    case VALUE:
+        type->lua_write(state, fname_idx, ptr, val_index);
+        return;
+
+    case STATIC_STRING:
+    {
+        size_t size;
+        const char *str = lua_tolstring(state, val_index, &size);
+        if (!str)
+            field_error(state, fname_idx, "string expected", "write");
+        memcpy(ptr, str, std::min(size+1, count));
+        return;
+    }
+
+    case BIT:
+        if (lua_isboolean(state, val_index) || lua_isnil(state, val_index))
+            setBitfieldField(ptr, bit_index, bit_size, lua_toboolean(state, val_index));
+        else if (lua_isnumber(state, val_index))
+            setBitfieldField(ptr, bit_index, bit_size, lua_tointeger(state, val_index));
+        else
+            field_error(state, fname_idx, "boolean or number expected", "write");
+        return;
+    }
+}
+
+namespace {
+    /**
+     * A field path read by df.bulk_read. If the path does not exist in the
+     * static item type of a vector of class pointers (e.g. a subclass field
+     * in world.items.all), it is resolved separately for each actual class.
+     */
+    struct BulkColumn {
+        std::string name;
+        FieldPath path;
+        bool per_class = false;
+        std::map<virtual_identity*, std::unique_ptr<FieldPath> > by_class;
+
+        const FieldPath *get(void *obj)
+        {
+            if (!per_class)
+                return &path;
+
+            auto vid = virtual_identity::get((virtual_ptr)obj);
+            auto it = by_class.find(vid);
+            if (it != by_class.end())
+                return it->second.get();
+
+            std::unique_ptr<FieldPath> fp(new FieldPath());
+            std::string error;
+            if (!vid || !fp->resolve(vid, name, &error))
+                fp.reset();
+            return (by_class[vid] = std::move(fp)).get();
+        }
+
+        void push(lua_State *state, int fname_idx, void *obj)
+        {
+            auto fp = obj ? get(obj) : NULL;
+            if (fp)
+                fp->push(state, fname_idx, obj);
+            else
+                lua_pushnil(state);
+        }
+    };
+}
+
+// True if the path exists in some subclass of the type
+static bool resolves_in_subclass(struct_identity *type, const std::string &name)
+{
+    for (auto child : type->getChildren())
+    {
+        FieldPath path;
+        std::string error;
+        if (path.resolve(child, name, &error) || resolves_in_subclass(child, name))
+            return true;
+    }
+    return false;
+}
+
+static void init_bulk_column(lua_State *state, BulkColumn &col, struct_identity *type, int name_idx)
+{
+    if (lua_type(state, name_idx) != LUA_TSTRING)
+        luaL_error(state, "df.bulk_read(): field names must be strings");
+
+    std::string error;
+    col.name = lua_tostring(state, name_idx);
+
+    if (col.path.resolve(type, col.name, &error))
+        return;
+
+    // a typo would otherwise just give a column of nils
+    if (type->type() != IDTYPE_CLASS || !resolves_in_subclass(type, col.name))
+        luaL_error(state, "df.bulk_read(): %s", error.c_str());
+
+    col.per_class = true;
+}
+
+/**
+ * Function: df.bulk_read(container, fields[, filter])
+ *
+ * Returns: columns, count, indices
+ */
+int LuaWrapper::bulk_read(lua_State *state)
+{
+    int argc = lua_gettop(state);
+    if (argc < 2 || argc > 3 || !lua_istable(state, 2))
+        luaL_error(state, "Usage: df.bulk_read(container, fields[, filter])");
+
+    // Find the container and its item type
+    auto id = get_object_identity(state, 1, "df.bulk_read()", false, true);
+    int meta = lua_gettop(state);
+    if (!id->isContainer() || id->type() == IDTYPE_BIT_CONTAINER)
+        luaL_error(state, "df.bulk_read(): container expected");
+
+    auto cid = (container_identity*)id;
+    type_identity *item = cid->getItemType();
+    int count = -1;
+    lua_getfield(state, meta, "_field_identity");
+    if (lua_islightuserdata(state, -1))
+        item = (type_identity*)lua_touserdata(state, -1);
+    lua_getfield(state, meta, "_count");
+    if (lua_isnumber(state, -1))
+        count = lua_tointeger(state, -1);
+    lua_pop(state, 2);
+
+    bool by_pointer = (id->type() == IDTYPE_PTR_CONTAINER || id->type() == IDTYPE_STL_PTR_VECTOR);
+    if (!by_pointer && item && item->type() == IDTYPE_POINTER)
+    {
+        by_pointer = true;
+        item = ((pointer_identity*)item)->getTarget();
+    }
+    if (!item || !is_struct_type(item))
+        luaL_error(state, "df.bulk_read(): container items must be structs");
+
+    auto stype = (struct_identity*)item;
+    uint8_t *ptr = (uint8_t*)get_object_ref(state, 1);
+    if (count < 0)
+        count = cid->get_item_count(ptr, container_identity::COUNT_READ);
+    type_identity *slot_type = by_pointer ? &df::identity_traits<void*>::identity : item;
+
+    // Resolve the requested fields
+    int nfields = lua_rawlen(state, 2);
+    std::vector<BulkColumn> columns(nfields);
+    for (int i = 0; i < nfields; i++)
+    {
+        lua_rawgeti(state, 2, i+1);
+        init_bulk_column(state, columns[i], stype, -1);
+        lua_pop(state, 1);
+    }
+
+    // Filter: either a table of path = value pairs, or a function
+    // receiving the field values of each item in order.
+    bool filter_fn = false;
+    std::vector<BulkColumn> conds;
+    int cond_values = 0;
+    if (argc >= 3 && !lua_isnil(state, 3))
+    {
+        if (lua_isfunction(state, 3))
+            filter_fn = true;
+        else if (lua_istable(state, 3))
+        {
+            lua_newtable(state);
+            cond_values = lua_gettop(state);
+            lua_pushnil(state);
+            while (lua_next(state, 3))
+            {
+                conds.emplace_back();
+                init_bulk_column(state, conds.back(), stype, -2);
+                lua_rawseti(state, cond_values, conds.size());
+            }
+        }
+        else
+            luaL_argerror(state, 3, "function or table expected");
+    }
+
+    // Result tables
+    lua_newtable(state);
+    int result = lua_gettop(state);
+    for (int i = 0; i < nfields; i++)
+    {
+        lua_createtable(state, count, 0);
+        lua_setfield(state, result, columns[i].name.c_str());
+    }
+    lua_createtable(state, count, 0);
+    int indices = lua_gettop(state);
+    for (int i = 0; i < nfields; i++)
+        lua_getfield(state, result, columns[i].name.c_str());
+    int first_col = indices + 1;
+
+    luaL_checkstack(state, nfields + 4, "df.bulk_read()");
+
+    int found = 0;
+    for (int i = 0; i < count; i++)
+    {
+        void *obj = cid->get_item_pointer(slot_type, ptr, i);
+        if (by_pointer)
+            obj = *(void**)obj;
+        if (!obj)
+            continue;
+
+        bool ok = true;
+        for (size_t j = 0; ok && j < conds.size(); j++)
+        {
+            conds[j].push(state, 1, obj);
+            lua_rawgeti(state, cond_values, j+1);
+            ok = lua_rawequal(state, -1, -2);
+            lua_pop(state, 2);
+        }
+        if (!ok)
+            continue;
+
+        if (filter_fn)
+        {
+            lua_pushvalue(state, 3);
+            for (int j = 0; j < nfields; j++)
+                columns[j].push(state, 1, obj);
+            lua_call(state, nfields, 1);
+            ok = lua_toboolean(state, -1);
+            lua_pop(state, 1);
+            if (!ok)
+                continue;
+        }
+
+        found++;
+        for (int j = 0; j < nfields; j++)
+        {
+            columns[j].push(state, 1, obj);
+            lua_rawseti(state, first_col + j, found);
+        }
+        lua_pushinteger(state, i);
+        lua_rawseti(state, indices, found);
+    }
+
+    lua_settop(state, indices);
+    lua_pushinteger(state, found);
+    lua_insert(state, indices);
+    return 3;
+}
+
+/*
+ * Upvalues of field handle closures, after UPVAL_TYPETABLE and
+ * UPVAL_METATABLE (the metatable of the type, for error messages).
+ */
+#define UPVAL_HANDLE_PATH lua_upvalueindex(3)
+#define UPVAL_HANDLE_TYPE lua_upvalueindex(4)
+#define UPVAL_HANDLE_NAME lua_upvalueindex(5)
+#define UPVAL_HANDLE_LAST_META lua_upvalueindex(6)
+
+/**
+ * Verify that the argument is a ref to the handle's type or a subclass.
+ * The metatable of the last accepted object is cached, so repeated calls
+ * with objects of the same type only do a single comparison.
+ */
+static void *check_handle_object(lua_State *state, int obj)
+{
+    if (lua_getmetatable(state, obj))
+    {
+        if (lua_rawequal(state, -1, UPVAL_HANDLE_LAST_META))
+        {
+            lua_pop(state, 1);
+            return get_object_ref(state, obj);
+        }
+        lua_pop(state, 1);
+    }
+
+    auto type = (struct_identity*)lua_touserdata(state, UPVAL_HANDLE_TYPE);
+    auto id = get_object_identity(state, obj, "field handle", false, true);
+    if (!is_struct_type(id) || !type->is_subclass((struct_identity*)id))
+        field_error(state, UPVAL_HANDLE_NAME, "object of a different type", "access");
+
+    lua_replace(state, UPVAL_HANDLE_LAST_META);
+    return get_object_ref(state, obj);
+}
+
+static int field_handle_get(lua_State *state)
+{
+    if (lua_gettop(state) != 1)
+        luaL_error(state, "Usage: getter(object)");
+
+    auto path = (FieldPath*)lua_touserdata(state, UPVAL_HANDLE_PATH);
+    path->push(state, UPVAL_HANDLE_NAME, check_handle_object(state, 1));
+    return 1;
+}
+
+static int field_handle_set(lua_State *state)
+{
+    if (lua_gettop(state) != 2)
+        luaL_error(state, "Usage: setter(object, value)");
+
+    auto path = (FieldPath*)lua_touserdata(state, UPVAL_HANDLE_PATH);
+    path->write(state, UPVAL_HANDLE_NAME, check_handle_object(state, 1), 2);
+    return 0;
+}
+
+static int field_path_gc(lua_State *state)
+{
+    auto path = (FieldPath*)lua_touserdata(state, 1);
+    path->~FieldPath();
+    return 0;
+}
+
+/**
+ * Function: df.fieldhandle(type, path)
+ *
+ * Returns: getter, setter
+ */
+int LuaWrapper::make_field_handle(lua_State *state)
+{
+    if (lua_gettop(state) != 2)
+        luaL_error(state, "Usage: df.fieldhandle(type, path)");
+
+    const char *name = luaL_checkstring(state, 2);
+    auto id = get_object_identity(state, 1, "df.fieldhandle()", true, true);
+    if (!is_struct_type(id))
+        luaL_error(state, "df.fieldhandle(): struct type expected");
+
+    // The resolved path lives in a userdata shared by both closures
+    int base = lua_gettop(state); // metatable
+    auto path = new (lua_newuserdata(state, sizeof(FieldPath))) FieldPath();
+    lua_newtable(state);
+    lua_pushcfunction(state, field_path_gc);
+    lua_setfield(state, -2, "__gc");
+    lua_setmetatable(state, -2);
+
+    std::string error;
+    if (!path->resolve((struct_identity*)id, name, &error))
+        luaL_error(state, "df.fieldhandle(): %s", error.c_str());
+
+    for (lua_CFunction fn : { field_handle_get, field_handle_set })
+    {
+        lua_pushvalue(state, UPVAL_TYPETABLE);
+        lua_pushvalue(state, base);
+        lua_pushvalue(state, base+1);
+        lua_pushlightuserdata(state, id);
+        lua_pushvalue(state, 2);
+        lua_pushnil(state);
+        lua_pushcclosure(state, fn, 6);
+    }
+
+    return 2;
+}
@@ -1791,6 +1791,12 @@ static int DoAttach(lua_State *state)
         lua_setfield(state, -2, "is_instance");
         lua_getfield(state, LUA_REGISTRYINDEX, DFHACK_CAST_NAME);
         lua_setfield(state, -2, "reinterpret_cast");
+        lua_rawgetp(state, LUA_REGISTRYINDEX, &DFHACK_TYPETABLE_TOKEN);
+        lua_pushcclosure(state, bulk_read, 1);
+        lua_setfield(state, -2, "bulk_read");
+        lua_rawgetp(state, LUA_REGISTRYINDEX, &DFHACK_TYPETABLE_TOKEN);
+        lua_pushcclosure(state, make_field_handle, 1);
+        lua_setfield(state, -2, "fieldhandle");
 
         lua_pushlightuserdata(state, NULL);
         lua_setfield(state, -2, "NULL");
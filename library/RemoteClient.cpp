@@ -53,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <cstdlib>
 #include <sstream>
 
+#include <algorithm>
 #include <memory>
 
 #include "json/json.h"
@@ -94,6 +95,8 @@ RemoteClient::RemoteClient(color_ostream *default_output)
     active = false;
     socket = new CActiveSocket();
     suspend_ready = false;
+    protocol_version = 1;
+    next_seq = 1;
 
     if (!p_default_output)
     {
@@ -186,7 +189,7 @@ bool RemoteClient::connect(int port)
 
     RPCHandshakeHeader header;
     memcpy(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic));
-    header.version = 1;
+    header.version = 2;
 
     if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
     {
@@ -203,13 +206,15 @@ bool RemoteClient::connect(int port)
     }
 
     if (memcmp(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic)) ||
-        header.version != 1)
+        header.version < 1 || header.version > 2)
     {
         default_output().printerr("Invalid handshake response.\n");
         socket->Close();
         return active = false;
     }
 
+    protocol_version = header.version;
+
     bind_call.name = "BindMethod";
     bind_call.p_client = this;
     bind_call.id = 0;
@@ -233,6 +238,7 @@ void RemoteClient::disconnect()
     }
 
     socket->Close();
+    fail_pending(CR_LINK_FAILURE);
 }
 
 bool RemoteClient::bind(color_ostream &out, RemoteFunctionBase *function,
@@ -308,6 +314,68 @@ int RemoteClient::resume_game()
         return -1;
 }
 
+void RemoteBatch::add(RemoteFunctionBase *function)
+{
+    auto call = batch_call.in()->add_calls();
+    call->set_id(function->id);
+    function->in()->SerializeToString(call->mutable_input());
+    functions.push_back(function);
+}
+
+void RemoteBatch::clear()
+{
+    batch_call.reset();
+    functions.clear();
+    results.clear();
+}
+
+command_result RemoteBatch::execute(color_ostream &out)
+{
+    results.clear();
+
+    for (auto fn : functions)
+    {
+        if (!fn->isValid())
+        {
+            out.printerr("Batching an unbound RPC function %s::%s.\n",
+                         fn->plugin.c_str(), fn->name.c_str());
+            return CR_NOT_IMPLEMENTED;
+        }
+    }
+
+    if (!batch_call.bind(out, client, "RunBatch"))
+        return CR_NOT_IMPLEMENTED;
+
+    command_result rv = batch_call(out);
+    if (rv != CR_OK)
+        return rv;
+
+    auto reply = batch_call.out();
+
+    for (size_t i = 0; i < functions.size(); i++)
+    {
+        if (int(i) >= reply->results_size())
+        {
+            results.push_back(CR_LINK_FAILURE);
+            continue;
+        }
+
+        auto &result = reply->results(i);
+        command_result res = command_result(result.result());
+
+        if (res == CR_OK && !functions[i]->out()->ParseFromString(result.output()))
+        {
+            out.printerr("In batched call to %s::%s: error parsing received result.\n",
+                         functions[i]->plugin.c_str(), functions[i]->name.c_str());
+            res = CR_LINK_FAILURE;
+        }
+
+        results.push_back(res);
+    }
+
+    return CR_OK;
+}
+
 void RPCFunctionBase::reset(bool free)
 {
     if (free)
@@ -365,100 +433,306 @@ bool sendRemoteMessage(CSimpleSocket *socket, int16_t id, const MessageLite *msg
     return (got == fullsz);
 }
 
-command_result RemoteFunctionBase::execute(color_ostream &out,
-                                           const message_type *input, message_type *output)
+int32_t RemoteClient::send_call(color_ostream &out, RemoteFunctionBase *function,
+                                const message_type *input, message_type *output, bool unordered)
 {
-    if (!isValid())
+    int size = input->ByteSize();
+    int prefix = sizeof(RPCMessageHeader);
+
+    if (size > RPCMessageHeader::MAX_MESSAGE_SIZE)
     {
-        out.printerr("Calling an unbound RPC function %s::%s.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_NOT_IMPLEMENTED;
+        out.printerr("In call to %s::%s: message too large: %d.\n",
+                     function->plugin.c_str(), function->name.c_str(), size);
+        return -1;
     }
 
-    if (!p_client->socket->IsSocketValid())
+    std::lock_guard<std::mutex> send_lock(send_mutex);
+
+    int32_t seq;
     {
-        out.printerr("In call to %s::%s: invalid socket.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_LINK_FAILURE;
+        std::lock_guard<std::mutex> lock(call_mutex);
+        seq = next_seq++;
+        if (next_seq <= 0)
+            next_seq = 1;
+
+        PendingCall &call = pending[seq];
+        call.function = function;
+        call.out = &out;
+        call.output = output;
+        call.done = false;
+        call.result = CR_LINK_FAILURE;
     }
 
-    int send_size = input->ByteSize();
+    if (protocol_version >= 2)
+        prefix += sizeof(RPCSequenceHeader);
+
+    std::unique_ptr<uint8_t[]> data(new uint8_t[prefix + size]);
+    RPCMessageHeader *hdr = (RPCMessageHeader*)data.get();
+
+    hdr->id = function->id;
+    hdr->size = prefix + size - sizeof(RPCMessageHeader);
 
-    if (send_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    if (protocol_version >= 2)
     {
-        out.printerr("In call to %s::%s: message too large: %d.\n",
-                     this->plugin.c_str(), this->name.c_str(), send_size);
-        return CR_LINK_FAILURE;
+        RPCSequenceHeader *seq_hdr = (RPCSequenceHeader*)(data.get() + sizeof(RPCMessageHeader));
+        seq_hdr->seq = seq;
+        seq_hdr->flags = unordered ? RPC_CALL_UNORDERED : 0;
     }
 
-    if (!sendRemoteMessage(p_client->socket, id, input, true))
+    input->SerializeWithCachedSizesToArray(data.get() + prefix);
+
+    if (socket->Send(data.get(), prefix + size) != prefix + size)
     {
         out.printerr("In call to %s::%s: I/O error in send.\n",
-                     this->plugin.c_str(), this->name.c_str());
-        return CR_LINK_FAILURE;
+                     function->plugin.c_str(), function->name.c_str());
+        std::lock_guard<std::mutex> lock(call_mutex);
+        pending.erase(seq);
+        return -1;
     }
 
-    color_ostream_proxy text_decoder(out);
-    CoreTextNotification text_data;
+    return seq;
+}
 
-    output->Clear();
+/*
+ * Reads one message from the server, and passes it to the pending call it
+ * belongs to. With protocol version 1 the replies come in the order of the
+ * requests, so they belong to the oldest call.
+ */
+bool RemoteClient::receive_reply(color_ostream &out)
+{
+    RPCMessageHeader header;
+    RPCSequenceHeader seq_header = { 0, 0 };
 
-    for (;;) {
-        RPCMessageHeader header;
+    if (!readFullBuffer(socket, &header, sizeof(header)))
+    {
+        out.printerr("In RPC client: I/O error in receive header.\n");
+        return false;
+    }
+
+    //out.print("Received %d:%d\n", header.id, header.size);
+
+    bool failed = ((DFHack::DFHackReplyCode)header.id == RPC_REPLY_FAIL);
+    std::unique_ptr<uint8_t[]> buf;
+    int size = 0;
+
+    if (failed)
+    {
+        if (protocol_version >= 2 && !readFullBuffer(socket, &seq_header, sizeof(seq_header)))
+        {
+            out.printerr("In RPC client: I/O error in receive header.\n");
+            return false;
+        }
+    }
+    else
+    {
+        size = header.size;
+        int min_size = (protocol_version >= 2 ? sizeof(seq_header) : 0);
 
-        if (!readFullBuffer(p_client->socket, &header, sizeof(header)))
+        if (size < min_size || size > RPCMessageHeader::MAX_MESSAGE_SIZE)
         {
-            out.printerr("In call to %s::%s: I/O error in receive header.\n",
-                         this->plugin.c_str(), this->name.c_str());
-            return CR_LINK_FAILURE;
+            out.printerr("In RPC client: invalid received size %d.\n", size);
+            return false;
         }
 
-        //out.print("Received %d:%d\n", header.id, header.size);
+        buf.reset(new uint8_t[size]);
 
-        if ((DFHack::DFHackReplyCode)header.id == RPC_REPLY_FAIL)
-            return header.size == CR_OK ? CR_FAILURE : command_result(header.size);
+        if (!readFullBuffer(socket, buf.get(), size))
+        {
+            out.printerr("In RPC client: I/O error in receive %d bytes of data.\n", size);
+            return false;
+        }
 
-        if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+        if (min_size)
         {
-            out.printerr("In call to %s::%s: invalid received size %d.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
-            return CR_LINK_FAILURE;
+            memcpy(&seq_header, buf.get(), sizeof(seq_header));
+            size -= sizeof(seq_header);
         }
+    }
+
+    const uint8_t *payload = buf.get() + (protocol_version >= 2 ? sizeof(seq_header) : 0);
+
+    std::lock_guard<std::mutex> lock(call_mutex);
+
+    auto it = (protocol_version >= 2 ? pending.find(seq_header.seq) : pending.begin());
+    if (it == pending.end())
+        return true;
+
+    PendingCall &call = it->second;
 
-        uint8_t *buf = new uint8_t[header.size];
+    // Left behind by a discarded future; only waiting for the reply
+    if (!call.out)
+    {
+        if (failed || header.id == RPC_REPLY_RESULT)
+            pending.erase(it);
+        return true;
+    }
+
+    if (failed)
+    {
+        call.result = header.size == CR_OK ? CR_FAILURE : command_result(header.size);
+        call.done = true;
+        return true;
+    }
 
-        if (!readFullBuffer(p_client->socket, buf, header.size))
+    switch (header.id) {
+    case RPC_REPLY_RESULT:
+        call.done = true;
+        call.result = CR_OK;
+        if (!call.output->ParseFromArray(payload, size))
         {
-            out.printerr("In call to %s::%s: I/O error in receive %d bytes of data.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
-            return CR_LINK_FAILURE;
+            call.out->printerr("In call to %s::%s: error parsing received result.\n",
+                               call.function->plugin.c_str(), call.function->name.c_str());
+            call.result = CR_LINK_FAILURE;
         }
+        break;
 
-        switch (header.id) {
-        case RPC_REPLY_RESULT:
-            if (!output->ParseFromArray(buf, header.size))
-            {
-                out.printerr("In call to %s::%s: error parsing received result.\n",
-                             this->plugin.c_str(), this->name.c_str());
-                delete[] buf;
+    case RPC_REPLY_TEXT:
+        {
+            CoreTextNotification text_data;
+            if (text_data.ParseFromArray(payload, size))
+                color_ostream_proxy(*call.out).decode(&text_data);
+            else
+                call.out->printerr("In call to %s::%s: received invalid text data.\n",
+                                   call.function->plugin.c_str(), call.function->name.c_str());
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
+command_result RemoteClient::wait_call(color_ostream &out, int32_t seq)
+{
+    std::lock_guard<std::mutex> recv_lock(recv_mutex);
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(call_mutex);
+
+            auto it = pending.find(seq);
+            if (it == pending.end())
                 return CR_LINK_FAILURE;
+
+            if (it->second.done)
+            {
+                command_result res = it->second.result;
+                pending.erase(it);
+                return res;
             }
+        }
 
-            delete[] buf;
-            return CR_OK;
+        if (!receive_reply(out))
+            fail_pending(CR_LINK_FAILURE);
+    }
+}
 
-        case RPC_REPLY_TEXT:
-            text_data.Clear();
-            if (text_data.ParseFromArray(buf, header.size))
-                text_decoder.decode(&text_data);
-            else
-                out.printerr("In call to %s::%s: received invalid text data.\n",
-                             this->plugin.c_str(), this->name.c_str());
-            break;
+void RemoteClient::abandon_call(int32_t seq)
+{
+    std::lock_guard<std::mutex> lock(call_mutex);
+
+    auto it = pending.find(seq);
+    if (it == pending.end())
+        return;
+
+    if (it->second.done)
+        pending.erase(it);
+    else
+    {
+        it->second.out = NULL;
+        it->second.output = NULL;
+    }
+}
 
-        default:
-            break;
+void RemoteClient::fail_pending(command_result res)
+{
+    std::lock_guard<std::mutex> lock(call_mutex);
+
+    for (auto it = pending.begin(); it != pending.end(); )
+    {
+        if (!it->second.out)
+            it = pending.erase(it);
+        else
+        {
+            if (!it->second.done)
+            {
+                it->second.done = true;
+                it->second.result = res;
+            }
+            ++it;
         }
-        delete[] buf;
     }
 }
+
+command_result RemoteFunctionBase::execute(color_ostream &out,
+                                           const message_type *input, message_type *output)
+{
+    if (!isValid())
+    {
+        out.printerr("Calling an unbound RPC function %s::%s.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return CR_NOT_IMPLEMENTED;
+    }
+
+    if (!p_client->socket->IsSocketValid())
+    {
+        out.printerr("In call to %s::%s: invalid socket.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return CR_LINK_FAILURE;
+    }
+
+    output->Clear();
+
+    int32_t seq = p_client->send_call(out, this, input, output, false);
+    if (seq < 0)
+        return CR_LINK_FAILURE;
+
+    return p_client->wait_call(out, seq);
+}
+
+std::future<command_result> RemoteFunctionBase::execute_async(color_ostream &out,
+                                                              const message_type *input,
+                                                              message_type *output,
+                                                              bool unordered)
+{
+    auto failed = [](command_result res) {
+        return std::async(std::launch::deferred, [res]() { return res; });
+    };
+
+    if (!p_client)
+        return failed(CR_NOT_IMPLEMENTED);
+
+    if (!isValid())
+    {
+        out.printerr("Calling an unbound RPC function %s::%s.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return failed(CR_NOT_IMPLEMENTED);
+    }
+
+    if (!p_client->socket->IsSocketValid())
+    {
+        out.printerr("In call to %s::%s: invalid socket.\n",
+                     this->plugin.c_str(), this->name.c_str());
+        return failed(CR_LINK_FAILURE);
+    }
+
+    output->Clear();
+
+    RemoteClient *client = p_client;
+    int32_t seq = client->send_call(out, this, input, output, unordered);
+    if (seq < 0)
+        return failed(CR_LINK_FAILURE);
+
+    // Drops the call if the future is destroyed before get()
+    std::shared_ptr<int32_t> handle(new int32_t(seq), [client](int32_t *pseq) {
+        client->abandon_call(*pseq);
+        delete pseq;
+    });
+
+    color_ostream *stream = &out;
+    return std::async(std::launch::deferred, [client, stream, handle]() {
+        return client->wait_call(*stream, *handle);
+    });
+}
@@ -54,11 +54,25 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <thread>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include "json/json.h"
 
 using namespace DFHack;
@@ -72,7 +86,12 @@ bool sendRemoteMessage(CSimpleSocket *socket, int16_t id,
                         const ::google::protobuf::MessageLite *msg, bool size_ready);
 
 std::mutex ServerMain::access_{};
-bool ServerMain::blocked_{};
+std::atomic<bool> ServerMain::blocked_{false};
+int ServerMain::shared_users_{};
+std::condition_variable ServerMain::shared_done_{};
+
+// Highest protocol version supported by the server
+static const int RPC_PROTOCOL_VERSION = 2;
 
 namespace {
     struct BlockedException : std::exception {
@@ -94,6 +113,24 @@ namespace DFHack {
                 throw BlockedException{};
         }
     };
+
+    // Like BlockGuard, but lets the call run concurrently with other calls;
+    // ServerMain::block() waits for these calls to finish instead.
+    struct SharedBlockGuard {
+        SharedBlockGuard()
+        {
+            std::lock_guard<std::mutex> lock{ServerMain::access_};
+            if (ServerMain::blocked_)
+                throw BlockedException{};
+            ServerMain::shared_users_++;
+        }
+        ~SharedBlockGuard()
+        {
+            std::lock_guard<std::mutex> lock{ServerMain::access_};
+            if (--ServerMain::shared_users_ == 0)
+                ServerMain::shared_done_.notify_all();
+        }
+    };
 }
 
 RPCService::RPCService()
@@ -154,6 +191,8 @@ ServerConnection::ServerConnection(CActiveSocket *socket)
     : socket(socket), stream(this)
 {
     in_error = false;
+    protocol_version = 1;
+    async_calls = 0;
 
     core_service = new CoreService();
     core_service->finalize(this, &functions);
@@ -205,6 +244,100 @@ ServerFunctionBase *ServerConnection::findFunction(color_ostream &out, const std
     return svc->getFunction(name);
 }
 
+bool ServerConnection::isAllowed(ServerFunctionBase *fn)
+{
+    return (fn->flags & SF_ALLOW_REMOTE) == SF_ALLOW_REMOTE ||
+           strcmp(socket->GetClientAddr(), "127.0.0.1") == 0;
+}
+
+bool ServerConnection::canRunUnordered(ServerFunctionBase *fn)
+{
+    if (!(fn->flags & SF_DONT_SUSPEND) || !isAllowed(fn))
+        return false;
+
+    // These use the state of the connection (the core lock it holds, the
+    // bound function table, the shared message templates of the calls in
+    // a batch), so they must run on the connection thread.
+    static const char *const stateful[] = {
+        "BindMethod", "CoreSuspend", "CoreResume", "RunBatch"
+    };
+    for (auto name : stateful)
+        if (fn == core_service->getFunction(name))
+            return false;
+
+    return true;
+}
+
+command_result ServerConnection::runBatch(color_ostream &stream,
+                                          const dfproto::CoreBatchRequest *in,
+                                          dfproto::CoreBatchReply *out)
+{
+    ServerFunctionBase *batch_fn = core_service->getFunction("RunBatch");
+
+    // Resolve everything first, so that the core is suspended only once
+    // and only if some call actually needs it.
+    std::vector<ServerFunctionBase*> calls;
+    bool need_suspend = false;
+
+    for (int i = 0; i < in->calls_size(); i++)
+    {
+        ServerFunctionBase *fn = vector_get(functions, in->calls(i).id());
+
+        if (!fn || fn == batch_fn)
+        {
+            stream.printerr("RPC batch call of invalid id %d\n", in->calls(i).id());
+            fn = NULL;
+        }
+        else if (!isAllowed(fn))
+        {
+            stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
+            fn = NULL;
+        }
+        else if (!(fn->flags & SF_DONT_SUSPEND))
+            need_suspend = true;
+
+        calls.push_back(fn);
+    }
+
+    CoreSuspender suspend(std::defer_lock);
+    if (need_suspend)
+        suspend.lock();
+
+    for (int i = 0; i < in->calls_size(); i++)
+    {
+        ServerFunctionBase *fn = calls[i];
+        auto result = out->add_results();
+        command_result res = CR_FAILURE;
+
+        if (!fn)
+        {
+            result->set_result(res);
+            continue;
+        }
+
+        const std::string &input = in->calls(i).input();
+
+        if (!fn->in()->ParseFromString(input))
+            stream.printerr("In call to %s: could not decode input args.\n", fn->name);
+        else
+            res = fn->execute(stream);
+
+        result->set_result(res);
+
+        int out_size = 0;
+        if (res == CR_OK)
+        {
+            fn->out()->SerializeToString(result->mutable_output());
+            out_size = (int)result->output().size();
+        }
+
+        fn->reset((fn->flags & SF_CALLED_ONCE) ||
+                  (out_size > 128*1024 || input.size() > 32*1024));
+    }
+
+    return CR_OK;
+}
+
 void ServerConnection::connection_ostream::flush_proxy()
 {
     if (owner->in_error)
@@ -228,7 +361,7 @@ void ServerConnection::connection_ostream::flush_proxy()
 
     buffer.clear();
 
-    if (!sendRemoteMessage(owner->socket, RPC_REPLY_TEXT, &msg, false))
+    if (!owner->sendMessage(RPC_REPLY_TEXT, &msg, false, seq))
     {
         owner->in_error = true;
         Core::printerr("Error writing text into client socket.\n");
@@ -245,10 +378,138 @@ void ServerConnection::Accepted(CActiveSocket* socket)
         },  socket}.detach();
 }
 
+namespace DFHack {
+    struct ServerOutputQueue {
+        std::mutex mutex;
+        std::string data;
+        // wakes up the event loop to write the data out
+        std::function<void()> notify;
+    };
+}
+
+bool ServerConnection::sendData(const void *data, int size)
+{
+    if (out_queue)
+    {
+        {
+            std::lock_guard<std::mutex> lock(out_queue->mutex);
+            out_queue->data.append((const char*)data, size);
+        }
+        out_queue->notify();
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(send_mutex);
+    return socket->Send((const uint8_t*)data, size) == size;
+}
+
+bool ServerConnection::sendMessage(int16_t id, const MessageLite *msg, bool size_ready, int32_t seq)
+{
+    if (!out_queue && protocol_version < 2)
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        return sendRemoteMessage(socket, id, msg, size_ready);
+    }
+
+    int msg_size = size_ready ? msg->GetCachedSize() : msg->ByteSize();
+    size_t prefix = sizeof(RPCMessageHeader);
+
+    RPCMessageHeader header;
+    header.id = id;
+    header.size = msg_size;
+
+    RPCSequenceHeader seq_header = { seq, 0 };
+    if (protocol_version >= 2)
+        header.size += sizeof(seq_header);
+
+    std::string data((const char*)&header, sizeof(header));
+    if (protocol_version >= 2)
+    {
+        data.append((const char*)&seq_header, sizeof(seq_header));
+        prefix += sizeof(seq_header);
+    }
+    data.resize(prefix + msg_size);
+    msg->SerializeWithCachedSizesToArray((uint8_t*)&data[prefix]);
+
+    return sendData(data.data(), data.size());
+}
+
+bool ServerConnection::sendFailure(command_result res, int32_t seq)
+{
+    std::string data;
+
+    RPCMessageHeader header;
+    header.id = RPC_REPLY_FAIL;
+    header.size = res;
+    data.append((const char*)&header, sizeof(header));
+
+    if (protocol_version >= 2)
+    {
+        RPCSequenceHeader seq_header = { seq, 0 };
+        data.append((const char*)&seq_header, sizeof(seq_header));
+    }
+
+    return sendData(data.data(), data.size());
+}
+
+bool ServerConnection::startAsyncCall(ServerFunctionBase *fn, const uint8_t *data, int size, int32_t seq)
+{
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        if (async_calls >= MAX_ASYNC_CALLS)
+            return false;
+        async_calls++;
+    }
+
+    auto input = fn->make_in();
+    if (!input->ParseFromArray(data, size))
+    {
+        delete input;
+        std::lock_guard<std::mutex> lock(async_mutex);
+        async_calls--;
+        return false;
+    }
+
+    std::thread{[this, fn, input, seq]() {
+        std::unique_ptr<MessageLite> in(input), out(fn->make_out());
+        connection_ostream call_stream(this, seq);
+        command_result res;
+
+        try {
+            SharedBlockGuard guard;
+            res = fn->execute(call_stream, in.get(), out.get());
+        } catch (BlockedException &) {
+            res = CR_LINK_FAILURE;
+        }
+
+        call_stream.flush();
+
+        int out_size = out->ByteSize();
+        if (res == CR_OK && out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+            res = CR_LINK_FAILURE;
+
+        if (!in_error)
+        {
+            if (res == CR_OK)
+                sendMessage(RPC_REPLY_RESULT, out.get(), true, seq);
+            else
+                sendFailure(res, seq);
+        }
+
+        std::lock_guard<std::mutex> lock(async_mutex);
+        if (--async_calls == 0)
+            async_done.notify_all();
+    }}.detach();
+
+    return true;
+}
+
 void ServerConnection::threadFn()
 {
     color_ostream_proxy out(Core::getInstance().getConsole());
 
+    Core::setSuspendClient(stl_sprintf("RPC %s:%d", socket->GetClientAddr(), int(socket->GetClientPort())));
+
     /* Handshake */
 
     {
@@ -268,7 +529,7 @@ void ServerConnection::threadFn()
         }
 
         memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
-        header.version = 1;
+        header.version = protocol_version = std::min(header.version, RPC_PROTOCOL_VERSION);
 
         if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
         {
@@ -310,99 +571,593 @@ void ServerConnection::threadFn()
 
         //out.print("Handling %d:%d\n", header.id, header.size);
 
-        // Find and call the function
-        int in_size = header.size;
-        BlockGuard lock;
+        if (!handleRequest(header.id, std::move(buf), header.size))
+            break;
+    }
 
-        ServerFunctionBase *fn = vector_get(functions, header.id);
-        MessageLite *reply = NULL;
-        command_result res = CR_FAILURE;
+    // Calls running out of order still refer to this connection
+    {
+        in_error = true;
+        std::unique_lock<std::mutex> lock(async_mutex);
+        async_done.wait(lock, [this]() -> bool { return async_calls == 0; });
+    }
 
-        if (!fn)
+    std::cerr << "Shutting down client connection." << endl;
+}
+
+bool ServerConnection::handleRequest(int16_t id, std::unique_ptr<uint8_t[]> buf, int size,
+                                     CoreSuspender *batch)
+{
+    color_ostream_proxy out(Core::getInstance().getConsole());
+
+    RPCSequenceHeader seq_header = { 0, 0 };
+    const uint8_t *payload = buf.get();
+
+    if (protocol_version >= 2)
+    {
+        if (size < int(sizeof(seq_header)))
         {
-            stream.printerr("RPC call of invalid id %d\n", header.id);
+            out.printerr("In RPC server: request without a sequence header.\n");
+            return false;
+        }
+        memcpy(&seq_header, payload, sizeof(seq_header));
+        payload += sizeof(seq_header);
+        size -= sizeof(seq_header);
+    }
+
+    // Calls that don't need the core may complete out of order,
+    // if the client allows it. The event loop runs everything in order.
+    if ((seq_header.flags & RPC_CALL_UNORDERED) && !out_queue)
+    {
+        ServerFunctionBase *fn = vector_get(functions, id);
+        if (fn && canRunUnordered(fn) && startAsyncCall(fn, payload, size, seq_header.seq))
+            return true;
+    }
+
+    stream.seq = seq_header.seq;
+
+    // Find and call the function
+    int in_size = size;
+
+    // A batch may already hold the core lock from an earlier request, so it
+    // must not wait for access_ while calls holding access_ wait for the core.
+    // The shared guard only holds access_ while it registers the call.
+    std::unique_ptr<BlockGuard> lock;
+    std::unique_ptr<SharedBlockGuard> shared_lock;
+    if (batch)
+        shared_lock.reset(new SharedBlockGuard());
+    else
+        lock.reset(new BlockGuard());
+
+    ServerFunctionBase *fn = vector_get(functions, id);
+    MessageLite *reply = NULL;
+    command_result res = CR_FAILURE;
+
+    if (!fn)
+    {
+        stream.printerr("RPC call of invalid id %d\n", id);
+    }
+    else
+    {
+        if (!isAllowed(fn))
+        {
+            stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
+        }
+        else if (!fn->in()->ParseFromArray(payload, size))
+        {
+            stream.printerr("In call to %s: could not decode input args.\n", fn->name);
         }
         else
         {
-            if (((fn->flags & SF_ALLOW_REMOTE) != SF_ALLOW_REMOTE) && strcmp(socket->GetClientAddr(), "127.0.0.1") != 0)
+            buf.reset();
+
+            reply = fn->out();
+
+            if (fn->flags & SF_DONT_SUSPEND)
             {
-                stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
+                // The function manages locking itself, and may need
+                // the game to run while it waits.
+                if (batch && batch->owns_lock())
+                    batch->unlock();
+                res = fn->execute(stream);
             }
-            else if (!fn->in()->ParseFromArray(buf.get(), header.size))
+            else if (batch)
             {
-                stream.printerr("In call to %s: could not decode input args.\n", fn->name);
+                if (!batch->owns_lock())
+                    batch->lock();
+                res = fn->execute(stream);
             }
             else
             {
-                buf.reset();
+                CoreSuspender suspend;
+                res = fn->execute(stream);
+            }
+        }
+    }
+
+    // Flush all text output
+    if (in_error)
+        return false;
+
+    //out.print("Answer %d:%d\n", res, reply);
+
+    // Send reply
+    int out_size = (reply ? reply->ByteSize() : 0);
+
+    if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        stream.printerr("In call to %s: reply too large: %d.\n",
+                            (fn ? fn->name : "UNKNOWN"), out_size);
+        res = CR_LINK_FAILURE;
+    }
 
-                reply = fn->out();
+    stream.flush();
 
-                if (fn->flags & SF_DONT_SUSPEND)
+    if (res == CR_OK && reply)
+    {
+        if (!sendMessage(RPC_REPLY_RESULT, reply, true, seq_header.seq))
+        {
+            out.printerr("In RPC server: I/O error in send result.\n");
+            return false;
+        }
+    }
+    else
+    {
+        if (!sendFailure(res, seq_header.seq))
+        {
+            out.printerr("In RPC server: I/O error in send failure code.\n");
+            return false;
+        }
+    }
+
+    // Cleanup
+    if (fn)
+    {
+        fn->reset((fn->flags & SF_CALLED_ONCE) ||
+                  (out_size > 128*1024 || in_size > 32*1024));
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+
+namespace DFHack {
+    /*
+     * Serves all connections from one thread with epoll, instead of using
+     * a blocking thread per connection. Complete requests are handed to a
+     * small pool of workers, and replies are queued per connection and
+     * written out by the event loop.
+     *
+     * Each connection always goes to the same worker, so that calls like
+     * CoreSuspend, which keep the core locked between requests, stay on one
+     * thread. A worker runs everything queued for it since it last woke up,
+     * taking the core suspension once for all the calls that need it.
+     */
+    class ServerEventLoop {
+        struct Request {
+            int16_t id;
+            int size;
+            std::unique_ptr<uint8_t[]> data;
+        };
+
+        struct Connection {
+            int fd;
+            size_t worker;
+            std::unique_ptr<ServerConnection> conn;
+
+            // only used by the event loop thread
+            bool handshake_done = false;
+            bool want_write = false;
+            std::string in_buf;
+            std::string out_buf;
+            size_t out_pos = 0;
+
+            // guarded by the mutex of the worker
+            std::deque<Request> requests;
+            bool scheduled = false;
+
+            std::atomic<bool> closing{false};
+        };
+        typedef std::shared_ptr<Connection> ConnectionPtr;
+
+        struct Worker {
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::deque<ConnectionPtr> queue;
+            std::thread thread;
+        };
+
+        int epoll_fd;
+        int wake_fd;
+        std::atomic<bool> stopping{false};
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        size_t next_worker = 0;
+        std::map<int, ConnectionPtr> connections;
+
+        // fds of connections that have output queued or asked to be closed
+        std::mutex dirty_mutex;
+        std::vector<int> dirty;
+
+        void wake(int fd);
+        void watch(int fd, uint32_t events, int op = EPOLL_CTL_ADD);
+
+        void accept(CPassiveSocket &listener);
+        void read(const ConnectionPtr &conn);
+        bool parse(const ConnectionPtr &conn);
+        bool flush(const ConnectionPtr &conn);
+        void close(const ConnectionPtr &conn);
+
+        void workerFn(Worker *worker);
+        void runRequests(Worker *worker, const ConnectionPtr &conn, CoreSuspender *suspend);
+
+    public:
+        ServerEventLoop(int num_workers);
+        ~ServerEventLoop();
+
+        void run(CPassiveSocket &listener);
+    };
+}
+
+ServerEventLoop::ServerEventLoop(int num_workers)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    for (int i = 0; i < std::max(num_workers, 1); i++)
+    {
+        workers.emplace_back(new Worker());
+        Worker *worker = workers.back().get();
+        worker->thread = std::thread(&ServerEventLoop::workerFn, this, worker);
+    }
+}
+
+ServerEventLoop::~ServerEventLoop()
+{
+    stopping = true;
+    for (auto &worker : workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+        }
+        worker->cond.notify_all();
+        worker->thread.join();
+    }
+
+    connections.clear();
+
+    ::close(wake_fd);
+    ::close(epoll_fd);
+}
+
+void ServerEventLoop::wake(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(dirty_mutex);
+        dirty.push_back(fd);
+    }
+    uint64_t one = 1;
+    if (::write(wake_fd, &one, sizeof(one)) < 0)
+    {
+        // the counter is saturated, so the loop is going to wake up anyway
+    }
+}
+
+void ServerEventLoop::watch(int fd, uint32_t events, int op)
+{
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+void ServerEventLoop::run(CPassiveSocket &listener)
+{
+    int listen_fd = listener.GetSocketDescriptor();
+    listener.SetNonblocking();
+
+    watch(listen_fd, EPOLLIN);
+    watch(wake_fd, EPOLLIN);
+
+    std::cerr << "RPC server: using the event loop with " << workers.size() << " workers." << endl;
+
+    epoll_event events[64];
+
+    while (!stopping && !ServerMain::is_blocked())
+    {
+        int count = epoll_wait(epoll_fd, events, 64, 250);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "RPC server: epoll_wait failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd)
+            {
+                accept(listener);
+            }
+            else if (fd == wake_fd)
+            {
+                uint64_t value;
+                while (::read(wake_fd, &value, sizeof(value)) > 0) {}
+
+                std::vector<int> fds;
                 {
-                    res = fn->execute(stream);
+                    std::lock_guard<std::mutex> lock(dirty_mutex);
+                    fds.swap(dirty);
                 }
-                else
+
+                for (int dirty_fd : fds)
                 {
-                    CoreSuspender suspend;
-                    res = fn->execute(stream);
+                    auto it = connections.find(dirty_fd);
+                    if (it == connections.end())
+                        continue;
+                    ConnectionPtr conn = it->second;
+                    if (conn->closing || !flush(conn))
+                        close(conn);
                 }
             }
+            else
+            {
+                auto it = connections.find(fd);
+                if (it == connections.end())
+                    continue;
+                ConnectionPtr conn = it->second;
+
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    read(conn);
+                if (!conn->closing && (events[i].events & EPOLLOUT) && !flush(conn))
+                    close(conn);
+            }
         }
+    }
+}
 
-        // Flush all text output
-        if (in_error)
+void ServerEventLoop::accept(CPassiveSocket &listener)
+{
+    while (CActiveSocket *client = listener.Accept())
+    {
+        int fd = client->GetSocketDescriptor();
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        ConnectionPtr conn = std::make_shared<Connection>();
+        conn->fd = fd;
+        conn->worker = next_worker++ % workers.size();
+        conn->conn.reset(new ServerConnection(client));
+
+        auto queue = std::make_shared<ServerOutputQueue>();
+        queue->notify = [this, fd]() { wake(fd); };
+        conn->conn->out_queue = queue;
+
+        connections[fd] = conn;
+        watch(fd, EPOLLIN);
+    }
+}
+
+void ServerEventLoop::read(const ConnectionPtr &conn)
+{
+    char buf[65536];
+
+    for (;;)
+    {
+        ssize_t got = ::recv(conn->fd, buf, sizeof(buf), 0);
+        if (got > 0)
+        {
+            conn->in_buf.append(buf, got);
+            continue;
+        }
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
             break;
 
-        //out.print("Answer %d:%d\n", res, reply);
+        // closed by the client, or an error
+        close(conn);
+        return;
+    }
+
+    if (!parse(conn))
+        close(conn);
+}
+
+bool ServerEventLoop::parse(const ConnectionPtr &conn)
+{
+    size_t pos = 0;
+    std::string &in = conn->in_buf;
+
+    if (!conn->handshake_done)
+    {
+        RPCHandshakeHeader header;
 
-        // Send reply
-        int out_size = (reply ? reply->ByteSize() : 0);
+        if (in.size() < sizeof(header))
+            return true;
 
-        if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+        memcpy(&header, in.data(), sizeof(header));
+        pos = sizeof(header);
+
+        if (memcmp(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic)) ||
+            header.version < 1 || header.version > 255)
         {
-            stream.printerr("In call to %s: reply too large: %d.\n",
-                                (fn ? fn->name : "UNKNOWN"), out_size);
-            res = CR_LINK_FAILURE;
+            std::cerr << "In RPC server: invalid handshake header." << endl;
+            return false;
         }
 
-        stream.flush();
+        memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
+        header.version = conn->conn->protocol_version = std::min(header.version, RPC_PROTOCOL_VERSION);
+        conn->conn->sendData(&header, sizeof(header));
+        conn->handshake_done = true;
+
+        std::cerr << "Client connection established." << endl;
+    }
+
+    Worker *worker = workers[conn->worker].get();
+    bool scheduled = false;
+
+    while (in.size() - pos >= sizeof(RPCMessageHeader))
+    {
+        RPCMessageHeader header;
+        memcpy(&header, in.data() + pos, sizeof(header));
+
+        if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_QUIT)
+            return false;
 
-        if (res == CR_OK && reply)
+        if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
         {
-            if (!sendRemoteMessage(socket, RPC_REPLY_RESULT, reply, true))
-            {
-                out.printerr("In RPC server: I/O error in send result.\n");
-                break;
-            }
+            std::cerr << "In RPC server: invalid received size " << header.size << "." << endl;
+            return false;
         }
-        else
+
+        if (in.size() - pos - sizeof(header) < size_t(header.size))
+            break;
+
+        Request req;
+        req.id = header.id;
+        req.size = header.size;
+        req.data.reset(new uint8_t[header.size]);
+        memcpy(req.data.get(), in.data() + pos + sizeof(header), header.size);
+        pos += sizeof(header) + header.size;
+
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        conn->requests.push_back(std::move(req));
+        if (!conn->scheduled)
         {
-            header.id = RPC_REPLY_FAIL;
-            header.size = res;
+            conn->scheduled = true;
+            worker->queue.push_back(conn);
+            scheduled = true;
+        }
+    }
 
-            if (socket->Send((uint8_t*)&header, sizeof(header)) != sizeof(header))
-            {
-                out.printerr("In RPC server: I/O error in send failure code.\n");
+    in.erase(0, pos);
+
+    if (scheduled)
+        worker->cond.notify_one();
+
+    return true;
+}
+
+bool ServerEventLoop::flush(const ConnectionPtr &conn)
+{
+    auto &queue = conn->conn->out_queue;
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        conn->out_buf.append(queue->data);
+        queue->data.clear();
+    }
+
+    while (conn->out_pos < conn->out_buf.size())
+    {
+        ssize_t sent = ::send(conn->fd, conn->out_buf.data() + conn->out_pos,
+                              conn->out_buf.size() - conn->out_pos, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
+            return false;
+        }
+        conn->out_pos += sent;
+    }
+
+    if (conn->out_pos == conn->out_buf.size())
+    {
+        conn->out_buf.clear();
+        conn->out_pos = 0;
+    }
+
+    // Only ask for write readiness while something is left to send
+    bool want_write = !conn->out_buf.empty();
+    if (want_write != conn->want_write)
+    {
+        watch(conn->fd, want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN, EPOLL_CTL_MOD);
+        conn->want_write = want_write;
+    }
+
+    return true;
+}
+
+void ServerEventLoop::close(const ConnectionPtr &conn)
+{
+    conn->closing = true;
+    conn->conn->in_error = true;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    // A worker may still be using it; the socket is closed
+    // when the last reference goes away.
+    connections.erase(conn->fd);
+
+    std::cerr << "Shutting down client connection." << endl;
+}
+
+void ServerEventLoop::workerFn(Worker *worker)
+{
+    Core::setSuspendClient("RPC event loop");
+
+    std::unique_lock<std::mutex> lock(worker->mutex);
+
+    while (!stopping)
+    {
+        worker->cond.wait(lock, [&]() -> bool { return stopping || !worker->queue.empty(); });
+        if (stopping)
+            break;
+
+        std::deque<ConnectionPtr> batch;
+        batch.swap(worker->queue);
+        lock.unlock();
+
+        try {
+            CoreSuspender suspend(std::defer_lock);
+            for (auto &conn : batch)
+                runRequests(worker, conn, &suspend);
+        } catch (BlockedException &) {
+            stopping = true;
+        }
+
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void ServerEventLoop::runRequests(Worker *worker, const ConnectionPtr &conn, CoreSuspender *suspend)
+{
+    for (;;)
+    {
+        Request req;
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            if (conn->closing || conn->requests.empty())
+            {
+                conn->scheduled = false;
+                return;
             }
+            req = std::move(conn->requests.front());
+            conn->requests.pop_front();
         }
 
-        // Cleanup
-        if (fn)
+        if (!conn->conn->handleRequest(req.id, std::move(req.data), req.size, suspend))
         {
-            fn->reset((fn->flags & SF_CALLED_ONCE) ||
-                      (out_size > 128*1024 || in_size > 32*1024));
+            conn->closing = true;
+            wake(conn->fd);
         }
     }
-
-    std::cerr << "Shutting down client connection." << endl;
 }
 
+#endif
+
 namespace {
 
     struct ServerMainImpl : public ServerMain {
         CPassiveSocket socket;
+        bool listening = false;
+        bool event_loop = false;
+        int event_workers = 2;
         static void threadFn(std::promise<bool> promise, int port);
         ServerMainImpl(std::promise<bool> promise, int port);
         ~ServerMainImpl();
@@ -429,10 +1184,14 @@ ServerMainImpl::ServerMainImpl(std::promise<bool> promise, int port) :
         inFile.close();
 
         allow_remote = configJson.get("allow_remote", "false").asBool();
+        event_loop = configJson.get("event_loop", false).asBool();
+        event_workers = std::max(1, configJson.get("event_workers", 2).asInt());
     }
 
     // rewrite/normalize config file
     configJson["allow_remote"] = allow_remote;
+    configJson["event_loop"] = event_loop;
+    configJson["event_workers"] = event_workers;
     configJson["port"] = configJson.get("port", RemoteClient::DEFAULT_PORT);
 
     std::ofstream outFile(filename, std::ios_base::trunc);
@@ -449,6 +1208,7 @@ ServerMainImpl::ServerMainImpl(std::promise<bool> promise, int port) :
         promise.set_value(false);
         return;
     }
+    listening = true;
     promise.set_value(true);
 }
 
@@ -469,6 +1229,15 @@ void ServerMainImpl::threadFn(std::promise<bool> promise, int port)
 {
     ServerMainImpl server{std::move(promise), port};
 
+#ifdef __linux__
+    if (server.event_loop)
+    {
+        if (server.listening)
+            ServerEventLoop(server.event_workers).run(server.socket);
+        return;
+    }
+#endif
+
     CActiveSocket *client = nullptr;
 
     try {
@@ -487,6 +1256,7 @@ void ServerMainImpl::threadFn(std::promise<bool> promise, int port)
 
 void ServerMain::block()
 {
-    std::lock_guard<std::mutex> lock{access_};
+    std::unique_lock<std::mutex> lock{access_};
     blocked_ = true;
+    shared_done_.wait(lock, []() -> bool { return shared_users_ == 0; });
 }
@@ -664,6 +664,7 @@ CoreService::CoreService() :
     // Add others here:
     addMethod("CoreSuspend", &CoreService::CoreSuspend, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
     addMethod("CoreResume", &CoreService::CoreResume, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
+    addMethod("RunBatch", &CoreService::RunBatch, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
 
     addMethod("RunLua", &CoreService::RunLua);
 
@@ -745,6 +746,13 @@ command_result CoreService::CoreResume(color_ostream &stream, const EmptyMessage
     return CR_OK;
 }
 
+command_result CoreService::RunBatch(color_ostream &stream,
+                                     const dfproto::CoreBatchRequest *in,
+                                     dfproto::CoreBatchReply *out)
+{
+    return connection()->runBatch(stream, in, out);
+}
+
 namespace {
     struct LuaFunctionData {
         command_result rv;
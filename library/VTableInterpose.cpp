@@ -28,6 +28,13 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 
 #include "MemAccess.h"
 #include "Core.h"
@@ -288,15 +295,35 @@ bool virtual_identity::set_vmethod_ptr(MemoryPatcher &patcher, int idx, void *pt
 
  */
 
+uint64_t DFHack::interpose_timestamp()
+{
+    return __rdtsc();
+}
+
 void VMethodInterposeLinkBase::set_chain(void *chain)
 {
     saved_chain = chain;
     addr_to_method_pointer_(chain_mptr, chain);
 }
 
-VMethodInterposeLinkBase::VMethodInterposeLinkBase(virtual_identity *host, int vmethod_idx, void *interpose_method, void *chain_mptr, int priority, const char *name)
+// Only applied hooks are listed: plugins like tweak keep unapplied
+// originals around and apply copies of them, which share the statistics.
+static std::set<VMethodInterposeLinkBase*> &all_links()
+{
+    static std::set<VMethodInterposeLinkBase*> links;
+    return links;
+}
+
+const std::set<VMethodInterposeLinkBase*> &VMethodInterposeLinkBase::get_all()
+{
+    return all_links();
+}
+
+VMethodInterposeLinkBase::VMethodInterposeLinkBase(virtual_identity *host, int vmethod_idx, void *interpose_method, void *chain_mptr, int priority, const char *name,
+                                                   void *counted_method, InterposeStats *stats)
     : host(host), vmethod_idx(vmethod_idx), interpose_method(interpose_method),
       chain_mptr(chain_mptr), priority(priority), name_str(name),
+      plain_method(interpose_method), counted_method(counted_method), stats(stats),
       applied(false), saved_chain(NULL), next(NULL), prev(NULL)
 {
     if (vmethod_idx < 0 || interpose_method == NULL)
@@ -314,6 +341,18 @@ VMethodInterposeLinkBase::VMethodInterposeLinkBase(virtual_identity *host, int v
         fflush(stderr);
         abort();
     }
+
+    if (!stats)
+        this->counted_method = NULL;
+}
+
+VMethodInterposeLinkBase::VMethodInterposeLinkBase(const VMethodInterposeLinkBase &other)
+    : host(other.host), vmethod_idx(other.vmethod_idx), interpose_method(other.plain_method),
+      chain_mptr(other.chain_mptr), priority(other.priority), name_str(other.name_str),
+      plain_method(other.plain_method), counted_method(other.counted_method), stats(other.stats),
+      applied(false), saved_chain(NULL), next(NULL), prev(NULL)
+{
+    // The copy is not applied yet, and shares the statistics of the original
 }
 
 VMethodInterposeLinkBase::~VMethodInterposeLinkBase()
@@ -419,9 +458,50 @@ bool VMethodInterposeLinkBase::apply(bool enable)
 
     if (is_applied())
         return true;
+
+    MemoryPatcher patcher;
+    return apply(patcher);
+}
+
+void VMethodInterposeLinkBase::remove()
+{
+    if (!is_applied())
+        return;
+
+    MemoryPatcher patcher;
+    remove(patcher);
+}
+
+bool VMethodInterposeLinkBase::apply_all(const std::vector<VMethodInterposeLinkBase*> &links, bool enable)
+{
+    // One patcher for the whole batch: the memory map is read once, and
+    // each vtable page changes protection only once each way.
+    MemoryPatcher patcher;
+    bool ok = true;
+
+    for (auto it = links.begin(); it != links.end(); ++it)
+    {
+        auto link = *it;
+        if (!link)
+            continue;
+
+        if (!enable)
+        {
+            if (link->is_applied())
+                link->remove(patcher);
+        }
+        else if (!link->is_applied() && !link->apply(patcher))
+            ok = false;
+    }
+
+    return ok;
+}
+
+bool VMethodInterposeLinkBase::apply(MemoryPatcher &patcher)
+{
     if (!host->vtable_ptr)
     {
-        std::cerr << "VMethodInterposeLinkBase::apply(" << enable << "): " << name()
+        std::cerr << "VMethodInterposeLinkBase::apply: " << name()
             << ": no vtable pointer: " << host->getName() << endl;
         return false;
     }
@@ -440,8 +520,6 @@ bool VMethodInterposeLinkBase::apply(bool enable)
     assert(old_ptr != NULL && (!old_link || old_link->interpose_method == old_ptr));
 
     // Apply the new method ptr
-    MemoryPatcher patcher;
-
     set_chain(old_ptr);
 
     if (next_link)
@@ -450,13 +528,14 @@ bool VMethodInterposeLinkBase::apply(bool enable)
     }
     else if (!host->set_vmethod_ptr(patcher, vmethod_idx, interpose_method))
     {
-        std::cerr << "VMethodInterposeLinkBase::apply(" << enable << "): " << name() << ": set_vmethod_ptr failed" << endl;
+        std::cerr << "VMethodInterposeLinkBase::apply: " << name() << ": set_vmethod_ptr failed" << endl;
         set_chain(NULL);
         return false;
     }
 
     // Push the current link into the home host
     applied = true;
+    all_links().insert(this);
     prev = old_link;
     next = next_link;
 
@@ -530,11 +609,8 @@ bool VMethodInterposeLinkBase::apply(bool enable)
     return true;
 }
 
-void VMethodInterposeLinkBase::remove()
+void VMethodInterposeLinkBase::remove(MemoryPatcher &patcher)
 {
-    if (!is_applied())
-        return;
-
     // Remove the link from prev to this
     if (prev)
     {
@@ -560,8 +636,6 @@ void VMethodInterposeLinkBase::remove()
     }
     else
     {
-        MemoryPatcher patcher;
-
         // Remove from the list in the identity and vtable
         host->interpose_list[vmethod_idx] = prev;
         host->set_vmethod_ptr(patcher, vmethod_idx, saved_chain);
@@ -588,8 +662,47 @@ void VMethodInterposeLinkBase::remove()
     }
 
     applied = false;
+    all_links().erase(this);
     prev = next = NULL;
     child_next.clear();
     child_hosts.clear();
     set_chain(NULL);
 }
+
+void VMethodInterposeLinkBase::set_interpose_method(MemoryPatcher &patcher, void *method)
+{
+    if (method == interpose_method)
+        return;
+
+    if (is_applied())
+    {
+        // Replace every place the old pointer was installed at
+        if (next)
+            next->set_chain(method);
+        else
+            host->set_vmethod_ptr(patcher, vmethod_idx, method);
+
+        for (auto it = child_next.begin(); it != child_next.end(); ++it)
+            (*it)->set_chain(method);
+        for (auto it = child_hosts.begin(); it != child_hosts.end(); ++it)
+            (*it)->set_vmethod_ptr(patcher, vmethod_idx, method);
+    }
+
+    interpose_method = method;
+}
+
+bool VMethodInterposeLinkBase::set_profiling(bool enable)
+{
+    if (!counted_method)
+        return false;
+
+    MemoryPatcher patcher;
+    set_interpose_method(patcher, enable ? counted_method : plain_method);
+    return true;
+}
+
+void VMethodInterposeLinkBase::reset_stats()
+{
+    if (stats)
+        stats->calls = stats->cycles = 0;
+}
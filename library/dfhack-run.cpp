@@ -46,24 +46,122 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 
 #include "Console.h"
+#include "MiscUtils.h"
 #include "RemoteClient.h"
 
 #include <cstdio>
 #include <cstdlib>
 #include <sstream>
 
+#include <deque>
 #include <memory>
 
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
 using namespace DFHack;
 using namespace dfproto;
 
+// Commands sent ahead of the one whose output is being read
+static const size_t BATCH_PIPELINE_DEPTH = 16;
+
+static const char *result_name(command_result rv)
+{
+    switch (rv)
+    {
+    case CR_LINK_FAILURE: return "link failure";
+    case CR_NEEDS_CONSOLE: return "needs console";
+    case CR_NOT_IMPLEMENTED: return "not implemented";
+    case CR_OK: return "ok";
+    case CR_FAILURE: return "failure";
+    case CR_WRONG_USAGE: return "wrong usage";
+    case CR_NOT_FOUND: return "not found";
+    default: return "unknown";
+    }
+}
+
+/*
+ * Runs one command per line over a single connection. Up to
+ * BATCH_PIPELINE_DEPTH commands are sent before waiting for the first reply,
+ * unless the commands are typed in. The output of each command is followed
+ * by a status line on stderr.
+ */
+static int run_batch(Console &out, RemoteClient &client, std::istream &input, bool interactive)
+{
+    struct PendingCommand {
+        std::string line;
+        std::future<command_result> result;
+    };
+
+    RemoteFunction<dfproto::CoreRunCommandRequest> run_call;
+    if (!run_call.bind(&client, "RunCommand"))
+    {
+        fprintf(stderr, "No RunCommand protocol function found.\n");
+        return 3;
+    }
+
+    size_t depth = interactive ? 1 : BATCH_PIPELINE_DEPTH;
+    std::deque<PendingCommand> pending;
+    bool link_failed = false;
+    int failures = 0;
+
+    auto finish = [&]() {
+        command_result rv = pending.front().result.get();
+        out.flush();
+        fprintf(stderr, "[%s] %s\n", result_name(rv), pending.front().line.c_str());
+        fflush(stderr);
+        if (rv != CR_OK)
+            failures++;
+        if (rv == CR_LINK_FAILURE)
+            link_failed = true;
+        pending.pop_front();
+    };
+
+    std::string line;
+    while (!link_failed && std::getline(input, line))
+    {
+        if (!line.empty() && line[line.size()-1] == '\r')
+            line.resize(line.size()-1);
+
+        std::vector<std::string> args;
+        tokenize_command_line(&args, line);
+        if (args.empty() || args[0][0] == '#')
+            continue;
+
+        auto in = run_call.in();
+        in->Clear();
+        in->set_command(args[0]);
+        for (size_t i = 1; i < args.size(); i++)
+            in->add_arguments(args[i]);
+
+        PendingCommand cmd;
+        cmd.line = line;
+        cmd.result = run_call.async(out, in);
+        pending.push_back(std::move(cmd));
+
+        if (pending.size() >= depth)
+            finish();
+    }
+
+    while (!pending.empty())
+        finish();
+
+    return failures ? 1 : 0;
+}
+
 int main (int argc, char *argv[])
 {
     Console out;
 
     if (argc <= 1)
     {
-        fprintf(stderr, "Usage: dfhack-run <command> [args...]\n\n");
+        fprintf(stderr, "Usage: dfhack-run <command> [args...]\n");
+        fprintf(stderr, "       dfhack-run --batch [file]\n\n");
         fprintf(stderr, "Note: this command does not start DFHack; it is intended to connect\n"
                         "to a running DFHack instance. If you were trying to start DFHack, run\n"
 #ifdef _WIN32
@@ -89,7 +187,35 @@ int main (int argc, char *argv[])
 
     command_result rv;
 
-    if (strcmp(argv[1], "--lua") == 0)
+    if (strcmp(argv[1], "--batch") == 0)
+    {
+        int status;
+
+        if (argc > 3)
+        {
+            out.shutdown();
+            fprintf(stderr, "Usage: dfhack-run --batch [file]\n");
+            return 2;
+        }
+        else if (argc == 3 && strcmp(argv[2], "-") != 0)
+        {
+            std::ifstream file(argv[2]);
+            if (!file)
+            {
+                out.shutdown();
+                fprintf(stderr, "Could not open %s\n", argv[2]);
+                return 2;
+            }
+            status = run_batch(out, client, file, false);
+        }
+        else
+            status = run_batch(out, client, std::cin, isatty(fileno(stdin)));
+
+        out.flush();
+        out.shutdown();
+        return status;
+    }
+    else if (strcmp(argv[1], "--lua") == 0)
     {
         if (argc <= 3)
         {
@@ -167,9 +167,20 @@ namespace  DFHack
 
         bool hide();
         bool show();
+
+        /// Switch to (or away from) asynchronous output. In async mode text is
+        /// queued in per-thread buffers and written to the terminal by a
+        /// dedicated thread, so producers never wait on terminal I/O. When the
+        /// queue is full, errors and warnings wait for space while other
+        /// output is dropped. Returns false if not supported.
+        bool set_async_output(bool enable);
+        bool is_async_output() { return async_output; }
+        /// number of output chunks dropped by async mode since init
+        size_t get_dropped_output();
     private:
         Private * d;
         tthread::recursive_mutex * wlock;
         std::atomic<bool> inited;
+        std::atomic<bool> async_output;
     };
 }
@@ -202,6 +202,24 @@ namespace DFHack
 
         static void cheap_tokenise(std::string const& input, std::vector<std::string> &output);
 
+        /// Time queued tools may hold the core per frame, in microseconds.
+        /// Once it is spent, new CoreSuspenders wait for the next frame.
+        /// Zero means no limit.
+        void setSuspendBudget(int64_t usec);
+        int64_t getSuspendBudget() { return suspendBudget.load(std::memory_order_relaxed); }
+
+        struct SuspendClientStats {
+            std::string client;
+            uint64_t count = 0;     // number of times the core was held
+            uint64_t deferred = 0;  // number of times it was deferred to the next frame
+            int64_t total_us = 0;
+            int64_t max_us = 0;
+        };
+        std::vector<SuspendClientStats> getSuspendStats();
+        void resetSuspendStats();
+        /// Names the calling thread in the suspension statistics
+        static void setSuspendClient(const std::string &name);
+
     private:
         DFHack::Console con;
 
@@ -302,6 +320,16 @@ namespace DFHack
         std::condition_variable_any CoreWakeup;
         std::atomic<std::thread::id> ownerThread;
         std::atomic<size_t> toolCount;
+        //! Per-frame suspension budget, see setSuspendBudget()
+        std::atomic<int64_t> suspendBudget;
+        std::atomic<int64_t> suspendUsed;
+        std::atomic<uint32_t> suspendFrame;
+        std::mutex suspendFrameMutex;
+        std::condition_variable suspendNextFrame;
+        void startSuspendFrame();
+        void waitSuspendBudget();
+        void onSuspendAcquired();
+        void onSuspendReleased();
         //! \}
 
         friend class CoreService;
@@ -378,6 +406,10 @@ namespace DFHack
      *   The last step is to decrement Core::toolCount and wakeup main thread if
      *   no more tools are queued trying to acquire the
      *   Core::CoreSuspenderMutex.
+     * - If a suspension budget is set, the time each outermost CoreSuspender
+     *   holds the core is added to the current frame. Once the budget is spent,
+     *   Core::Update() stops waiting for queued tools, and new CoreSuspenders
+     *   wait in Core::waitSuspendBudget() until the next frame.
      */
     class CoreSuspender : public CoreSuspenderBase {
         using parent_t = CoreSuspenderBase;
@@ -398,13 +430,18 @@ namespace DFHack
         void lock()
         {
             auto& core = Core::getInstance();
+            core.waitSuspendBudget();
             core.toolCount.fetch_add(1, std::memory_order_relaxed);
             parent_t::lock();
+            if (tid == std::thread::id{})
+                core.onSuspendAcquired();
         }
 
         void unlock()
         {
             auto& core = Core::getInstance();
+            if (tid == std::thread::id{})
+                core.onSuspendReleased();
             parent_t::unlock();
             /* Notify core to continue when all queued tools have completed
              * 0 = None wants to own the core
@@ -135,6 +135,11 @@ namespace DFHack
 
         virtual bool lua_insert2(lua_State *state, int fname_idx, void *ptr, int idx, int val_index);
 
+        // Raw access for bulk readers; for pointer containers, the item
+        // pointer is the address of the pointer stored in the container.
+        int get_item_count(void *ptr, CountMode cnt) { return item_count(ptr, cnt); }
+        void *get_item_pointer(type_identity *item, void *ptr, int idx) { return item_pointer(item, ptr, idx); }
+
     protected:
         virtual int item_count(void *ptr, CountMode cnt) = 0;
         virtual void *item_pointer(type_identity *item, void *ptr, int idx) = 0;
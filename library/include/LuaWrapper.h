@@ -239,5 +239,52 @@ namespace LuaWrapper {
     void IndexStatics(lua_State *state, int meta_idx, int ftable_idx, struct_identity *pstruct);
 
     void AttachDFGlobals(lua_State *state);
+
+    /**
+     * A dotted field path like 'pos.x', 'flags1.dead' or 'job.current_job.id'
+     * resolved against a struct type once, so that it can then be read from
+     * many objects without any per-access name lookups. Pointer fields along
+     * the path are followed; the final field must be a primitive value, a
+     * static string or a bitfield member.
+     */
+    struct FieldPath {
+        enum Kind { VALUE, STATIC_STRING, BIT };
+
+        // offsets of each step; a pointer is dereferenced between steps
+        std::vector<size_t> offsets;
+        Kind kind = VALUE;
+        type_identity *type = NULL;
+        int bit_index = 0, bit_size = 0;
+        size_t count = 0;
+
+        /**
+         * Resolve the path; on failure returns false and sets the error.
+         */
+        bool resolve(struct_identity *root, const std::string &path, std::string *error);
+        /**
+         * Address of the final field, or NULL if a pointer on the way is NULL.
+         */
+        uint8_t *locate(void *obj) const;
+        /**
+         * Push the value of the field, or nil if it cannot be reached.
+         */
+        void push(lua_State *state, int fname_idx, void *obj) const;
+        /**
+         * Assign the value at val_index to the field.
+         */
+        void write(lua_State *state, int fname_idx, void *obj, int val_index) const;
+    };
+
+    /**
+     * df.bulk_read(container, fields[, filter]): read columns of primitive
+     * fields from every item of a container in a single call.
+     */
+    int bulk_read(lua_State *state);
+
+    /**
+     * df.fieldhandle(type, path): returns a getter and a setter function
+     * for the field path, resolved once against the type.
+     */
+    int make_field_handle(lua_State *state);
 }}
 
@@ -363,6 +363,8 @@ DFHACK_EXPORT bool split_string(std::vector<std::string> *out,
                                 const std::string &str, const std::string &separator,
                                 bool squash_empty = false);
 DFHACK_EXPORT std::string join_strings(const std::string &separator, const std::vector<std::string> &items);
+// Splits a command line into words the way the console does, and appends them to out
+DFHACK_EXPORT void tokenize_command_line(std::vector<std::string> *out, const std::string &input);
 
 DFHACK_EXPORT std::string toUpper(const std::string &str);
 DFHACK_EXPORT std::string toLower(const std::string &str);
@@ -27,6 +27,10 @@ distribution.
 #include "Export.h"
 #include "ColorText.h"
 
+#include <future>
+#include <map>
+#include <mutex>
+
 class CPassiveSocket;
 class CActiveSocket;
 class CSimpleSocket;
@@ -72,13 +76,29 @@ namespace  DFHack
         int32_t size;
     };
 
+    // Follows the header of every message with a payload in protocol
+    // version 2, and is included in its size. RPC_REPLY_FAIL keeps the
+    // error code in the size field, and is followed by this header.
+    struct RPCSequenceHeader {
+        int32_t seq;
+        int32_t flags;
+    };
+
+    enum RPCCallFlags {
+        // The reply may arrive before the replies to earlier calls.
+        // Only honored for functions that don't suspend the core.
+        RPC_CALL_UNORDERED = 1
+    };
+
     /* Protocol description:
      *
      * 1. Handshake
      *
      *   Client initiates connection by sending the handshake
      *   request header. The server responds with the response
-     *   magic. Currently both versions must be 1.
+     *   magic. The client sends the highest version it supports,
+     *   and the server replies with the version it will use, which
+     *   is currently 1 or 2.
      *
      * 2. Interaction
      *
@@ -90,6 +110,12 @@ namespace  DFHack
      *   NOTE: As a special exception, RPC_REPLY_FAIL uses the size
      *         field to hold the error code directly.
      *
+     *   In version 2, every request and reply also carries an
+     *   RPCSequenceHeader chosen by the client, so that replies can
+     *   be matched to requests. Several requests may be sent before
+     *   reading the replies, and calls flagged RPC_CALL_UNORDERED
+     *   may complete out of order.
+     *
      *   Every callable function is assigned a non-negative id by
      *   the server. Id 0 is reserved for BindMethod, which can be
      *   used to request any other id by function name. Id 1 is
@@ -159,6 +185,7 @@ namespace  DFHack
 
     protected:
         friend class RemoteClient;
+        friend class RemoteBatch;
 
         RemoteFunctionBase(const message_type *in, const message_type *out)
             : RPCFunctionBase(in, out), p_client(NULL), id(-1)
@@ -166,6 +193,8 @@ namespace  DFHack
 
         inline color_ostream &default_ostream();
         command_result execute(color_ostream &out, const message_type *input, message_type *output);
+        std::future<command_result> execute_async(color_ostream &out, const message_type *input,
+                                                  message_type *output, bool unordered);
 
         std::string name, plugin;
         RemoteClient *p_client;
@@ -196,6 +225,21 @@ namespace  DFHack
         command_result operator() (color_ostream &stream, const In *input, Out *output) {
             return RemoteFunctionBase::execute(stream, input, output);
         }
+
+        /*
+         * Sends the call without waiting for the reply, which is collected
+         * by get() on the future, or by any later call on the same client.
+         * The input is serialized immediately; the output and stream must
+         * stay valid until get() returns or the future is destroyed. If
+         * unordered, the server may complete the call before earlier ones.
+         */
+        std::future<command_result> async(const In *input, Out *output, bool unordered = false) {
+            return async(default_ostream(), input, output, unordered);
+        }
+        std::future<command_result> async(color_ostream &stream, const In *input, Out *output,
+                                          bool unordered = false) {
+            return RemoteFunctionBase::execute_async(stream, input, output, unordered);
+        }
     };
 
     template<typename In>
@@ -220,6 +264,14 @@ namespace  DFHack
         command_result operator() (color_ostream &stream, const In *input) {
             return RemoteFunctionBase::execute(stream, input, out());
         }
+
+        std::future<command_result> async(const In *input, bool unordered = false) {
+            return async(default_ostream(), input, unordered);
+        }
+        std::future<command_result> async(color_ostream &stream, const In *input,
+                                          bool unordered = false) {
+            return RemoteFunctionBase::execute_async(stream, input, out(), unordered);
+        }
     };
 
     class DFHACK_EXPORT RemoteClient
@@ -229,6 +281,24 @@ namespace  DFHack
         bool bind(color_ostream &out, RemoteFunctionBase *function,
                   const std::string &name, const std::string &plugin);
 
+        typedef RPCFunctionBase::message_type message_type;
+
+        // Calls sent and not yet collected, by sequence number
+        struct PendingCall {
+            RemoteFunctionBase *function;
+            color_ostream *out;
+            message_type *output;
+            bool done;
+            command_result result;
+        };
+
+        int32_t send_call(color_ostream &out, RemoteFunctionBase *function,
+                          const message_type *input, message_type *output, bool unordered);
+        command_result wait_call(color_ostream &out, int32_t seq);
+        void abandon_call(int32_t seq);
+        bool receive_reply(color_ostream &out);
+        void fail_pending(command_result res);
+
     public:
         RemoteClient(color_ostream *default_output = NULL);
         ~RemoteClient();
@@ -257,6 +327,11 @@ namespace  DFHack
         CActiveSocket *socket;
         color_ostream *p_default_output;
 
+        int protocol_version;
+        int32_t next_seq;
+        std::mutex send_mutex, recv_mutex, call_mutex;
+        std::map<int32_t, PendingCall> pending;
+
         RemoteFunction<dfproto::CoreBindRequest,dfproto::CoreBindReply> bind_call;
         RemoteFunction<dfproto::CoreRunCommandRequest> runcmd_call;
 
@@ -273,6 +348,41 @@ namespace  DFHack
         return bind(client->default_output(), client, name, plugin);
     }
 
+    /*
+     * Collects calls of bound functions and sends them in one RunBatch
+     * request. The server runs them back to back under a single core
+     * suspension and returns all replies together, so a client that needs
+     * several queries per frame only waits for the core once.
+     */
+    class DFHACK_EXPORT RemoteBatch {
+    public:
+        RemoteBatch(RemoteClient *client) : client(client) {}
+
+        // Queues a call with the current contents of function->in().
+        // The input is copied, so the function may be queued again
+        // with different arguments.
+        void add(RemoteFunctionBase *function);
+        void clear();
+        size_t size() const { return functions.size(); }
+
+        // Runs the queued calls. On success, result(i) holds the status of
+        // each call, and the out() message of each function holds its reply
+        // (of the last call, if it was queued several times).
+        command_result execute(color_ostream &out);
+        command_result execute() { return execute(client->default_output()); }
+
+        command_result result(size_t i) const {
+            return i < results.size() ? results[i] : CR_NOT_IMPLEMENTED;
+        }
+
+    private:
+        RemoteClient *client;
+        std::vector<RemoteFunctionBase*> functions;
+        std::vector<command_result> results;
+
+        RemoteFunction<dfproto::CoreBatchRequest, dfproto::CoreBatchReply> batch_call;
+    };
+
     class RemoteSuspender {
         RemoteClient *client;
     public:
@@ -28,6 +28,7 @@ distribution.
 #include "RemoteClient.h"
 #include "Core.h"
 
+#include <atomic>
 #include <future>
 
 class CPassiveSocket;
@@ -39,6 +40,8 @@ namespace  DFHack
     class Plugin;
     class CoreService;
     class ServerConnection;
+    class ServerEventLoop;
+    struct ServerOutputQueue;
 
     class DFHACK_EXPORT RPCService;
 
@@ -60,6 +63,8 @@ namespace  DFHack
         const int flags;
 
         virtual command_result execute(color_ostream &stream) = 0;
+        // Runs the function with separate messages, for concurrent calls
+        virtual command_result execute(color_ostream &stream, const message_type *input, message_type *output) = 0;
 
         int16_t getId() { return id; }
 
@@ -89,6 +94,9 @@ namespace  DFHack
               fptr(fptr) {}
 
         virtual command_result execute(color_ostream &stream) { return fptr(stream, in(), out()); }
+        virtual command_result execute(color_ostream &stream, const message_type *input, message_type *output) {
+            return fptr(stream, static_cast<const In*>(input), static_cast<Out*>(output));
+        }
 
     private:
         function_type fptr;
@@ -106,6 +114,9 @@ namespace  DFHack
               fptr(fptr) {}
 
         virtual command_result execute(color_ostream &stream) { return fptr(stream, in()); }
+        virtual command_result execute(color_ostream &stream, const message_type *input, message_type *) {
+            return fptr(stream, static_cast<const In*>(input));
+        }
 
     private:
         function_type fptr;
@@ -126,6 +137,9 @@ namespace  DFHack
         virtual command_result execute(color_ostream &stream) {
             return (static_cast<Svc*>(owner)->*fptr)(stream, in(), out());
         }
+        virtual command_result execute(color_ostream &stream, const message_type *input, message_type *output) {
+            return (static_cast<Svc*>(owner)->*fptr)(stream, static_cast<const In*>(input), static_cast<Out*>(output));
+        }
 
     private:
         function_type fptr;
@@ -145,6 +159,9 @@ namespace  DFHack
         virtual command_result execute(color_ostream &stream) {
             return (static_cast<Svc*>(owner)->*fptr)(stream, in());
         }
+        virtual command_result execute(color_ostream &stream, const message_type *input, message_type *) {
+            return (static_cast<Svc*>(owner)->*fptr)(stream, static_cast<const In*>(input));
+        }
 
     private:
         function_type fptr;
@@ -223,37 +240,83 @@ namespace  DFHack
             virtual void flush_proxy();
 
         public:
-            connection_ostream(ServerConnection *owner) : owner(owner) {}
+            // sequence number of the call the text belongs to (protocol version 2)
+            int32_t seq;
+
+            connection_ostream(ServerConnection *owner, int32_t seq = 0) : owner(owner), seq(seq) {}
         };
 
-        bool in_error;
+        // written by the connection thread, read by calls running out of order
+        std::atomic<bool> in_error;
         CActiveSocket *socket;
         connection_ostream stream;
+        int protocol_version;
+
+        std::mutex send_mutex;
+
+        // calls running out of order on their own threads
+        std::mutex async_mutex;
+        std::condition_variable async_done;
+        int async_calls;
+        static const int MAX_ASYNC_CALLS = 8;
+
+        // Set in event loop mode: everything sent to the client is appended
+        // to this queue, and written to the socket by the event loop.
+        std::shared_ptr<ServerOutputQueue> out_queue;
 
         std::vector<ServerFunctionBase*> functions;
 
         CoreService *core_service;
         std::map<std::string, RPCService*> plugin_services;
 
+        bool isAllowed(ServerFunctionBase *fn);
+        bool canRunUnordered(ServerFunctionBase *fn);
+
+        bool sendData(const void *data, int size);
+        bool sendMessage(int16_t id, const ::google::protobuf::MessageLite *msg, bool size_ready,
+                         int32_t seq = 0);
+        bool sendFailure(command_result res, int32_t seq = 0);
+
+        bool startAsyncCall(ServerFunctionBase *fn, const uint8_t *data, int size, int32_t seq);
+
+        // Runs one request and sends the reply. If batch is given, calls that
+        // need the core suspended share it instead of taking their own lock.
+        // Returns false if the connection should be closed.
+        bool handleRequest(int16_t id, std::unique_ptr<uint8_t[]> buf, int size,
+                           CoreSuspender *batch = nullptr);
+
         void threadFn();
         ServerConnection(CActiveSocket* socket);
         ~ServerConnection();
 
+        friend class ServerEventLoop;
+
     public:
 
         static void Accepted(CActiveSocket* socket);
 
         ServerFunctionBase *findFunction(color_ostream &out, const std::string &plugin, const std::string &name);
+
+        // Runs the calls of a RunBatch request back to back, under a single
+        // core suspension if any of them needs one.
+        command_result runBatch(color_ostream &stream,
+                                const dfproto::CoreBatchRequest *in,
+                                dfproto::CoreBatchReply *out);
     };
 
     class ServerMain {
         static std::mutex access_;
-        static bool blocked_;
+        static std::atomic<bool> blocked_;
+        static int shared_users_;
+        static std::condition_variable shared_done_;
         friend struct BlockGuard;
+        friend struct SharedBlockGuard;
 
     public:
 
         static std::future<bool> listen(int port);
         static void block();
+        // Lock-free check for loops that only need to know when to stop.
+        static bool is_blocked() { return blocked_; }
     };
 }
@@ -149,6 +149,9 @@ namespace DFHack
         // For batching
         command_result CoreSuspend(color_ostream &stream, const EmptyMessage*, IntMessage *cnt);
         command_result CoreResume(color_ostream &stream, const EmptyMessage*, IntMessage *cnt);
+        command_result RunBatch(color_ostream &stream,
+                                const dfproto::CoreBatchRequest *in,
+                                dfproto::CoreBatchReply *out);
 
         command_result RunLua(color_ostream &stream,
                               const dfproto::CoreRunLuaRequest *in,
@@ -24,6 +24,11 @@ distribution.
 
 #pragma once
 
+#include <set>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
 #include "DataFuncs.h"
 
 namespace DFHack
@@ -69,6 +74,16 @@ namespace DFHack
            INTERPOSE_HOOK(my_hack, foo).remove();
        }
 
+       Several hooks can be applied or removed at once with
+       VMethodInterposeLinkBase::apply_all(), which is cheaper
+       than doing it one by one.
+
+       Profiling: set_profiling(true) routes calls through a
+       wrapper that counts calls and CPU cycles spent in the hook
+       (including anything it calls, like INTERPOSE_NEXT). When
+       profiling is off, the vtable points at the hook directly,
+       so there is no overhead. See the 'interpose' command.
+
        Important caveat:
 
        This will NOT intercept calls to the superclass vmethod
@@ -138,6 +153,54 @@ namespace DFHack
     }
 
 
+    /* Call statistics for profiled hooks. */
+
+    struct InterposeStats {
+        uint64_t calls;
+        uint64_t cycles;
+    };
+
+    DFHACK_EXPORT uint64_t interpose_timestamp();
+
+    struct InterposeTimer {
+        InterposeStats &stats;
+        uint64_t start;
+        InterposeTimer(InterposeStats &stats) : stats(stats), start(interpose_timestamp()) {}
+        ~InterposeTimer() {
+            stats.calls++;
+            stats.cycles += interpose_timestamp() - start;
+        }
+    };
+
+    /* Generates the profiling wrapper for a hook method. */
+
+    template<class Ptr, Ptr fn> struct InterposeCounter;
+
+    template<class R, class C, class... A, R (C::*fn)(A...)>
+    struct InterposeCounter<R (C::*)(A...), fn> : C {
+        static InterposeStats stats;
+        R call(A... args) {
+            InterposeTimer timer(stats);
+            return (this->*fn)(std::forward<A>(args)...);
+        }
+    };
+    template<class R, class C, class... A, R (C::*fn)(A...)>
+    InterposeStats InterposeCounter<R (C::*)(A...), fn>::stats = { 0, 0 };
+
+    template<class R, class C, class... A, R (C::*fn)(A...) const>
+    struct InterposeCounter<R (C::*)(A...) const, fn> : C {
+        static InterposeStats stats;
+        R call(A... args) const {
+            InterposeTimer timer(stats);
+            return (this->*fn)(std::forward<A>(args)...);
+        }
+    };
+    template<class R, class C, class... A, R (C::*fn)(A...) const>
+    InterposeStats InterposeCounter<R (C::*)(A...) const, fn>::stats = { 0, 0 };
+
+#define INTERPOSE_COUNTER(class,name) \
+    DFHack::InterposeCounter<decltype(&class::interpose_fn_##name), &class::interpose_fn_##name>
+
 #define DEFINE_VMETHOD_INTERPOSE(rtype, name, args) \
     typedef rtype (interpose_base::*interpose_ptr_##name)args; \
     static DFHack::VMethodInterposeLink<interpose_base,interpose_ptr_##name> interpose_##name; \
@@ -145,7 +208,8 @@ namespace DFHack
 
 #define IMPLEMENT_VMETHOD_INTERPOSE_PRIO(class,name,priority) \
     DFHack::VMethodInterposeLink<class::interpose_base,class::interpose_ptr_##name> \
-        class::interpose_##name(&class::interpose_base::name, &class::interpose_fn_##name, priority, #class"::"#name);
+        class::interpose_##name(&class::interpose_base::name, &class::interpose_fn_##name, priority, #class"::"#name, \
+            &INTERPOSE_COUNTER(class,name)::call, &INTERPOSE_COUNTER(class,name)::stats);
 
 #define IMPLEMENT_VMETHOD_INTERPOSE(class,name) IMPLEMENT_VMETHOD_INTERPOSE_PRIO(class,name,0)
 
@@ -162,11 +226,15 @@ namespace DFHack
 
         virtual_identity *host; // Class with the vtable
         int vmethod_idx;        // Index of the interposed method in the vtable
-        void *interpose_method; // Pointer to the code of the interposing method
+        void *interpose_method; // Pointer to the code installed in the vtable
         void *chain_mptr;       // Pointer to the chain field in the subclass below
         int priority;           // Higher priority hooks are called earlier
         const char *name_str;   // Name of the hook
 
+        void *plain_method;     // Pointer to the code of the interposing method
+        void *counted_method;   // Profiling wrapper around plain_method, or NULL
+        InterposeStats *stats;  // Statistics updated by counted_method
+
         bool applied;           // True if this hook is currently applied
         void *saved_chain;      // Pointer to the code of the original vmethod or next hook
 
@@ -183,15 +251,37 @@ namespace DFHack
 
         VMethodInterposeLinkBase *get_first_interpose(virtual_identity *id);
         bool find_child_hosts(virtual_identity *cur, void *vmptr);
+
+        bool apply(MemoryPatcher &patcher);
+        void remove(MemoryPatcher &patcher);
+        void set_interpose_method(MemoryPatcher &patcher, void *method);
     public:
-        VMethodInterposeLinkBase(virtual_identity *host, int vmethod_idx, void *interpose_method, void *chain_mptr, int priority, const char *name);
+        VMethodInterposeLinkBase(virtual_identity *host, int vmethod_idx, void *interpose_method, void *chain_mptr, int priority, const char *name,
+                                 void *counted_method = NULL, InterposeStats *stats = NULL);
+        VMethodInterposeLinkBase(const VMethodInterposeLinkBase &other);
         ~VMethodInterposeLinkBase();
 
         bool is_applied() { return applied; }
         bool apply(bool enable = true);
         void remove();
 
+        // Apply or remove several hooks, sharing the memory protection changes.
+        // Returns false if any of them could not be applied.
+        static bool apply_all(const std::vector<VMethodInterposeLinkBase*> &links, bool enable = true);
+
         const char *name() { return name_str; }
+        int get_priority() { return priority; }
+        virtual_identity *get_host() { return host; }
+
+        // Call counting; only available for hooks defined with the macros above.
+        bool can_profile() { return counted_method != NULL; }
+        bool is_profiling() { return counted_method && interpose_method == counted_method; }
+        bool set_profiling(bool enable);
+        const InterposeStats *get_stats() { return stats; }
+        void reset_stats();
+
+        // All hooks that are currently applied.
+        static const std::set<VMethodInterposeLinkBase*> &get_all();
     };
 
     template<class Base, class Ptr>
@@ -214,5 +304,17 @@ namespace DFHack
                 priority, name
               )
         { src = target; /* check compatibility */ }
+
+        template<class Ptr2, class Ptr3>
+        VMethodInterposeLink(Ptr target, Ptr2 src, int priority, const char *name, Ptr3 counted, InterposeStats *stats)
+            : VMethodInterposeLinkBase(
+                &Base::_identity,
+                vmethod_pointer_to_idx(target),
+                method_pointer_to_addr(src),
+                &chain,
+                priority, name,
+                method_pointer_to_addr(counted), stats
+              )
+        { src = target; counted = target; /* check compatibility */ }
     };
 }
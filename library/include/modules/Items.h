@@ -188,6 +188,9 @@ DFHACK_EXPORT int getItemBaseValue(int16_t item_type, int16_t item_subtype, int1
 /// Gets the value of a specific item, ignoring civ values and trade agreements
 DFHACK_EXPORT int getValue(df::item *item);
 
+/// Gets the values of many items at once; NULL items are worth 0
+DFHACK_EXPORT void getValues(const std::vector<df::item*> &items, /*output*/ std::vector<int> *values);
+
 DFHACK_EXPORT int32_t createItem(df::item_type type, int16_t item_subtype, int16_t mat_type, int32_t mat_index, df::unit* creator);
 
 /// Returns true if the item is free from mandates, or false if mandates prevent trading the item
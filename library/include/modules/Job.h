@@ -34,6 +34,7 @@ distribution.
 
 #include "DataDefs.h"
 #include "df/job_item_ref.h"
+#include "df/job_type.h"
 #include "df/item_type.h"
 
 namespace df
@@ -97,6 +98,23 @@ namespace DFHack
         // lists jobs with ids >= *id_var, and sets *id_var = *job_next_id;
         DFHACK_EXPORT bool listNewlyCreated(std::vector<df::job*> *pvec, int *id_var);
 
+        // Job index: kept current by linkIntoWorld and removeJob, and
+        // checked against world->jobs.list on the first query of each
+        // DFHack update, which only costs a walk over the list when DF
+        // did not change it. Outside of updates (e.g. in vmethod hooks)
+        // every query checks the list, so it never returns freed jobs.
+        // Code that edits the list directly should call invalidateIndex().
+        DFHACK_EXPORT void invalidateIndex();
+        DFHACK_EXPORT df::job *findJob(int32_t id);
+        // true if the job is linked into world->jobs.list
+        DFHACK_EXPORT bool isInWorld(df::job *job);
+        // all jobs in the list, in list order
+        DFHACK_EXPORT const std::vector<df::job*> &getAllJobs();
+        DFHACK_EXPORT const std::vector<df::job*> &getJobsOfType(df::job_type type);
+        // these read building->jobs and unit->job.current_job
+        DFHACK_EXPORT const std::vector<df::job*> &getJobsForHolder(int32_t building_id);
+        DFHACK_EXPORT df::job *getJobForWorker(int32_t unit_id);
+
         DFHACK_EXPORT bool attachJobItem(df::job *job, df::item *item,
                                          df::job_item_ref::T_role role,
                                          int filter_idx = -1, int insert_idx = -1);
@@ -173,6 +173,12 @@ namespace DFHack
     DFHACK_EXPORT bool isSoilInorganic(int material);
     DFHACK_EXPORT bool isStoneInorganic(int material);
 
+    // Return the index of the raw object with the given id, or -1.
+    // These use a hash index that is built on first use for the current world.
+    DFHACK_EXPORT int findInorganicIndex(const std::string &id);
+    DFHACK_EXPORT int findPlantIndex(const std::string &id);
+    DFHACK_EXPORT int findCreatureIndex(const std::string &id);
+
     typedef int32_t t_materialIndex;
     typedef int16_t t_materialType, t_itemType, t_itemSubtype;
 
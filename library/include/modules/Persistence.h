@@ -194,6 +194,20 @@ namespace DFHack
         // Fills the vector with references to each persistent item with a key that is
         // equal to the given key.
         DFHACK_EXPORT void getAllByKey(std::vector<PersistentDataItem> &vec, const std::string &key);
+        // Fills the vector with references to each persistent item with a key that
+        // starts with the given prefix.
+        DFHACK_EXPORT void getAllByKeyPrefix(std::vector<PersistentDataItem> &vec, const std::string &prefix);
+
+        // Persistent items are saved in a compact binary format, with a copy in the
+        // JSON format used by older versions. These functions write and read all
+        // items in either format. Importing replaces all existing items. All return
+        // false if no world is loaded or the operation fails.
+        DFHACK_EXPORT bool exportJSON(std::ostream &out);
+        DFHACK_EXPORT bool importJSON(std::istream &in);
+        // Exporting to the file that was last exported to or imported from only
+        // appends the changes, as when saving the world.
+        DFHACK_EXPORT bool exportBinary(const std::string &path);
+        DFHACK_EXPORT bool importBinary(const std::string &path);
 
 #if defined(__GNUC__) && __GNUC__ < 5
         // file stream move constructors are missing in libstdc++ before version 5.
@@ -54,7 +54,8 @@ DFHACK_EXPORT void setNickname(df::language_name *name, std::string nick);
 
 DFHACK_EXPORT std::string capitalize(const std::string &str, bool all_words = false);
 
-// translate a name using the loaded dictionaries
+// translate a name using the loaded dictionaries; results are cached,
+// keyed by the contents of the name
 DFHACK_EXPORT std::string TranslateName (const df::language_name * name, bool inEnglish = true,
                                          bool onlyLastPart = false);
 }
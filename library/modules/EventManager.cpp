@@ -381,13 +381,13 @@ static void manageJobInitiatedEvent(color_ostream& out) {
     }
     multimap<Plugin*,EventHandler> copy(handlers[EventType::JOB_INITIATED].begin(), handlers[EventType::JOB_INITIATED].end());
 
-    for ( df::job_list_link* link = &df::global::world->jobs.list; link != NULL; link = link->next ) {
-        if ( link->item == NULL )
-            continue;
-        if ( link->item->id <= lastJobId )
+    //new jobs have consecutive ids, so look them up in the job index instead of walking the list
+    for ( int32_t id = lastJobId+1; id < *df::global::job_next_id; id++ ) {
+        df::job* job = Job::findJob(id);
+        if ( job == NULL )
             continue;
         for ( auto i = copy.begin(); i != copy.end(); i++ ) {
-            (*i).second.eventHandler(out, (void*)link->item);
+            (*i).second.eventHandler(out, (void*)job);
         }
     }
 
@@ -411,10 +411,8 @@ static void manageJobCompletedEvent(color_ostream& out) {
 
     multimap<Plugin*,EventHandler> copy(handlers[EventType::JOB_COMPLETED].begin(), handlers[EventType::JOB_COMPLETED].end());
     map<int32_t, df::job*> nowJobs;
-    for ( df::job_list_link* link = &df::global::world->jobs.list; link != NULL; link = link->next ) {
-        if ( link->item == NULL )
-            continue;
-        nowJobs[link->item->id] = link->item;
+    for ( df::job* job : Job::getAllJobs() ) {
+        nowJobs[job->id] = job;
     }
 
 #if 0
@@ -28,6 +28,8 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <cassert>
 using namespace std;
 
@@ -356,6 +358,186 @@ bool DFHack::Job::disconnectJobGeneralRef(df::job *job, df::general_ref *ref) {
     return true;
 }
 
+/*
+ * Job index
+ */
+
+namespace {
+    struct JobIndexEntry {
+        df::job *job;
+        df::job_type type;
+        uint32_t seen;
+    };
+
+    struct JobIndex {
+        // set by Core::Update while DF is stopped; outside of it, DF may
+        // free jobs at any time, so every query checks the list first
+        bool in_update;
+        bool valid;
+        int32_t next_id;
+        uint32_t generation;
+        // world->jobs.list in order, with the ids as of the last check
+        std::vector<df::job*> all;
+        std::vector<int32_t> all_ids;
+        std::unordered_map<int32_t, JobIndexEntry> by_id;
+        std::unordered_set<df::job*> jobs;
+        std::unordered_map<int, std::vector<df::job*> > by_type;
+        // scratch space for sync_index
+        std::vector<df::job*> now;
+        std::vector<int32_t> now_ids;
+
+        JobIndex() : in_update(false), valid(false), next_id(-1), generation(0) {}
+    };
+
+    JobIndex job_index;
+    const std::vector<df::job*> no_jobs;
+
+    void index_insert(df::job *job, int32_t id)
+    {
+        JobIndexEntry entry = { job, job->job_type, job_index.generation };
+        job_index.by_id[id] = entry;
+        job_index.jobs.insert(job);
+        job_index.by_type[entry.type].push_back(job);
+    }
+
+    // does not look at the job itself, which may already be freed
+    void index_erase_entry(std::unordered_map<int32_t, JobIndexEntry>::iterator it)
+    {
+        auto &entry = it->second;
+        auto &type_jobs = job_index.by_type[entry.type];
+        vector_erase_at(type_jobs, linear_index(type_jobs, entry.job));
+        job_index.jobs.erase(entry.job);
+        job_index.by_id.erase(it);
+    }
+
+    void index_erase(df::job *job)
+    {
+        auto it = job_index.by_id.find(job->id);
+        if (it == job_index.by_id.end() || it->second.job != job)
+            return;
+
+        int pos = linear_index(job_index.all, job);
+        vector_erase_at(job_index.all, pos);
+        vector_erase_at(job_index.all_ids, pos);
+        index_erase_entry(it);
+    }
+
+    // Compares the index with world->jobs.list and applies the difference.
+    // When nothing changed, this is a single walk over the list.
+    void sync_index()
+    {
+        using df::global::world;
+        using df::global::job_next_id;
+
+        auto &index = job_index;
+        index.now.clear();
+        index.now_ids.clear();
+        if (world)
+        {
+            for (auto link = world->jobs.list.next; link; link = link->next)
+            {
+                if (!link->item)
+                    continue;
+                index.now.push_back(link->item);
+                index.now_ids.push_back(link->item->id);
+            }
+        }
+
+        if (index.now != index.all || index.now_ids != index.all_ids)
+        {
+            // DF may reuse the address of a freed job for a new one,
+            // so an entry is only kept if both the address and id match
+            uint32_t gen = ++index.generation;
+            for (size_t i = 0; i < index.now.size(); i++)
+            {
+                auto it = index.by_id.find(index.now_ids[i]);
+                if (it != index.by_id.end() && it->second.job == index.now[i])
+                    it->second.seen = gen;
+            }
+            for (size_t i = 0; i < index.all.size(); i++)
+            {
+                auto it = index.by_id.find(index.all_ids[i]);
+                if (it != index.by_id.end() && it->second.job == index.all[i] &&
+                        it->second.seen != gen)
+                    index_erase_entry(it);
+            }
+            for (size_t i = 0; i < index.now.size(); i++)
+            {
+                if (!index.by_id.count(index.now_ids[i]))
+                    index_insert(index.now[i], index.now_ids[i]);
+            }
+            index.all.swap(index.now);
+            index.all_ids.swap(index.now_ids);
+        }
+
+        index.valid = true;
+        index.next_id = job_next_id ? *job_next_id : -1;
+    }
+
+    JobIndex &get_index()
+    {
+        using df::global::job_next_id;
+
+        int32_t next_id = job_next_id ? *job_next_id : -1;
+        if (!job_index.valid || !job_index.in_update || job_index.next_id != next_id)
+            sync_index();
+        return job_index;
+    }
+}
+
+// called by Core::Update around the time DFHack code runs each frame
+void jobs_beginUpdate()
+{
+    job_index.in_update = true;
+    job_index.valid = false;
+}
+
+void jobs_endUpdate()
+{
+    job_index.in_update = false;
+}
+
+void DFHack::Job::invalidateIndex()
+{
+    job_index.valid = false;
+}
+
+df::job *DFHack::Job::findJob(int32_t id)
+{
+    auto &index = get_index();
+    auto it = index.by_id.find(id);
+    return it != index.by_id.end() ? it->second.job : NULL;
+}
+
+bool DFHack::Job::isInWorld(df::job *job)
+{
+    return job && get_index().jobs.count(job) > 0;
+}
+
+const std::vector<df::job*> &DFHack::Job::getAllJobs()
+{
+    return get_index().all;
+}
+
+const std::vector<df::job*> &DFHack::Job::getJobsOfType(df::job_type type)
+{
+    auto &index = get_index();
+    auto it = index.by_type.find(type);
+    return it != index.by_type.end() ? it->second : no_jobs;
+}
+
+const std::vector<df::job*> &DFHack::Job::getJobsForHolder(int32_t building_id)
+{
+    auto building = df::building::find(building_id);
+    return building ? building->jobs : no_jobs;
+}
+
+df::job *DFHack::Job::getJobForWorker(int32_t unit_id)
+{
+    auto unit = df::unit::find(unit_id);
+    return unit ? unit->job.current_job : NULL;
+}
+
 bool DFHack::Job::removeJob(df::job *job) {
     using df::global::world;
     CHECK_NULL_POINTER(job);
@@ -375,6 +557,9 @@ bool DFHack::Job::removeJob(df::job *job) {
             return false;
     }
 
+    if (job_index.valid)
+        index_erase(job);
+
     //Disconnect, delete, and wipe all general refs
     while (job->general_refs.size() > 0) {
         auto ref = job->general_refs[0];
@@ -485,6 +670,14 @@ bool DFHack::Job::linkIntoWorld(df::job *job, bool new_id)
         job->list_link = new df::job_list_link();
         job->list_link->item = job;
         linked_list_append(&world->jobs.list, job->list_link);
+
+        if (job_index.valid && job_index.next_id == job->id)
+        {
+            job_index.all.push_back(job);
+            job_index.all_ids.push_back(job->id);
+            index_insert(job, job->id);
+            job_index.next_id = *job_next_id;
+        }
         return true;
     } else {
         df::job_list_link *ins_pos = &world->jobs.list;
@@ -497,6 +690,9 @@ bool DFHack::Job::linkIntoWorld(df::job *job, bool new_id)
         job->list_link = new df::job_list_link();
         job->list_link->item = job;
         linked_list_insert_after(ins_pos, job->list_link);
+
+        // the position in the list order is not cheap to find here
+        job_index.valid = false;
         return true;
     }
 }
@@ -28,6 +28,7 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <cstring>
 using namespace std;
 
@@ -160,6 +161,146 @@ bool MaterialInfo::decode(int16_t type, int32_t index)
     return (material != NULL);
 }
 
+/*
+ * Token index
+ *
+ * Maps raw ids and material subtokens to their indices. It is built on first
+ * use, and dropped when a world is loaded or unloaded, or when the raw vectors
+ * change under it.
+ */
+
+namespace {
+    struct MaterialTokenIndex {
+        bool valid = false;
+
+        // Identity of the raw vectors the index was built from
+        const void *inorganic_data = nullptr, *plant_data = nullptr, *creature_data = nullptr;
+        size_t inorganic_count = 0, plant_count = 0, creature_count = 0;
+
+        std::unordered_map<std::string, int16_t> builtin;
+        std::unordered_map<std::string, int32_t> inorganic;
+        std::unordered_map<std::string, int32_t> plant;
+        std::unordered_map<std::string, int32_t> creature;
+        // keyed by "RAW_ID:MAT_ID"; value is the material type
+        std::unordered_map<std::string, int16_t> plant_mat;
+        std::unordered_map<std::string, int16_t> creature_mat;
+
+        bool matches(df::world_raws &raws) const
+        {
+            return valid &&
+                inorganic_data == raws.inorganics.data() && inorganic_count == raws.inorganics.size() &&
+                plant_data == raws.plants.all.data() && plant_count == raws.plants.all.size() &&
+                creature_data == raws.creatures.all.data() && creature_count == raws.creatures.all.size();
+        }
+
+        void clear()
+        {
+            valid = false;
+            builtin.clear();
+            inorganic.clear();
+            plant.clear();
+            creature.clear();
+            plant_mat.clear();
+            creature_mat.clear();
+        }
+
+        void build(df::world_raws &raws)
+        {
+            clear();
+
+            // The first entry with a given id wins, as in a linear search
+            for (int i = 0; i < MaterialInfo::NUM_BUILTIN; i++)
+            {
+                auto obj = raws.mat_table.builtin[i];
+                if (obj)
+                    builtin.emplace(obj->id, int16_t(i));
+            }
+
+            inorganic.reserve(raws.inorganics.size());
+            for (size_t i = 0; i < raws.inorganics.size(); i++)
+                inorganic.emplace(raws.inorganics[i]->id, int32_t(i));
+
+            plant.reserve(raws.plants.all.size());
+            for (size_t i = 0; i < raws.plants.all.size(); i++)
+            {
+                auto p = raws.plants.all[i];
+                if (!plant.emplace(p->id, int32_t(i)).second)
+                    continue;
+                for (size_t j = 0; j < p->material.size(); j++)
+                    plant_mat.emplace(p->id + ":" + p->material[j]->id, int16_t(MaterialInfo::PLANT_BASE+j));
+            }
+
+            creature.reserve(raws.creatures.all.size());
+            for (size_t i = 0; i < raws.creatures.all.size(); i++)
+            {
+                auto p = raws.creatures.all[i];
+                if (!creature.emplace(p->creature_id, int32_t(i)).second)
+                    continue;
+                for (size_t j = 0; j < p->material.size(); j++)
+                    creature_mat.emplace(p->creature_id + ":" + p->material[j]->id, int16_t(MaterialInfo::CREATURE_BASE+j));
+            }
+
+            inorganic_data = raws.inorganics.data();
+            inorganic_count = raws.inorganics.size();
+            plant_data = raws.plants.all.data();
+            plant_count = raws.plants.all.size();
+            creature_data = raws.creatures.all.data();
+            creature_count = raws.creatures.all.size();
+            valid = true;
+        }
+    };
+}
+
+static MaterialTokenIndex token_index;
+
+static MaterialTokenIndex &getTokenIndex()
+{
+    df::world_raws &raws = world->raws;
+    if (!token_index.matches(raws))
+        token_index.build(raws);
+    return token_index;
+}
+
+template<class T>
+static int32_t lookup(const std::unordered_map<std::string, T> &map, const std::string &key)
+{
+    auto it = map.find(key);
+    return it == map.end() ? -1 : int32_t(it->second);
+}
+
+void materials_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_WORLD_LOADED:
+    case SC_WORLD_UNLOADED:
+        token_index.clear();
+        break;
+    default:
+        break;
+    }
+}
+
+int DFHack::findInorganicIndex(const std::string &id)
+{
+    if (!world)
+        return -1;
+    return lookup(getTokenIndex().inorganic, id);
+}
+
+int DFHack::findPlantIndex(const std::string &id)
+{
+    if (!world)
+        return -1;
+    return lookup(getTokenIndex().plant, id);
+}
+
+int DFHack::findCreatureIndex(const std::string &id)
+{
+    if (!world)
+        return -1;
+    return lookup(getTokenIndex().creature, id);
+}
+
 bool MaterialInfo::find(const std::string &token)
 {
     std::vector<std::string> items;
@@ -218,13 +359,9 @@ bool MaterialInfo::findBuiltin(const std::string &token)
         return true;
     }
 
-    df::world_raws &raws = world->raws;
-    for (int i = 0; i < NUM_BUILTIN; i++)
-    {
-        auto obj = raws.mat_table.builtin[i];
-        if (obj && obj->id == token)
-            return decode(i, -1);
-    }
+    int type = lookup(getTokenIndex().builtin, token);
+    if (type >= 0)
+        return decode(type, -1);
     return decode(-1);
 }
 
@@ -238,13 +375,9 @@ bool MaterialInfo::findInorganic(const std::string &token)
         return true;
     }
 
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.inorganics.size(); i++)
-    {
-        df::inorganic_raw *p = raws.inorganics[i];
-        if (p->id == token)
-            return decode(0, i);
-    }
+    int index = lookup(getTokenIndex().inorganic, token);
+    if (index >= 0)
+        return decode(0, index);
     return decode(-1);
 }
 
@@ -252,23 +385,22 @@ bool MaterialInfo::findPlant(const std::string &token, const std::string &subtok
 {
     if (token.empty())
         return decode(-1);
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.plants.all.size(); i++)
-    {
-        df::plant_raw *p = raws.plants.all[i];
-        if (p->id != token)
-            continue;
-
-        // As a special exception, return the structural material with empty subtoken
-        if (subtoken.empty())
-            return decode(p->material_defs.type[plant_material_def::basic_mat], p->material_defs.idx[plant_material_def::basic_mat]);
 
-        for (size_t j = 0; j < p->material.size(); j++)
-            if (p->material[j]->id == subtoken)
-                return decode(PLANT_BASE+j, i);
+    auto &idx = getTokenIndex();
+    int index = lookup(idx.plant, token);
+    if (index < 0)
+        return decode(-1);
 
-        break;
+    // As a special exception, return the structural material with empty subtoken
+    if (subtoken.empty())
+    {
+        df::plant_raw *p = world->raws.plants.all[index];
+        return decode(p->material_defs.type[plant_material_def::basic_mat], p->material_defs.idx[plant_material_def::basic_mat]);
     }
+
+    int type = lookup(idx.plant_mat, token + ":" + subtoken);
+    if (type >= 0)
+        return decode(type, index);
     return decode(-1);
 }
 
@@ -276,19 +408,15 @@ bool MaterialInfo::findCreature(const std::string &token, const std::string &sub
 {
     if (token.empty() || subtoken.empty())
         return decode(-1);
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.creatures.all.size(); i++)
-    {
-        df::creature_raw *p = raws.creatures.all[i];
-        if (p->creature_id != token)
-            continue;
 
-        for (size_t j = 0; j < p->material.size(); j++)
-            if (p->material[j]->id == subtoken)
-                return decode(CREATURE_BASE+j, i);
+    auto &idx = getTokenIndex();
+    int index = lookup(idx.creature, token);
+    if (index < 0)
+        return decode(-1);
 
-        break;
-    }
+    int type = lookup(idx.creature_mat, token + ":" + subtoken);
+    if (type >= 0)
+        return decode(type, index);
     return decode(-1);
 }
 
@@ -23,12 +23,20 @@ distribution.
 */
 
 #include "Internal.h"
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
 #include <map>
+#include <sstream>
+#include <unordered_map>
 #include <json/json.h>
 
 #include "Core.h"
 #include "DataDefs.h"
+#include "modules/Filesystem.h"
 #include "modules/Persistence.h"
 #include "modules/World.h"
 
@@ -37,13 +45,54 @@ distribution.
 using namespace DFHack;
 
 static std::vector<std::shared_ptr<Persistence::LegacyData>> legacy_data;
+// ordered index, used for key range and prefix queries
 static std::multimap<std::string, size_t> index_cache;
+// hashed index, used for exact key lookups; indices are in insertion order
+static std::unordered_map<std::string, std::vector<size_t>> key_index;
+
+static void index_add(const std::string &key, size_t index)
+{
+    index_cache.insert(std::make_pair(key, index));
+    key_index[key].push_back(index);
+}
+
+static void index_remove(const std::string &key, size_t index)
+{
+    auto range = index_cache.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == index)
+        {
+            index_cache.erase(it);
+            break;
+        }
+    }
+
+    auto it = key_index.find(key);
+    if (it != key_index.end())
+    {
+        auto &vec = it->second;
+        vec.erase(std::remove(vec.begin(), vec.end(), index), vec.end());
+        if (vec.empty())
+            key_index.erase(it);
+    }
+}
+
+// Bumped whenever an item is created or may have been modified, so that a
+// save only has to look at the items changed since the previous one.
+static uint64_t change_counter = 0;
 
 struct Persistence::LegacyData
 {
     const std::string key;
     std::string str_value;
     std::array<int, PersistentDataItem::NumInts> int_values;
+    uint64_t changed = ++change_counter;
+
+    void touch()
+    {
+        changed = ++change_counter;
+    }
 
     explicit LegacyData(const std::string &key) : key(key)
     {
@@ -69,6 +118,11 @@ struct Persistence::LegacyData
         }
     }
 
+    explicit LegacyData(const std::string &key, const std::string &str_value, const std::array<int, PersistentDataItem::NumInts> &int_values)
+        : key(key), str_value(str_value), int_values(int_values)
+    {
+    }
+
     Json::Value toJSON()
     {
         Json::Value json(Json::objectValue);
@@ -85,6 +139,452 @@ struct Persistence::LegacyData
     }
 };
 
+static std::string getSaveFilePath(const std::string &world, const std::string &name);
+
+/*
+ * Binary store
+ *
+ * The file is a header followed by an append-only log of records. Each save
+ * appends the records that changed since the previous one, followed by a
+ * commit marker; anything after the last commit marker is ignored on load.
+ * Once the log grows too large compared to the live data, it is rewritten
+ * from scratch into a temporary file that then replaces the old one.
+ * Record layout (little endian):
+ *
+ *   u8 op, u32 index                                     (OP_DELETE)
+ *   u8 op, u32 slot count, u64 hash of the JSON copy     (OP_COMMIT)
+ *   u8 op, u32 index, u32 key_len, key, u32 val_len, val, NumInts x i32   (OP_PUT)
+ *
+ * Items are not serialized again unless they were touched since the last
+ * save (see LegacyData::changed), and nothing at all is written if none
+ * were. The JSON copy is written next to the store whenever the data
+ * changed, so that older versions can still read it. Its hash tells whether
+ * it was rewritten since, by a version that does not know about the binary
+ * store.
+ */
+
+namespace BinaryStore
+{
+    using Persistence::LegacyData;
+    typedef std::vector<std::shared_ptr<LegacyData>> DataVector;
+
+    static const char MAGIC[8] = { 'D', 'F', 'H', 'P', 'E', 'R', 'S', '1' };
+    static const size_t HEADER_SIZE = sizeof(MAGIC) + 8;
+    static const char *const FILE_NAME = "legacy-data-bin";
+
+    enum : uint8_t { OP_PUT = 1, OP_DELETE = 2, OP_COMMIT = 3 };
+
+    enum LoadResult { LOAD_OK, LOAD_MISSING, LOAD_CORRUPT };
+
+    // Rewrite the log when it is this many times bigger than the live data
+    static const size_t COMPACT_RATIO = 2;
+    static const size_t COMPACT_MIN_SIZE = 64 * 1024;
+
+    // What we know about the contents of one log file
+    struct Log
+    {
+        // Hash and size of each record as last written to the log, 0 if
+        // not in the log
+        std::vector<uint64_t> written;
+        std::vector<uint32_t> sizes;
+        // change_counter as of the last save or load; items with a higher
+        // LegacyData::changed may differ from what is in the log
+        uint64_t synced = 0;
+        // Identity and length of the log file that matches "written"
+        uint64_t generation = 0;
+        size_t log_size = 0;
+        // Hash of the JSON copy in the last commit marker
+        uint64_t json_hash = 0;
+
+        void reset()
+        {
+            written.clear();
+            sizes.clear();
+            synced = 0;
+            generation = 0;
+            log_size = 0;
+            json_hash = 0;
+        }
+    };
+
+    // The changes to append to a log, from collect()
+    struct Batch
+    {
+        std::string buf;
+        std::vector<uint64_t> written;
+        std::vector<uint32_t> sizes;
+        size_t live_size = HEADER_SIZE;
+        bool changed = false;
+    };
+
+    static void put_u32(std::string &buf, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            buf.push_back(char((v >> (8 * i)) & 0xFF));
+    }
+
+    static void put_u64(std::string &buf, uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            buf.push_back(char((v >> (8 * i)) & 0xFF));
+    }
+
+    static void put_str(std::string &buf, const std::string &str)
+    {
+        put_u32(buf, uint32_t(str.size()));
+        buf.append(str);
+    }
+
+    static uint64_t fnv1a(const char *data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= uint8_t(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        // 0 is reserved for "not written"
+        return hash ? hash : 1;
+    }
+
+    uint64_t hash(const std::string &data)
+    {
+        return fnv1a(data.data(), data.size());
+    }
+
+    static void put_record(std::string &buf, size_t index, const LegacyData &data)
+    {
+        buf.push_back(char(OP_PUT));
+        put_u32(buf, uint32_t(index));
+        put_str(buf, data.key);
+        put_str(buf, data.str_value);
+        for (int i = 0; i < PersistentDataItem::NumInts; i++)
+            put_u32(buf, uint32_t(data.int_values.at(i)));
+    }
+
+    static void put_op(std::string &buf, uint8_t op, uint32_t arg)
+    {
+        buf.push_back(char(op));
+        put_u32(buf, arg);
+    }
+
+    class Reader
+    {
+        const std::string &buf;
+        size_t pos;
+
+    public:
+        Reader(const std::string &buf, size_t pos) : buf(buf), pos(pos) {}
+
+        size_t offset() const { return pos; }
+        bool eof() const { return pos >= buf.size(); }
+
+        bool get_u8(uint8_t &v)
+        {
+            if (pos + 1 > buf.size())
+                return false;
+            v = uint8_t(buf[pos++]);
+            return true;
+        }
+
+        bool get_u32(uint32_t &v)
+        {
+            if (pos + 4 > buf.size())
+                return false;
+            v = 0;
+            for (int i = 0; i < 4; i++)
+                v |= uint32_t(uint8_t(buf[pos++])) << (8 * i);
+            return true;
+        }
+
+        bool get_u64(uint64_t &v)
+        {
+            if (pos + 8 > buf.size())
+                return false;
+            v = 0;
+            for (int i = 0; i < 8; i++)
+                v |= uint64_t(uint8_t(buf[pos++])) << (8 * i);
+            return true;
+        }
+
+        bool get_str(std::string &str)
+        {
+            uint32_t size;
+            if (!get_u32(size) || pos + size > buf.size())
+                return false;
+            str.assign(buf, pos, size);
+            pos += size;
+            return true;
+        }
+    };
+
+    bool read_file(const std::string &path, std::string &buf)
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file)
+            return false;
+
+        buf.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Replaces dst with src, atomically where the platform allows it
+    static bool replace_file(const std::string &src, const std::string &dst)
+    {
+#ifdef _WIN32
+        return MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return std::rename(src.c_str(), dst.c_str()) == 0;
+#endif
+    }
+
+    static uint64_t new_generation(const Log &log)
+    {
+        uint64_t gen = uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+        gen ^= uint64_t(std::chrono::system_clock::now().time_since_epoch().count()) << 1;
+        return gen == log.generation ? gen + 1 : gen;
+    }
+
+    // Reads the store at path into data, and the hash of the JSON copy that
+    // was written along with it into json_hash. data is left alone unless
+    // LOAD_OK is returned.
+    LoadResult load(Log &log, const std::string &path, DataVector &data, uint64_t &json_hash)
+    {
+        if (!Filesystem::isfile(path))
+            return LOAD_MISSING;
+
+        std::string buf;
+        if (!read_file(path, buf) || buf.size() < HEADER_SIZE ||
+            memcmp(buf.data(), MAGIC, sizeof(MAGIC)) != 0)
+            return LOAD_CORRUPT;
+
+        Reader reader(buf, sizeof(MAGIC));
+        uint64_t gen;
+        reader.get_u64(gen);
+
+        DataVector loaded;
+        // Records are staged until their commit marker is seen
+        std::map<size_t, std::shared_ptr<LegacyData>> batch;
+        size_t committed = reader.offset();
+        json_hash = 0;
+
+        while (!reader.eof())
+        {
+            uint8_t op;
+            uint32_t index;
+            if (!reader.get_u8(op) || !reader.get_u32(index))
+                break;
+
+            if (op == OP_PUT)
+            {
+                std::string key, val;
+                std::array<int, PersistentDataItem::NumInts> ints;
+                bool ok = reader.get_str(key) && reader.get_str(val);
+                for (int i = 0; ok && i < PersistentDataItem::NumInts; i++)
+                {
+                    uint32_t v;
+                    ok = reader.get_u32(v);
+                    ints.at(i) = int(v);
+                }
+                if (!ok)
+                    break;
+
+                batch[index] = std::make_shared<LegacyData>(key, val, ints);
+            }
+            else if (op == OP_DELETE)
+            {
+                batch[index] = nullptr;
+            }
+            else if (op == OP_COMMIT)
+            {
+                uint64_t commit_hash;
+                if (!reader.get_u64(commit_hash))
+                    break;
+
+                for (auto &entry : batch)
+                {
+                    if (loaded.size() <= entry.first)
+                        loaded.resize(entry.first + 1);
+                    loaded.at(entry.first) = entry.second;
+                }
+                batch.clear();
+
+                // the commit marker holds the slot count at save time
+                if (loaded.size() > index)
+                    loaded.resize(index);
+
+                json_hash = commit_hash;
+                committed = reader.offset();
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (committed != buf.size())
+            Core::printerr("Persistence: discarding %zu bytes of incomplete data in %s\n",
+                           buf.size() - committed, path.c_str());
+
+        // Record what is in the log so that the next save can append to it,
+        // provided that the file is still the same one.
+        log.generation = gen;
+        log.log_size = committed;
+        log.json_hash = json_hash;
+        log.written.assign(loaded.size(), 0);
+        log.sizes.assign(loaded.size(), 0);
+
+        std::string rec;
+        for (size_t i = 0; i < loaded.size(); i++)
+        {
+            if (!loaded.at(i))
+                continue;
+            rec.clear();
+            put_record(rec, i, *loaded.at(i));
+            log.written.at(i) = hash(rec);
+            log.sizes.at(i) = uint32_t(rec.size());
+        }
+        log.synced = change_counter;
+
+        data.swap(loaded);
+        return LOAD_OK;
+    }
+
+    bool can_append(const Log &log, const std::string &path)
+    {
+        if (!log.generation)
+            return false;
+
+        std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file || size_t(file.tellg()) != log.log_size)
+            return false;
+
+        char header[HEADER_SIZE];
+        file.seekg(0);
+        if (!file.read(header, HEADER_SIZE))
+            return false;
+
+        std::string hbuf(header, HEADER_SIZE);
+        Reader reader(hbuf, sizeof(MAGIC));
+        uint64_t gen;
+        return memcmp(header, MAGIC, sizeof(MAGIC)) == 0 && reader.get_u64(gen) && gen == log.generation;
+    }
+
+    // Serializes the items touched since the log was last written, and
+    // deletions. Items that were only read through a non-const accessor
+    // hash the same as before and are left out.
+    void collect(const Log &log, const DataVector &data, Batch &batch)
+    {
+        std::string rec;
+        batch.written.assign(data.size(), 0);
+        batch.sizes.assign(data.size(), 0);
+        batch.changed = data.size() != log.written.size();
+
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            bool in_log = i < log.written.size() && log.written.at(i);
+            if (!data.at(i))
+            {
+                if (in_log)
+                {
+                    put_op(batch.buf, OP_DELETE, uint32_t(i));
+                    batch.changed = true;
+                }
+                continue;
+            }
+
+            if (in_log && data.at(i)->changed <= log.synced)
+            {
+                batch.written.at(i) = log.written.at(i);
+                batch.sizes.at(i) = log.sizes.at(i);
+                batch.live_size += log.sizes.at(i);
+                continue;
+            }
+
+            rec.clear();
+            put_record(rec, i, *data.at(i));
+            batch.written.at(i) = hash(rec);
+            batch.sizes.at(i) = uint32_t(rec.size());
+            batch.live_size += rec.size();
+
+            if (!in_log || log.written.at(i) != batch.written.at(i))
+            {
+                batch.buf.append(rec);
+                batch.changed = true;
+            }
+        }
+    }
+
+    // Writes the batch from collect() to the store at path, appending to it
+    // if log says that the file is the one we last wrote.
+    bool save(Log &log, const std::string &path, const DataVector &data, Batch &batch, uint64_t json_hash)
+    {
+        std::string &buf = batch.buf;
+        bool changed = batch.changed;
+        size_t new_live = batch.live_size;
+
+        bool append = can_append(log, path);
+        // The commit marker carries the JSON hash, so a new one is
+        // needed if only the JSON copy changed.
+        if (append && !changed && json_hash == log.json_hash)
+            return true;
+
+        if (append && log.log_size + buf.size() > std::max(COMPACT_MIN_SIZE, COMPACT_RATIO * new_live))
+            append = false;
+
+        if (!append)
+        {
+            // Compact: write every live record into a fresh log
+            log.generation = new_generation(log);
+            buf.assign(MAGIC, sizeof(MAGIC));
+            put_u64(buf, log.generation);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                if (data.at(i))
+                    put_record(buf, i, *data.at(i));
+            }
+            log.log_size = 0;
+        }
+
+        put_op(buf, OP_COMMIT, uint32_t(data.size()));
+        put_u64(buf, json_hash);
+
+        // Appending is safe, since an incomplete batch is ignored on load.
+        // A rewrite goes to a temporary file first, so that a crash leaves
+        // either the old or the new log in place.
+        std::string target = append ? path : path + ".tmp";
+        {
+            std::ofstream file(target, std::ios::out | std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+            if (!file.write(buf.data(), buf.size()) || !file.flush())
+            {
+                Core::printerr("Persistence: could not write %s\n", target.c_str());
+                log.reset();
+                return false;
+            }
+        }
+        if (!append && !replace_file(target, path))
+        {
+            Core::printerr("Persistence: could not replace %s\n", path.c_str());
+            std::remove(target.c_str());
+            log.reset();
+            return false;
+        }
+
+        log.log_size += buf.size();
+        log.written = std::move(batch.written);
+        log.sizes = std::move(batch.sizes);
+        log.synced = change_counter;
+        log.json_hash = json_hash;
+        return true;
+    }
+}
+
+// The store in the save folder, and the last file written by exportBinary()
+static BinaryStore::Log world_log, export_log;
+// Set if the store of the loaded world could not be read, to keep the
+// files in the save from being overwritten with nothing.
+static bool load_failed = false;
+
 const std::string &PersistentDataItem::key() const
 {
     CHECK_INVALID_ARGUMENT(isValid());
@@ -94,6 +594,7 @@ const std::string &PersistentDataItem::key() const
 std::string &PersistentDataItem::val()
 {
     CHECK_INVALID_ARGUMENT(isValid());
+    data->touch();
     return data->str_value;
 }
 const std::string &PersistentDataItem::val() const
@@ -105,6 +606,7 @@ int &PersistentDataItem::ival(int i)
 {
     CHECK_INVALID_ARGUMENT(isValid());
     CHECK_INVALID_ARGUMENT(i >= 0 && i < NumInts);
+    data->touch();
     return data->int_values.at(i);
 }
 int PersistentDataItem::ival(int i) const
@@ -127,34 +629,80 @@ bool PersistentDataItem::isValid() const
     return legacy_data.at(index) == data;
 }
 
+static std::string toJSONString()
+{
+    Json::Value json(Json::arrayValue);
+    for (size_t i = 0; i < legacy_data.size(); i++)
+    {
+        if (legacy_data.at(i) != nullptr)
+        {
+            while (json.size() < i)
+            {
+                json[json.size()] = Json::Value();
+            }
+
+            json[int(i)] = legacy_data.at(i)->toJSON();
+        }
+    }
+
+    std::ostringstream out;
+    out << json;
+    return out.str();
+}
+
+static void rebuildIndex()
+{
+    index_cache.clear();
+    key_index.clear();
+
+    for (size_t i = 0; i < legacy_data.size(); i++)
+    {
+        if (legacy_data.at(i) != nullptr)
+            index_add(legacy_data.at(i)->key, i);
+    }
+}
+
 void Persistence::Internal::clear()
 {
     CoreSuspender suspend;
 
     legacy_data.clear();
     index_cache.clear();
+    key_index.clear();
+    world_log.reset();
+    load_failed = false;
 }
 
 void Persistence::Internal::save()
 {
     CoreSuspender suspend;
 
-    Json::Value json(Json::arrayValue);
-    for (size_t i = 0; i < legacy_data.size(); i++)
+    if (!Core::getInstance().isWorldLoaded())
+        return;
+
+    if (load_failed)
     {
-        if (legacy_data.at(i) != nullptr)
-        {
-            while (json.size() < i)
-            {
-                json[json.size()] = Json::Value();
-            }
+        Core::printerr("Persistence: not saving, since the stored data could not be loaded.\n");
+        return;
+    }
 
-            json[int(i)] = legacy_data.at(i)->toJSON();
-        }
+    std::string path = getSaveFilePath("current", BinaryStore::FILE_NAME);
+    BinaryStore::Batch batch;
+    BinaryStore::collect(world_log, legacy_data, batch);
+
+    // Nothing changed since the last save, so both files are up to date
+    if (!batch.changed && BinaryStore::can_append(world_log, path) &&
+        Filesystem::isfile(getSaveFilePath("current", "legacy-data")))
+        return;
+
+    // The JSON copy is for older versions, which do not read the binary store.
+    std::string json = toJSONString();
+    {
+        auto file = writeSaveData("legacy-data");
+        file << json;
     }
 
-    auto file = writeSaveData("legacy-data");
-    file << json;
+    BinaryStore::save(world_log, path, legacy_data, batch, BinaryStore::hash(json));
 }
 
 static void convertHFigs()
@@ -200,46 +748,179 @@ static void convertHFigs()
     figs.erase(dst, figs.end());
 }
 
-void Persistence::Internal::load()
+static void loadJSON(Json::Value &json, BinaryStore::DataVector &data)
 {
-    CoreSuspender suspend;
+    if (!json.isArray())
+        return;
 
-    clear();
+    data.resize(json.size());
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        if (json[int(i)].isObject())
+        {
+            data.at(i) = std::shared_ptr<Persistence::LegacyData>(new Persistence::LegacyData(json[int(i)]));
+        }
+    }
+}
+
+// Replaces all items with the imported ones. Items that keep their key and
+// slot are updated in place, so that references to them stay valid.
+static void replaceData(BinaryStore::DataVector &data)
+{
+    for (size_t i = 0; i < data.size() && i < legacy_data.size(); i++)
+    {
+        auto &old = legacy_data.at(i);
+        if (old && data.at(i) && old->key == data.at(i)->key)
+        {
+            old->str_value = data.at(i)->str_value;
+            old->int_values = data.at(i)->int_values;
+            old->touch();
+            data.at(i) = old;
+        }
+    }
 
-    auto file = readSaveData("legacy-data");
+    legacy_data.swap(data);
+    rebuildIndex();
+    load_failed = false;
+}
+
+static void loadJSONFile(const std::string &text)
+{
     Json::Value json;
     try
     {
-        file >> json;
+        std::istringstream(text) >> json;
     }
     catch (std::exception &)
     {
         // empty file?
     }
 
-    if (json.isArray())
+    loadJSON(json, legacy_data);
+}
+
+void Persistence::Internal::load()
+{
+    CoreSuspender suspend;
+
+    clear();
+
+    std::string world = World::ReadWorldFolder();
+    std::string bin_path = getSaveFilePath(world, BinaryStore::FILE_NAME);
+    std::string json_path = getSaveFilePath(world, "legacy-data");
+
+    std::string json;
+    bool have_json = BinaryStore::read_file(json_path, json);
+
+    // Saves made by older versions only have the JSON file.
+    uint64_t json_hash = 0;
+    switch (BinaryStore::load(world_log, bin_path, legacy_data, json_hash))
     {
-        legacy_data.resize(json.size());
-        for (size_t i = 0; i < legacy_data.size(); i++)
+    case BinaryStore::LOAD_OK:
+        // An older version has saved the world since we did, so the
+        // JSON file is newer than the binary store.
+        if (have_json && BinaryStore::hash(json) != json_hash)
         {
-            if (json[int(i)].isObject())
-            {
-                legacy_data.at(i) = std::shared_ptr<LegacyData>(new LegacyData(json[int(i)]));
-            }
+            Core::print("Persistence: %s was changed by another DFHack version, loading it instead.\n",
+                        json_path.c_str());
+            legacy_data.clear();
+            world_log.reset();
+            loadJSONFile(json);
         }
+        break;
+    case BinaryStore::LOAD_MISSING:
+        loadJSONFile(json);
+        break;
+    case BinaryStore::LOAD_CORRUPT:
+        // The JSON copy is written by the same saves, so it can stand in.
+        // The store is then rewritten from scratch on the next save.
+        if (have_json)
+        {
+            Core::printerr("Persistence: %s is corrupt; loading %s instead.\n",
+                           bin_path.c_str(), json_path.c_str());
+            legacy_data.clear();
+            world_log.reset();
+            loadJSONFile(json);
+            break;
+        }
+        Core::printerr("Persistence: %s is corrupt and %s is missing; persistent data was not loaded,\n"
+                       "and will not be saved until it is restored with dfhack.persistent.importJSON()\n"
+                       "or dfhack.persistent.importBinary().\n",
+                       bin_path.c_str(), json_path.c_str());
+        load_failed = true;
+        break;
     }
 
     convertHFigs();
 
-    for (size_t i = 0; i < legacy_data.size(); i++)
-    {
-        if (legacy_data.at(i) == nullptr)
-        {
-            continue;
-        }
+    rebuildIndex();
+}
+
+bool Persistence::exportJSON(std::ostream &out)
+{
+    CoreSuspender suspend;
+
+    if (!Core::getInstance().isWorldLoaded())
+        return false;
+
+    out << toJSONString();
+    return out.good();
+}
+
+bool Persistence::importJSON(std::istream &in)
+{
+    CoreSuspender suspend;
+
+    if (!Core::getInstance().isWorldLoaded())
+        return false;
 
-        index_cache.insert(std::make_pair(legacy_data.at(i)->key, i));
+    Json::Value json;
+    try
+    {
+        in >> json;
     }
+    catch (std::exception &)
+    {
+        return false;
+    }
+
+    if (!json.isArray())
+        return false;
+
+    BinaryStore::DataVector data;
+    loadJSON(json, data);
+    replaceData(data);
+
+    return true;
+}
+
+bool Persistence::exportBinary(const std::string &path)
+{
+    CoreSuspender suspend;
+
+    if (!Core::getInstance().isWorldLoaded())
+        return false;
+
+    BinaryStore::Batch batch;
+    BinaryStore::collect(export_log, legacy_data, batch);
+    return BinaryStore::save(export_log, path, legacy_data, batch, 0);
+}
+
+bool Persistence::importBinary(const std::string &path)
+{
+    CoreSuspender suspend;
+
+    if (!Core::getInstance().isWorldLoaded())
+        return false;
+
+    BinaryStore::DataVector data;
+    uint64_t json_hash;
+    if (BinaryStore::load(export_log, path, data, json_hash) != BinaryStore::LOAD_OK)
+        return false;
+
+    replaceData(data);
+
+    return true;
 }
 
 PersistentDataItem Persistence::addItem(const std::string &key)
@@ -266,7 +947,7 @@ PersistentDataItem Persistence::addItem(const std::string &key)
         legacy_data.at(index) = ptr;
     }
 
-    index_cache.insert(std::make_pair(key, index));
+    index_add(key, index);
 
     return PersistentDataItem(index, ptr);
 }
@@ -275,16 +956,17 @@ PersistentDataItem Persistence::getByKey(const std::string &key, bool *added)
 {
     CoreSuspender suspend;
 
-    auto it = index_cache.find(key);
+    auto it = key_index.find(key);
 
     if (added)
     {
-        *added = it == index_cache.end();
+        *added = it == key_index.end();
     }
 
-    if (it != index_cache.end())
+    if (it != key_index.end())
     {
-        return PersistentDataItem(it->second, legacy_data.at(it->second));
+        size_t index = it->second.front();
+        return PersistentDataItem(index, legacy_data.at(index));
     }
 
     if (!added)
@@ -317,15 +999,7 @@ bool Persistence::deleteItem(const PersistentDataItem &item)
     }
 
     size_t index = item.get_index();
-    auto range = index_cache.equal_range(item.key());
-    for (auto it = range.first; it != range.second; ++it)
-    {
-        if (it->second == index)
-        {
-            index_cache.erase(it);
-            break;
-        }
-    }
+    index_remove(item.key(), index);
     legacy_data.at(index) = nullptr;
 
     return true;
@@ -366,9 +1040,28 @@ void Persistence::getAllByKey(std::vector<PersistentDataItem> &vec, const std::s
 
     CoreSuspender suspend;
 
-    auto range = index_cache.equal_range(key);
-    for (auto it = range.first; it != range.second; ++it)
+    auto it = key_index.find(key);
+    if (it == key_index.end())
+        return;
+
+    for (size_t index : it->second)
     {
+        vec.push_back(PersistentDataItem(index, legacy_data.at(index)));
+    }
+}
+
+void Persistence::getAllByKeyPrefix(std::vector<PersistentDataItem> &vec, const std::string &prefix)
+{
+    vec.clear();
+
+    CoreSuspender suspend;
+
+    auto it = index_cache.lower_bound(prefix);
+    for (; it != index_cache.end(); ++it)
+    {
+        if (it->first.compare(0, prefix.size(), prefix) != 0)
+            break;
+
         vec.push_back(PersistentDataItem(it->second, legacy_data.at(it->second)));
     }
 }
@@ -27,6 +27,9 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 using namespace std;
 
 #include "modules/Translation.h"
@@ -101,10 +104,117 @@ void addNameWord (string &out, const string &word)
     out.append(Translation::capitalize(word));
 }
 
+/*
+ * Cache of translated names, keyed by the contents of the name, so that
+ * UIs and RPC calls that translate the same names over and over don't
+ * rebuild the strings. Entries are checked against the full name, so a
+ * hash collision or a changed name can't return a stale string.
+ */
+
+namespace {
+    struct NameCacheEntry {
+        uint64_t hash;
+        int flags;
+        std::string first_name, nickname;
+        int32_t words[7];
+        int16_t parts_of_speech[7];
+        int32_t language;
+        std::string result;
+    };
+
+    const size_t NAME_CACHE_SIZE = 4096;
+
+    std::mutex name_cache_mutex;
+    std::list<NameCacheEntry> name_cache_lru; // most recently used first
+    std::unordered_map<uint64_t, std::list<NameCacheEntry>::iterator> name_cache;
+
+    void hash_bytes(uint64_t &hash, const void *data, size_t size)
+    {
+        auto bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    int name_flags(bool inEnglish, bool onlyLastPart)
+    {
+        int nick_mode = (d_init && gametype) ? d_init->nickname[*gametype] : d_init_nickname::CENTRALIZE;
+        return (inEnglish ? 1 : 0) | (onlyLastPart ? 2 : 0) | (nick_mode << 2);
+    }
+
+    uint64_t name_hash(const df::language_name *name, int flags)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        hash_bytes(hash, &flags, sizeof(flags));
+        hash_bytes(hash, name->first_name.data(), name->first_name.size());
+        hash_bytes(hash, "\0", 1);
+        hash_bytes(hash, name->nickname.data(), name->nickname.size());
+        for (int i = 0; i < 7; i++)
+        {
+            int32_t word = name->words[i];
+            int16_t part = name->parts_of_speech[i];
+            hash_bytes(hash, &word, sizeof(word));
+            hash_bytes(hash, &part, sizeof(part));
+        }
+        int32_t language = name->language;
+        hash_bytes(hash, &language, sizeof(language));
+        return hash;
+    }
+
+    bool name_matches(const NameCacheEntry &entry, const df::language_name *name, int flags)
+    {
+        if (entry.flags != flags || entry.language != name->language ||
+            entry.first_name != name->first_name || entry.nickname != name->nickname)
+            return false;
+        for (int i = 0; i < 7; i++)
+        {
+            if (entry.words[i] != name->words[i] ||
+                entry.parts_of_speech[i] != name->parts_of_speech[i])
+                return false;
+        }
+        return true;
+    }
+
+    void clear_name_cache()
+    {
+        std::lock_guard<std::mutex> lock(name_cache_mutex);
+        name_cache.clear();
+        name_cache_lru.clear();
+    }
+
+    void forget_name(const df::language_name *name)
+    {
+        std::lock_guard<std::mutex> lock(name_cache_mutex);
+        for (int i = 0; i < 4; i++)
+        {
+            int flags = name_flags(i & 1, i & 2);
+            auto it = name_cache.find(name_hash(name, flags));
+            if (it == name_cache.end())
+                continue;
+            name_cache_lru.erase(it->second);
+            name_cache.erase(it);
+        }
+    }
+}
+
+void translation_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event)
+    {
+    case SC_WORLD_LOADED:
+    case SC_WORLD_UNLOADED:
+        clear_name_cache();
+        break;
+    default:
+        break;
+    }
+}
+
 void Translation::setNickname(df::language_name *name, std::string nick)
 {
     CHECK_NULL_POINTER(name);
 
+    forget_name(name);
+
     if (!name->has_name)
     {
         if (nick.empty())
@@ -131,10 +241,59 @@ void Translation::setNickname(df::language_name *name, std::string nick)
     }
 }
 
+static string translateNameUncached(const df::language_name * name, bool inEnglish, bool onlyLastPart);
+
 string Translation::TranslateName(const df::language_name * name, bool inEnglish, bool onlyLastPart)
 {
     CHECK_NULL_POINTER(name);
 
+    int flags = name_flags(inEnglish, onlyLastPart);
+    uint64_t hash = name_hash(name, flags);
+
+    std::lock_guard<std::mutex> lock(name_cache_mutex);
+
+    auto it = name_cache.find(hash);
+    if (it != name_cache.end())
+    {
+        if (name_matches(*it->second, name, flags))
+        {
+            name_cache_lru.splice(name_cache_lru.begin(), name_cache_lru, it->second);
+            return it->second->result;
+        }
+
+        // hash collision: replace the old entry
+        name_cache_lru.erase(it->second);
+        name_cache.erase(it);
+    }
+
+    string result = translateNameUncached(name, inEnglish, onlyLastPart);
+
+    if (name_cache.size() >= NAME_CACHE_SIZE)
+    {
+        name_cache.erase(name_cache_lru.back().hash);
+        name_cache_lru.pop_back();
+    }
+
+    name_cache_lru.emplace_front();
+    auto &entry = name_cache_lru.front();
+    entry.hash = hash;
+    entry.flags = flags;
+    entry.first_name = name->first_name;
+    entry.nickname = name->nickname;
+    for (int i = 0; i < 7; i++)
+    {
+        entry.words[i] = name->words[i];
+        entry.parts_of_speech[i] = name->parts_of_speech[i];
+    }
+    entry.language = name->language;
+    entry.result = result;
+    name_cache[hash] = name_cache_lru.begin();
+
+    return result;
+}
+
+static string translateNameUncached(const df::language_name * name, bool inEnglish, bool onlyLastPart)
+{
     string out;
     string word;
 
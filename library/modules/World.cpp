@@ -220,10 +220,8 @@ void World::GetPersistentData(std::vector<PersistentDataItem> *vec, const std::s
         {
             min.push_back('/');
         }
-        std::string max = min;
-        ++max.back();
 
-        Persistence::getAllByKeyRange(*vec, min, max);
+        Persistence::getAllByKeyPrefix(*vec, min);
     }
     else
     {
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+#include <functional>
 #include <llimits.h>
 #include <sstream>
 #include <string>
@@ -6,11 +8,21 @@
 #include <set>
 
 typedef vector <df::coord> coord_vec;
+typedef std::function<void(MapExtras::Block *, coord_vec::const_iterator, coord_vec::const_iterator)> block_fn;
 class Brush
 {
 public:
     virtual ~Brush(){};
     virtual coord_vec points(MapExtras::MapCache & mc,DFHack::DFCoord start) = 0;
+    /**
+     * Calls fn(block, first, last) once per allocated map block the brush
+     * touches, with the brush points inside that block. Returns the number
+     * of blocks visited and adds the number of points to *num_tiles.
+     * The default collects all points first; brushes that can enumerate
+     * their blocks directly override it.
+     */
+    virtual size_t forEachBlock(MapExtras::MapCache & mc, DFHack::DFCoord start,
+                                const block_fn & fn, size_t * num_tiles = NULL);
     virtual std::string str() const {
         return "unknown";
     }
@@ -63,6 +75,40 @@ public:
         }
         return v;
     };
+    /**
+     * Walks the rectangle one map block at a time, so only the points of
+     * the current block are held in memory.
+     */
+    size_t forEachBlock(MapExtras::MapCache & mc, DFHack::DFCoord start,
+                        const block_fn & fn, size_t * num_tiles = NULL)
+    {
+        int x1 = start.x - cx_, x2 = x1 + x_ - 1;
+        int y1 = start.y - cy_, y2 = y1 + y_ - 1;
+        int z1 = start.z - cz_, z2 = z1 + z_ - 1;
+        size_t count = 0;
+        coord_vec v;
+        for (int z = z1; z <= z2; z++)
+        {
+            for (int by = y1 >> 4; by <= (y2 >> 4); by++)
+            {
+                for (int bx = x1 >> 4; bx <= (x2 >> 4); bx++)
+                {
+                    MapExtras::Block *blk = mc.BlockAt(DFHack::DFCoord(bx, by, z));
+                    if (!blk || !blk->is_valid())
+                        continue;
+                    v.clear();
+                    for (int x = std::max(x1, bx * 16); x <= std::min(x2, bx * 16 + 15); x++)
+                        for (int y = std::max(y1, by * 16); y <= std::min(y2, by * 16 + 15); y++)
+                            v.push_back(DFHack::DFCoord(x, y, z));
+                    if (num_tiles)
+                        *num_tiles += v.size();
+                    fn(blk, v.begin(), v.end());
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
     ~RectangleBrush(){};
     std::string str() const {
         if (x_ == 1 && y_ == 1 && z_ == 1)
@@ -208,6 +254,56 @@ private:
     DFHack::Core *c_;
 };
 
+/**
+ * Sorts brush points so that the tiles of each map block are contiguous and
+ * calls fn(block, first, last) once per block, skipping unallocated blocks.
+ * Painters use the block-local accessors inside fn instead of looking up the
+ * block for every tile. Returns the number of blocks visited.
+ */
+template<class F>
+size_t forEachBlock(MapExtras::MapCache & mc, coord_vec & tiles, F fn)
+{
+    auto block_of = [](const df::coord &c) {
+        return df::coord(c.x >> 4, c.y >> 4, c.z);
+    };
+    std::stable_sort(tiles.begin(), tiles.end(),
+        [&](const df::coord &a, const df::coord &b) {
+            df::coord ba = block_of(a), bb = block_of(b);
+            if (ba.z != bb.z)
+                return ba.z < bb.z;
+            if (ba.y != bb.y)
+                return ba.y < bb.y;
+            return ba.x < bb.x;
+        });
+
+    size_t count = 0;
+    for (auto first = tiles.begin(); first != tiles.end(); )
+    {
+        df::coord bcoord = block_of(*first);
+        auto last = first;
+        while (last != tiles.end() && block_of(*last) == bcoord)
+            ++last;
+
+        MapExtras::Block *blk = mc.BlockAt(bcoord);
+        if (blk && blk->is_valid())
+        {
+            fn(blk, first, last);
+            count++;
+        }
+        first = last;
+    }
+    return count;
+}
+
+inline size_t Brush::forEachBlock(MapExtras::MapCache & mc, DFHack::DFCoord start,
+                                  const block_fn & fn, size_t * num_tiles)
+{
+    coord_vec tiles = points(mc, start);
+    if (num_tiles)
+        *num_tiles += tiles.size();
+    return ::forEachBlock(mc, tiles, fn);
+}
+
 DFHack::command_result parseRectangle(DFHack::color_ostream & out,
                               vector<string>  & input, int start, int end,
                               int & width, int & height, int & zLevels,
@@ -5,6 +5,7 @@
 #include <Export.h>
 #include <PluginManager.h>
 
+#include <algorithm>
 #include <map>
 
 // DF data structure definition headers
@@ -16,6 +17,7 @@
 #include "modules/Units.h"
 #include "modules/World.h"
 
+#include "df/items_other_id.h"
 #include "df/itemdef_armorst.h"
 #include "df/itemdef_glovesst.h"
 #include "df/itemdef_shoesst.h"
@@ -506,29 +508,126 @@ static void find_needed_clothing_items()
     }
 }
 
+/*
+ * Clothing items grouped by type and subtype, kept between runs.
+ *
+ * The items.other vectors are sorted by id and new items get the highest ids,
+ * so each run only has to pick up the items at the end. If anything else
+ * changed in a vector (usually worn out items being deleted), its group is
+ * rebuilt from the vector instead of from all the items in the world.
+ * Entries are still checked against df::item::find before use, so a freed
+ * item can never reach the ownership checks.
+ */
+struct ClothingItem
+{
+    df::item *item;
+    int32_t id;
+    int16_t race;
+    // job_material_category bits that the material of the item matches
+    uint32_t material_mask;
+};
+
+struct ClothingTypeIndex
+{
+    df::items_other_id other_id;
+    int32_t max_id = -1;
+    size_t count = 0;
+    std::map<int16_t, std::vector<ClothingItem>> by_subtype;
+};
+
+static std::map<df::item_type, ClothingTypeIndex> clothing_index;
+
+static ClothingItem make_clothing_item(df::item *item)
+{
+    ClothingItem entry;
+    entry.item = item;
+    entry.id = item->id;
+    entry.race = item->getMakerRace();
+    entry.material_mask = 0;
+
+    MaterialInfo matInfo;
+    matInfo.decode(item);
+    for (int bit = 0; bit < 32; bit++)
+    {
+        df::job_material_category category;
+        category.whole = 1U << bit;
+        if (matInfo.matches(category))
+            entry.material_mask |= category.whole;
+    }
+    return entry;
+}
+
+static bool item_id_lt(int32_t id, df::item *item)
+{
+    return id < item->id;
+}
+
+static ClothingTypeIndex &update_clothing_index(df::item_type type)
+{
+    auto it = clothing_index.find(type);
+    if (it == clothing_index.end())
+    {
+        ClothingTypeIndex index;
+        if (!find_enum_item(&index.other_id, ENUM_KEY_STR(item_type, type)))
+            index.other_id = items_other_id::IN_PLAY;
+        it = clothing_index.insert(std::make_pair(type, index)).first;
+    }
+    auto &index = it->second;
+    auto &items = world->items.other[index.other_id];
+
+    // an unsorted vector (max_id == INT32_MAX) gives no way to tell what
+    // changed, since a delete followed by a create keeps the same size
+    auto first_new = std::upper_bound(items.begin(), items.end(), index.max_id, item_id_lt);
+    bool rebuild = index.max_id == INT32_MAX ||
+        size_t(first_new - items.begin()) != index.count;
+    if (rebuild)
+    {
+        // something other than an append happened; start over
+        index.by_subtype.clear();
+        index.max_id = -1;
+        first_new = items.begin();
+    }
+
+    for (auto item_it = first_new; item_it != items.end(); ++item_it)
+    {
+        auto item = *item_it;
+        // if the vector is not sorted after all, any change forces a rebuild
+        if (item->id <= index.max_id)
+            index.max_id = INT32_MAX;
+        else if (index.max_id != INT32_MAX)
+            index.max_id = item->id;
+        if (item->getType() != type)
+            continue;
+        index.by_subtype[item->getSubtype()].push_back(make_clothing_item(item));
+    }
+
+    index.count = items.size();
+    return index;
+}
+
 static void remove_available_clothing()
 {
-    for (auto& item : world->items.all)
+    for (auto& clothingOrder : clothingOrders)
     {
-        //skip any owned items.
-        if (getOwner(item))
+        auto &index = update_clothing_index(clothingOrder.itemType);
+        auto group = index.by_subtype.find(clothingOrder.item_subtype);
+        if (group == index.by_subtype.end())
             continue;
 
-        //again, for each item, find if any clothing order matches
-        for (auto& clothingOrder : clothingOrders)
+        for (auto &entry : group->second)
         {
-            if (item->getType() != clothingOrder.itemType)
-                continue;
-            if (item->getSubtype() != clothingOrder.item_subtype)
+            if (!(entry.material_mask & clothingOrder.material_category.whole))
                 continue;
 
-            MaterialInfo matInfo;
-            matInfo.decode(item);
+            //the item may have been deleted since the index was updated
+            if (df::item::find(entry.id) != entry.item)
+                continue;
 
-            if (!matInfo.matches(clothingOrder.material_category))
+            //skip any owned items.
+            if (getOwner(entry.item))
                 continue;
 
-            clothingOrder.total_needed_per_race[item->getMakerRace()] --;
+            clothingOrder.total_needed_per_race[entry.race] --;
         }
     }
 }
@@ -603,6 +702,7 @@ static void do_autoclothing()
 static void cleanup_state(color_ostream &out)
 {
     clothingOrders.clear();
+    clothing_index.clear();
     autoclothing_enabled = false;
 }
 
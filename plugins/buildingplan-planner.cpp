@@ -593,6 +593,7 @@ void Planner::reset()
     default_item_filters.clear();
     planned_buildings.clear();
     tasks.clear();
+    scan_state.clear();
 
     config = init_global_settings(global_settings);
 
@@ -734,14 +735,17 @@ bool Planner::registerTasks(PlannedBuilding & pb)
         // as invalid
         for (auto vector_id : vector_ids)
         {
+            auto & task_bucket = tasks[vector_id][bucket];
+            if (task_bucket.tasks.empty())
+                task_bucket.epoch = ++bucket_epoch;
             for (int item_num = 0; item_num < job_item->quantity; ++item_num)
             {
-                tasks[vector_id][bucket].push(std::make_pair(id, job_item_idx));
+                task_bucket.tasks.push(std::make_pair(id, job_item_idx));
                 debug("added task: %s/%s/%d,%d; "
                       "%zu vector(s), %zu filter bucket(s), %zu task(s) in bucket",
                       ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
                       bucket.c_str(), id, job_item_idx, tasks.size(),
-                      tasks[vector_id].size(), tasks[vector_id][bucket].size());
+                      tasks[vector_id].size(), task_bucket.tasks.size());
             }
         }
     }
@@ -930,33 +934,188 @@ void Planner::popInvalidTasks(std::queue<std::pair<int32_t, int>> & task_queue)
     }
 }
 
-void Planner::doVector(df::job_item_vector_id vector_id,
-       std::map<std::string, std::queue<std::pair<int32_t, int>>> & buckets)
+// how often to rescan a whole vector even if nothing seems to have changed,
+// in case items got moved into it in a way we could not detect
+static const int FULL_SCAN_INTERVAL = 20;
+
+static bool item_id_lt(df::item *item, int32_t id)
+{
+    return item->id < id;
+}
+
+// returns the item with the given id if it is in the vector, which must be
+// sorted by id
+static df::item * findInVector(const std::vector<df::item *> & vec, int32_t id)
+{
+    auto it = std::lower_bound(vec.begin(), vec.end(), id, item_id_lt);
+    return (it != vec.end() && (*it)->id == id) ? *it : NULL;
+}
+
+void Planner::doVector(df::job_item_vector_id vector_id, TaskBuckets & buckets)
 {
     auto other_id = ENUM_ATTR(job_item_vector_id, other, vector_id);
-    auto item_vector = df::global::world->items.other[other_id];
-    debug("matching %zu item(s) in vector %s against %zu filter bucket(s)",
-          item_vector.size(),
-          ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
-          buckets.size());
-    for (auto item_it = item_vector.rbegin();
-         item_it != item_vector.rend();
-         ++item_it)
+    const auto & item_vector = df::global::world->items.other[other_id];
+    auto & state = scan_state[vector_id];
+
+    // drop stale tasks up front so the bucket heads are valid
+    uint32_t max_epoch = 0;
+    for (auto bucket_it = buckets.begin(); bucket_it != buckets.end();)
     {
-        auto item = *item_it;
-        if (!itemPassesScreen(item))
+        popInvalidTasks(bucket_it->second.tasks);
+        if (bucket_it->second.tasks.empty())
+        {
+            debug("removing empty bucket: %s/%s; %zu bucket(s) left",
+                  ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
+                  bucket_it->first.c_str(),
+                  buckets.size() - 1);
+            bucket_it = buckets.erase(bucket_it);
             continue;
-        for (auto bucket_it = buckets.begin(); bucket_it != buckets.end();)
+        }
+        max_epoch = std::max(max_epoch, bucket_it->second.epoch);
+        ++bucket_it;
+    }
+    if (buckets.empty())
+        return;
+
+    // a full scan is needed if there are buckets that have not seen the
+    // existing items yet, or if items were added with ids below the ones we
+    // have already seen. otherwise only new and parked items are candidates.
+    auto first_new = std::upper_bound(item_vector.begin(), item_vector.end(),
+            state.max_seen_id,
+            [](int32_t id, df::item *item) { return id < item->id; });
+    size_t num_old = first_new - item_vector.begin();
+    // every once in a while, also recheck items that did not match before in
+    // case they changed in some way that the filters care about
+    bool refresh = ++state.cycles_since_full_scan >= FULL_SCAN_INTERVAL;
+    bool full_scan = refresh || !state.sorted || max_epoch > state.epoch
+        || num_old > state.last_size;
+
+    // (item, epoch of the buckets it has already been matched against)
+    std::vector<std::pair<df::item *, uint32_t>> candidates;
+
+    if (full_scan)
+    {
+        std::unordered_map<int32_t, uint32_t> rejected;
+        state.parked.clear();
+        state.sorted = true;
+        int32_t prev_id = INT_MAX;
+        for (auto item_it = item_vector.rbegin();
+             item_it != item_vector.rend();
+             ++item_it)
         {
-            auto & task_queue = bucket_it->second;
+            auto item = *item_it;
+            if (item->id >= prev_id)
+                state.sorted = false;
+            prev_id = item->id;
+
+            if (!itemPassesScreen(item))
+            {
+                state.parked.insert(item->id);
+                continue;
+            }
+            auto rej_it = state.rejected.find(item->id);
+            uint32_t seen = (refresh || rej_it == state.rejected.end())
+                    ? 0 : rej_it->second;
+            if (seen >= max_epoch)
+            {
+                // no bucket can match it
+                rejected[item->id] = seen;
+                continue;
+            }
+            candidates.push_back(std::make_pair(item, seen));
+        }
+        state.rejected.swap(rejected);
+        state.epoch = max_epoch;
+        state.cycles_since_full_scan = 0;
+    }
+    else
+    {
+        // new items, newest first as in the full scan
+        for (auto item_it = item_vector.end(); item_it != first_new;)
+        {
+            auto item = *--item_it;
+            if (itemPassesScreen(item))
+                candidates.push_back(std::make_pair(item, 0));
+            else
+                state.parked.insert(item->id);
+        }
+        // parked items that may have become available
+        for (auto id_it = state.parked.begin(); id_it != state.parked.end();)
+        {
+            df::item *item = findInVector(item_vector, *id_it);
+            if (!item)
+            {
+                id_it = state.parked.erase(id_it);
+                continue;
+            }
+            if (itemPassesScreen(item))
+            {
+                candidates.push_back(std::make_pair(item, 0));
+                id_it = state.parked.erase(id_it);
+                continue;
+            }
+            ++id_it;
+        }
+    }
+
+    if (!item_vector.empty())
+        state.max_seen_id = std::max(state.max_seen_id, item_vector.back()->id);
+    state.last_size = item_vector.size();
+
+    debug("matching %zu of %zu item(s) in vector %s against %zu filter bucket(s)%s",
+          candidates.size(), item_vector.size(),
+          ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
+          buckets.size(), full_scan ? " (full scan)" : "");
+
+    // buckets are emptied but not erased while matching so that the
+    // iterators below stay valid
+    size_t live_buckets = buckets.size();
+
+    // buckets that can accept items of a given type, in bucket order. the
+    // item type is part of the bucket key, so all tasks in a bucket agree.
+    std::unordered_map<int, std::vector<TaskBuckets::iterator>> buckets_by_type;
+    auto getBucketsForType = [&](int item_type)
+        -> std::vector<TaskBuckets::iterator> &
+    {
+        auto found = buckets_by_type.find(item_type);
+        if (found != buckets_by_type.end())
+            return found->second;
+        auto & ret = buckets_by_type[item_type];
+        for (auto bucket_it = buckets.begin(); bucket_it != buckets.end(); ++bucket_it)
+        {
+            auto & task_queue = bucket_it->second.tasks;
+            if (task_queue.empty())
+                continue;
             popInvalidTasks(task_queue);
             if (task_queue.empty())
             {
-                debug("removing empty bucket: %s/%s; %zu bucket(s) left",
-                      ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
-                      bucket_it->first.c_str(),
-                      buckets.size() - 1);
-                bucket_it = buckets.erase(bucket_it);
+                --live_buckets;
+                continue;
+            }
+            auto & task = task_queue.front();
+            auto job_item = planned_buildings.at(task.first)
+                    .getBuilding()->jobs[0]->job_items[task.second];
+            if (job_item->item_type < 0 || job_item->item_type == item_type)
+                ret.push_back(bucket_it);
+        }
+        return ret;
+    };
+
+    for (auto & candidate : candidates)
+    {
+        auto item = candidate.first;
+        bool matched = false;
+        for (auto bucket_it : getBucketsForType(item->getType()))
+        {
+            auto & bucket = bucket_it->second;
+            auto & task_queue = bucket.tasks;
+            if (task_queue.empty() || bucket.epoch <= candidate.second)
+                continue;
+            // earlier matches may have completed the building at the front
+            popInvalidTasks(task_queue);
+            if (task_queue.empty())
+            {
+                --live_buckets;
                 continue;
             }
             auto & task = task_queue.front();
@@ -993,22 +1152,33 @@ void Planner::doVector(df::job_item_vector_id vector_id,
                     unregisterBuilding(id);
                 }
                 if (task_queue.empty())
-                {
-                    debug(
-                        "removing empty item bucket: %s/%s; %zu left",
-                        ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
-                        bucket_it->first.c_str(),
-                        buckets.size() - 1);
-                    buckets.erase(bucket_it);
-                }
+                    --live_buckets;
+                matched = true;
                 // we found a home for this item; no need to look further
                 break;
             }
-            ++bucket_it;
         }
-        if (buckets.empty())
+        if (matched)
+            state.rejected.erase(item->id);
+        else
+            state.rejected[item->id] = bucket_epoch;
+        if (!live_buckets)
             break;
     }
+
+    for (auto bucket_it = buckets.begin(); bucket_it != buckets.end();)
+    {
+        if (bucket_it->second.tasks.empty())
+        {
+            debug("removing empty item bucket: %s/%s; %zu left",
+                  ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
+                  bucket_it->first.c_str(),
+                  buckets.size() - 1);
+            bucket_it = buckets.erase(bucket_it);
+        }
+        else
+            ++bucket_it;
+    }
 }
 
 struct VectorsToScanLast
@@ -1049,6 +1219,7 @@ void Planner::doCycle()
             debug("removing empty vector: %s; %zu vector(s) left",
                   ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
                   tasks.size() - 1);
+            scan_state.erase(vector_id);
             it = tasks.erase(it);
         }
         else
@@ -1066,6 +1237,7 @@ void Planner::doCycle()
                   ENUM_KEY_STR(job_item_vector_id, vector_id).c_str(),
                   tasks.size() - 1);
             tasks.erase(vector_id);
+            scan_state.erase(vector_id);
         }
     }
     debug("cycle done; %zu registered building(s) left",
@@ -2,6 +2,7 @@
 
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "df/building.h"
 #include "df/dfhack_material_category.h"
@@ -120,6 +121,35 @@ public:
     void doCycle();
 
 private:
+    // queue of (building id, job_item index) for tasks with identical filters
+    struct TaskBucket
+    {
+        std::queue<std::pair<int32_t, int>> tasks;
+        // buckets created after an item was last matched need to see it again
+        uint32_t epoch = 0;
+    };
+    typedef std::map<std::string, TaskBucket> TaskBuckets;
+
+    // what we already know about the items in a vector, so that each cycle
+    // only needs to look at items that are new or that may have changed
+    struct VectorScanState
+    {
+        // items with a higher id have not been seen yet
+        int32_t max_seen_id = -1;
+        // vector size after the last scan
+        size_t last_size = 0;
+        // bucket epoch covered by the last full scan
+        uint32_t epoch = 0;
+        int cycles_since_full_scan = 0;
+        // false if the vector turned out not to be sorted by id
+        bool sorted = true;
+        // ids of items that failed itemPassesScreen; they are rechecked
+        // every cycle since their flags can change at any time
+        std::unordered_set<int32_t> parked;
+        // item id -> bucket epoch at the time it matched none of the buckets
+        std::unordered_map<int32_t, uint32_t> rejected;
+    };
+
     DFHack::PersistentDataItem config;
     std::map<std::string, bool> global_settings;
     std::unordered_map<BuildingTypeKey,
@@ -127,14 +157,15 @@ private:
                        BuildingTypeKeyHash> default_item_filters;
     // building id -> PlannedBuilding
     std::unordered_map<int32_t, PlannedBuilding> planned_buildings;
-    // vector id -> filter bucket -> queue of (building id, job_item index)
-    std::map<df::job_item_vector_id, std::map<std::string, std::queue<std::pair<int32_t, int>>>> tasks;
+    // vector id -> filter bucket -> tasks
+    std::map<df::job_item_vector_id, TaskBuckets> tasks;
+    std::map<df::job_item_vector_id, VectorScanState> scan_state;
+    uint32_t bucket_epoch = 0;
 
     bool registerTasks(PlannedBuilding &plannedBuilding);
     void unregisterBuilding(int32_t id);
     void popInvalidTasks(std::queue<std::pair<int32_t, int>> &task_queue);
-    void doVector(df::job_item_vector_id vector_id,
-        std::map<std::string, std::queue<std::pair<int32_t, int>>> & buckets);
+    void doVector(df::job_item_vector_id vector_id, TaskBuckets & buckets);
 };
 
 extern Planner planner;
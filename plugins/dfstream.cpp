@@ -10,6 +10,7 @@
 
 #include <vector>
 #include <string>
+#include <sstream>
 #include "PassiveSocket.h"
 #include "tinythread.h"
 
@@ -23,13 +24,69 @@ DFHACK_PLUGIN("dfstream");
 REQUIRE_GLOBAL(gps);
 REQUIRE_GLOBAL(enabler);
 
+// Tiles that differ from the previous frame are sent as spans of one row each;
+// spans closer together than this are merged, since the header of a separate
+// message costs about as much as this many unchanged tiles.
+static const int SPAN_GAP = 10;
+
+static void append_rect(std::string & message, int dimx, int dimy, int x, int y, int w, int h) {
+    std::stringstream header;
+    header << dimx << ' ' << dimy << ' ' << x << ' ' << y << ' ' << w << ' ' << h << '\n';
+    message += header.str();
+}
+
+// Splits the changes between two frames of the same size into messages, each
+// covering one dirty span of a row. Frames hold two bytes per tile, row-major.
+// Returns false if a keyframe would be smaller.
+static bool diff_frames(vector<string> & messages, int dimx, int dimy,
+                        const vector<unsigned char> & frame, const vector<unsigned char> & last) {
+    size_t total = 0;
+    for (int y = 0; y < dimy; ++y) {
+        const unsigned char * row = &frame[y * dimx * 2];
+        const unsigned char * old = &last[y * dimx * 2];
+        int x = 0;
+        while (x < dimx) {
+            if (row[x*2] == old[x*2] && row[x*2+1] == old[x*2+1]) {
+                ++x;
+                continue;
+            }
+            int start = x, end = x + 1;
+            for (x = end; x < dimx && x - end < SPAN_GAP; ++x) {
+                if (row[x*2] != old[x*2] || row[x*2+1] != old[x*2+1])
+                    end = x + 1;
+            }
+            x = end;
+            string message;
+            append_rect(message, dimx, dimy, start, y, end - start, 1);
+            message.append((const char *) row + start*2, (end - start) * 2);
+            total += message.size() + 4;
+            if (total >= frame.size())
+                return false;
+            messages.push_back(message);
+        }
+    }
+    return true;
+}
+
 // Owns the thread that accepts TCP connections and forwards messages to clients;
 // has a mutex
 class client_pool {
     typedef tthread::mutex mutex;
 
+    struct client {
+        CActiveSocket * socket;
+        // the last frame this client was sent; empty until it gets a keyframe
+        int dimx, dimy;
+        vector<unsigned char> frame;
+
+        client(CActiveSocket * socket)
+            : socket(socket), dimx(0), dimy(0)
+        {
+        }
+    };
+
     mutex clients_lock;
-    std::vector<CActiveSocket *> clients;
+    std::vector<client> clients;
 
     // TODO - delete this at some point
     tthread::thread * accepter;
@@ -53,6 +110,18 @@ class client_pool {
         }
     }
 
+    static bool send(client & c, const std::string & message) {
+        unsigned int sz = htonl(message.size());
+        return c.socket->Send(reinterpret_cast<const uint8_t *>(&sz), sizeof(sz)) >= 0
+            && c.socket->Send((const uint8_t *) message.c_str(), message.size()) >= 0;
+    }
+
+    // MUST have lock
+    void drop_client(size_t i) {
+        delete clients[i].socket;
+        clients.erase(clients.begin() + i);
+    }
+
 public:
     class lock {
         tthread::lock_guard<mutex> l;
@@ -80,10 +149,43 @@ public:
 
     // MUST have lock
     void broadcast(const std::string & message) {
-        unsigned int sz = htonl(message.size());
-        for (size_t i = 0; i < clients.size(); ++i) {
-            clients[i]->Send(reinterpret_cast<const uint8_t *>(&sz), sizeof(sz));
-            clients[i]->Send((const uint8_t *) message.c_str(), message.size());
+        for (size_t i = 0; i < clients.size(); ) {
+            if (send(clients[i], message))
+                ++i;
+            else
+                drop_client(i);
+        }
+    }
+
+    // MUST have lock
+    // Sends each client only what changed since the frame it was sent last.
+    // Clients that are new, or saw the screen at another size, get a keyframe.
+    void send_frame(int dimx, int dimy, const vector<unsigned char> & frame) {
+        string keyframe;
+        vector<string> messages;
+        for (size_t i = 0; i < clients.size(); ) {
+            client & c = clients[i];
+            bool ok = true;
+            messages.clear();
+            if (c.dimx == dimx && c.dimy == dimy
+                && diff_frames(messages, dimx, dimy, frame, c.frame)) {
+                for (size_t j = 0; ok && j < messages.size(); ++j)
+                    ok = send(c, messages[j]);
+            } else {
+                if (keyframe.empty()) {
+                    append_rect(keyframe, dimx, dimy, 0, 0, dimx, dimy);
+                    keyframe.append(frame.begin(), frame.end());
+                }
+                ok = send(c, keyframe);
+            }
+            if (!ok) {
+                drop_client(i);
+                continue;
+            }
+            c.dimx = dimx;
+            c.dimy = dimy;
+            c.frame = frame;
+            ++i;
         }
     }
 };
@@ -103,6 +205,9 @@ class renderer_decorator : public df::renderer {
     // clients to which we send the frame
     client_pool clients;
 
+    // the frame being sent, reused to avoid reallocating it every time
+    vector<unsigned char> frame;
+
     // The following three methods facilitate copying of state to the inner object
     void set_to_null() {
         screen = NULL;
@@ -178,8 +283,8 @@ public:
         client_pool::lock lock(clients);
         if (!clients.has_clients()) return;
         framesNotPrinted = 0;
-        std::stringstream frame;
-        frame << gps->dimx << ' ' << gps->dimy << " 0 0 " << gps->dimx << ' ' << gps->dimy << '\n';
+        frame.resize(gps->dimx * gps->dimy * 2);
+        unsigned char * out = frame.data();
         unsigned char * sc_ = gps->screen;
         for (int y = 0; y < gps->dimy; ++y) {
             unsigned char * sc = sc_;
@@ -190,13 +295,13 @@ public:
                 { 0, 4, 2, 6, 1, 5, 3, 7, 8, 12, 10, 14, 9, 13, 11, 15 };
                 unsigned char fg   = translate[(sc[1] + bold) % 16];
                 unsigned char bg   = translate[sc[2] % 16]*16;
-                frame.put(ch);
-                frame.put(fg+bg);
+                *out++ = ch;
+                *out++ = fg+bg;
                 sc += 4*gps->dimy;
             }
             sc_ += 4;
         }
-        clients.broadcast(frame.str());
+        clients.send_frame(gps->dimx, gps->dimy, frame);
     }
     virtual void set_fullscreen() { inner->set_fullscreen(); }
     virtual void zoom(df::zoom_commands cmd) {
@@ -145,7 +145,8 @@ struct OperationMode {
 } cur_mode;
 
 command_result df_liquids_execute(color_ostream &out);
-command_result df_liquids_execute(color_ostream &out, OperationMode &mode, df::coord pos);
+command_result df_liquids_execute(color_ostream &out, OperationMode &mode, df::coord pos,
+                                  bool dry_run = false, size_t *painted = nullptr);
 
 static void print_prompt(std::ostream &str, OperationMode &cur_mode)
 {
@@ -408,7 +409,8 @@ command_result df_liquids_execute(color_ostream &out)
     return rv;
 }
 
-command_result df_liquids_execute(color_ostream &out, OperationMode &cur_mode, df::coord cursor)
+command_result df_liquids_execute(color_ostream &out, OperationMode &cur_mode, df::coord cursor,
+                                  bool dry_run, size_t *painted)
 {
     // create brush type depending on old parameters
     std::unique_ptr<Brush> brush;
@@ -444,101 +446,99 @@ command_result df_liquids_execute(color_ostream &out, OperationMode &cur_mode, d
     }
 
     MapCache mcache;
-    coord_vec all_tiles = brush->points(mcache,cursor);
 
     // Force the game to recompute its walkability cache
-    world->reindex_pathfinding = true;
+    if (!dry_run)
+        world->reindex_pathfinding = true;
+
+    size_t matched = 0;
+    size_t num_tiles = 0;
 
     switch (cur_mode.paint)
     {
     case P_OBSIDIAN:
+        brush->forEachBlock(mcache, cursor, [&](Block *b, coord_vec::const_iterator first, coord_vec::const_iterator last)
         {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
+            matched += last - first;
+            if (dry_run)
+                return;
+            for (auto iter = first; iter != last; ++iter)
             {
-                mcache.setTiletypeAt(*iter, tiletype::LavaWall);
-                mcache.setTemp1At(*iter,10015);
-                mcache.setTemp2At(*iter,10015);
-                df::tile_designation des = mcache.designationAt(*iter);
+                b->setTiletypeAt(*iter, tiletype::LavaWall);
+                b->setTemp1At(*iter,10015);
+                b->setTemp2At(*iter,10015);
+                df::tile_designation des = b->DesignationAt(*iter);
                 des.bits.flow_size = 0;
                 des.bits.flow_forbid = false;
-                mcache.setDesignationAt(*iter, des);
-                iter ++;
+                b->setDesignationAt(*iter, des);
             }
-            break;
-        }
+        }, &num_tiles);
+        break;
     case P_OBSIDIAN_FLOOR:
+        brush->forEachBlock(mcache, cursor, [&](Block *b, coord_vec::const_iterator first, coord_vec::const_iterator last)
         {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
-            {
-                mcache.setTiletypeAt(*iter, findRandomVariant(tiletype::LavaFloor1));
-                iter ++;
-            }
-            break;
-        }
+            matched += last - first;
+            if (dry_run)
+                return;
+            for (auto iter = first; iter != last; ++iter)
+                b->setTiletypeAt(*iter, findRandomVariant(tiletype::LavaFloor1));
+        }, &num_tiles);
+        break;
     case P_RIVER_SOURCE:
+        brush->forEachBlock(mcache, cursor, [&](Block *b, coord_vec::const_iterator first, coord_vec::const_iterator last)
         {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
+            matched += last - first;
+            if (dry_run)
+                return;
+            for (auto iter = first; iter != last; ++iter)
             {
-                mcache.setTiletypeAt(*iter, tiletype::RiverSource);
+                b->setTiletypeAt(*iter, tiletype::RiverSource);
 
-                df::tile_designation a = mcache.designationAt(*iter);
+                df::tile_designation a = b->DesignationAt(*iter);
                 a.bits.liquid_type = tile_liquid::Water;
                 a.bits.liquid_static = false;
                 a.bits.flow_size = 7;
-                mcache.setTemp1At(*iter,10015);
-                mcache.setTemp2At(*iter,10015);
-                mcache.setDesignationAt(*iter,a);
-
-                Block * b = mcache.BlockAt((*iter)/16);
-                b->enableBlockUpdates(true);
-
-                iter++;
+                b->setTemp1At(*iter,10015);
+                b->setTemp2At(*iter,10015);
+                b->setDesignationAt(*iter,a);
             }
-            break;
-        }
+            b->enableBlockUpdates(true);
+        }, &num_tiles);
+        break;
     case P_WCLEAN:
+        brush->forEachBlock(mcache, cursor, [&](Block *b, coord_vec::const_iterator first, coord_vec::const_iterator last)
         {
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
+            matched += last - first;
+            if (dry_run)
+                return;
+            for (auto iter = first; iter != last; ++iter)
             {
-                DFHack::DFCoord current = *iter;
-                df::tile_designation des = mcache.designationAt(current);
+                df::tile_designation des = b->DesignationAt(*iter);
                 des.bits.water_salt = false;
                 des.bits.water_stagnant = false;
-                mcache.setDesignationAt(current,des);
-                iter++;
+                b->setDesignationAt(*iter,des);
             }
-            break;
-        }
+        }, &num_tiles);
+        break;
     case P_MAGMA:
     case P_WATER:
     case P_FLOW_BITS:
+        brush->forEachBlock(mcache, cursor, [&](Block *block, coord_vec::const_iterator first, coord_vec::const_iterator last)
         {
-            set <Block *> seen_blocks;
-            coord_vec::iterator iter = all_tiles.begin();
-            while (iter != all_tiles.end())
+            auto raw_block = block->getRaw();
+            bool seen = false;
+            for (auto iter = first; iter != last; ++iter)
             {
                 DFHack::DFCoord current = *iter; // current tile coord
-                DFHack::DFCoord curblock = current /16; // current block coord
-                // check if the block is actually there
-                auto block = mcache.BlockAt(curblock);
-                if(!block)
-                {
-                    iter ++;
-                    continue;
-                }
-                auto raw_block = block->getRaw();
-                df::tile_designation des = mcache.designationAt(current);
-                df::tiletype tt = mcache.tiletypeAt(current);
+                df::tile_designation des = block->DesignationAt(current);
+                df::tiletype tt = block->tiletypeAt(current);
                 // don't put liquids into places where they don't belong...
                 if(!DFHack::FlowPassable(tt))
-                {
-                    iter++;
                     continue;
-                }
+                matched++;
+                seen = true;
+                if (dry_run)
+                    continue;
                 if(cur_mode.paint != P_FLOW_BITS)
                 {
                     unsigned old_amount = des.bits.flow_size;
@@ -575,18 +575,18 @@ command_result df_liquids_execute(color_ostream &out, OperationMode &cur_mode, d
                     {
                         if (new_liquid == tile_liquid::Water)
                         {
-                            mcache.setTemp1At(current,10015);
-                            mcache.setTemp2At(current,10015);
+                            block->setTemp1At(current,10015);
+                            block->setTemp2At(current,10015);
                         }
                         else
                         {
-                            mcache.setTemp1At(current,12000);
-                            mcache.setTemp2At(current,12000);
+                            block->setTemp1At(current,12000);
+                            block->setTemp2At(current,12000);
                         }
                     }
                     // mark the tile passable or impassable like the game does
                     des.bits.flow_forbid = (new_liquid == tile_liquid::Magma || new_amount > 3);
-                    mcache.setDesignationAt(current,des);
+                    block->setDesignationAt(current,des);
                     // request flow engine updates
                     block->enableBlockUpdates(new_amount != old_amount, new_liquid != old_liquid);
                 }
@@ -596,35 +596,40 @@ command_result df_liquids_execute(color_ostream &out, OperationMode &cur_mode, d
                     flow.bits.perm_flow_dir = permaflow_id[cur_mode.permaflow];
                     flow.bits.temp_flow_timer = 0;
                 }
-                seen_blocks.insert(block);
-                iter++;
             }
-            set <Block *>::iterator biter = seen_blocks.begin();
-            while (biter != seen_blocks.end())
+            if (!seen)
+                return;
+            switch (cur_mode.flowmode)
             {
-                switch (cur_mode.flowmode)
+            case M_INC:
+                if (!dry_run)
+                    block->enableBlockUpdates(true);
+                break;
+            case M_DEC:
+                if (raw_block && !dry_run)
                 {
-                case M_INC:
-                    (*biter)->enableBlockUpdates(true);
-                    break;
-                case M_DEC:
-                    if (auto block = (*biter)->getRaw())
-                    {
-                        block->flags.bits.update_liquid = false;
-                        block->flags.bits.update_liquid_twice = false;
-                    }
-                    break;
-                case M_KEEP:
-                    {
-                        auto bflags = (*biter)->BlockFlags();
-                        out << "flow bit 1 = " << bflags.bits.update_liquid << endl;
-                        out << "flow bit 2 = " << bflags.bits.update_liquid_twice << endl;
-                    }
+                    raw_block->flags.bits.update_liquid = false;
+                    raw_block->flags.bits.update_liquid_twice = false;
+                }
+                break;
+            case M_KEEP:
+                {
+                    auto bflags = block->BlockFlags();
+                    out << "flow bit 1 = " << bflags.bits.update_liquid << endl;
+                    out << "flow bit 2 = " << bflags.bits.update_liquid_twice << endl;
                 }
-                biter ++;
             }
-            break;
-        }
+        }, &num_tiles);
+        break;
+    }
+
+    if (painted)
+        *painted = matched;
+
+    if (dry_run)
+    {
+        out << "Would paint " << matched << " of " << num_tiles << " tiles." << endl;
+        return CR_OK;
     }
 
     if(!mcache.WriteAll())
@@ -641,7 +646,7 @@ static int paint(lua_State *L)
     df::coord pos;
     OperationMode mode;
 
-    lua_settop(L, 8);
+    lua_settop(L, 9);
     Lua::CheckDFAssign(L, &pos, 1);
     if (!pos.isValid())
         luaL_argerror(L, 1, "invalid cursor position");
@@ -655,9 +660,12 @@ static int paint(lua_State *L)
     mode.setmode = (ModifyMode)luaL_checkoption(L, 6, ".", modify_mode_name);
     mode.flowmode = (ModifyMode)luaL_checkoption(L, 7, "+", modify_mode_name);
     mode.permaflow = (PermaflowMode)luaL_checkoption(L, 8, ".", permaflow_name);
+    bool dry_run = lua_toboolean(L, 9);
 
-    lua_pushboolean(L, df_liquids_execute(*Lua::GetOutput(L), mode, pos));
-    return 1;
+    size_t painted = 0;
+    lua_pushboolean(L, df_liquids_execute(*Lua::GetOutput(L), mode, pos, dry_run, &painted));
+    lua_pushinteger(L, painted);
+    return 2;
 }
 
 DFHACK_PLUGIN_LUA_COMMANDS {
@@ -4,7 +4,9 @@ local _ENV = mkmodule('plugins.liquids')
 
  Native functions:
 
- * paint(pos,brush,paint,amount,size,setmode,flowmode)
+ * paint(pos,brush,paint,amount,size,setmode,flowmode,permaflow,dry_run)
+   Returns the command status and the number of tiles painted (or that
+   would be painted if dry_run is true).
 
 --]]
 
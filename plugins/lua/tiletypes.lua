@@ -3,6 +3,18 @@ local _ENV = mkmodule('plugins.tiletypes')
 local argparse = require('argparse')
 local utils = require('utils')
 
+--[[
+
+ Native functions:
+
+ * tiletypes_paint(pos,dry_run) -> number of tiles painted (or that would be painted)
+
+--]]
+
+function paint(pos, dry_run)
+    return tiletypes_paint(pos, dry_run)
+end
+
 local function parse_cursor(opts, arg)
     utils.assign(opts.cursor, argparse.coords(arg))
 end
@@ -12,6 +24,7 @@ function parse_commandline(opts, ...)
             {'c', 'cursor', hasArg=true,
              handler=function(arg) parse_cursor(opts, arg) end},
             {'h', 'help', handler=function() opts.help = true end},
+            {'n', 'dry-run', handler=function() opts.dry_run = true end},
             {'q', 'quiet', handler=function() opts.quiet = true end},
         })
 
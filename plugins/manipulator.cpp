@@ -298,7 +298,12 @@ struct UnitInfo
     string squad_info;
     string job_desc;
     enum { IDLE, SOCIAL, JOB } job_mode;
+    df::goal_type goal_type;
+    int stress;
     bool selected;
+    // Skill matrix row, refreshed together with the names
+    int64_t skill_key[NUM_COLUMNS]; // rating and experience, for sorting
+    uint8_t skill_char[NUM_COLUMNS]; // level glyph shown in the grid
     struct {
         // Used for custom professions, 1-indexed
         int list_id;        // Position in list
@@ -335,8 +340,7 @@ string itos (int n)
 }
 
 bool descending;
-df::job_skill sort_skill;
-df::unit_labor sort_labor;
+size_t sort_column;
 
 bool sortByName (const UnitInfo *d1, const UnitInfo *d2)
 {
@@ -356,33 +360,33 @@ bool sortByProfession (const UnitInfo *d1, const UnitInfo *d2)
 
 bool sortByGoal (const UnitInfo *d1, const UnitInfo *d2)
 {
+    if (!d1->unit->status.current_soul && !d2->unit->status.current_soul)
+        return false;
     if (!d1->unit->status.current_soul)
         return !descending;
     if (!d2->unit->status.current_soul)
         return descending;
 
-    df::goal_type goal1 = Units::getGoalType(d1->unit);
-    df::goal_type goal2 = Units::getGoalType(d2->unit);
     if (descending)
-        return (goal1 > goal2);
+        return (d1->goal_type > d2->goal_type);
     else
-        return (goal1 < goal2);
+        return (d1->goal_type < d2->goal_type);
 }
 
 bool sortBySquad (const UnitInfo *d1, const UnitInfo *d2)
 {
-    bool gt = false;
+    int cmp;
     if (d1->unit->military.squad_id == -1 && d2->unit->military.squad_id == -1)
-        gt = d1->name > d2->name;
+        cmp = d1->name.compare(d2->name);
     else if (d1->unit->military.squad_id == -1)
-        gt = true;
+        cmp = 1;
     else if (d2->unit->military.squad_id == -1)
-        gt = false;
+        cmp = -1;
     else if (d1->unit->military.squad_id != d2->unit->military.squad_id)
-        gt = d1->squad_effective_name > d2->squad_effective_name;
+        cmp = d1->squad_effective_name.compare(d2->squad_effective_name);
     else
-        gt = d1->unit->military.squad_position > d2->unit->military.squad_position;
-    return descending ? gt : !gt;
+        cmp = d1->unit->military.squad_position - d2->unit->military.squad_position;
+    return descending ? (cmp > 0) : (cmp < 0);
 }
 
 bool sortByJob (const UnitInfo *d1, const UnitInfo *d2)
@@ -403,15 +407,17 @@ bool sortByJob (const UnitInfo *d1, const UnitInfo *d2)
 
 bool sortByStress (const UnitInfo *d1, const UnitInfo *d2)
 {
+    if (!d1->unit->status.current_soul && !d2->unit->status.current_soul)
+        return false;
     if (!d1->unit->status.current_soul)
         return !descending;
     if (!d2->unit->status.current_soul)
         return descending;
 
     if (descending)
-        return (d1->unit->status.current_soul->personality.stress_level > d2->unit->status.current_soul->personality.stress_level);
+        return (d1->stress > d2->stress);
     else
-        return (d1->unit->status.current_soul->personality.stress_level < d2->unit->status.current_soul->personality.stress_level);
+        return (d1->stress < d2->stress);
 }
 
 bool sortByArrival (const UnitInfo *d1, const UnitInfo *d2)
@@ -424,39 +430,19 @@ bool sortByArrival (const UnitInfo *d1, const UnitInfo *d2)
 
 bool sortBySkill (const UnitInfo *d1, const UnitInfo *d2)
 {
-    if (sort_skill != job_skill::NONE)
-    {
-        if (!d1->unit->status.current_soul)
-            return !descending;
-        if (!d2->unit->status.current_soul)
-            return descending;
-        df::unit_skill *s1 = binsearch_in_vector<df::unit_skill,df::job_skill>(d1->unit->status.current_soul->skills, &df::unit_skill::id, sort_skill);
-        df::unit_skill *s2 = binsearch_in_vector<df::unit_skill,df::job_skill>(d2->unit->status.current_soul->skills, &df::unit_skill::id, sort_skill);
-        int l1 = s1 ? s1->rating : 0;
-        int l2 = s2 ? s2->rating : 0;
-        int e1 = s1 ? s1->experience : 0;
-        int e2 = s2 ? s2->experience : 0;
-        if (descending)
-        {
-            if (l1 != l2)
-                return l1 > l2;
-            if (e1 != e2)
-                return e1 > e2;
-        }
-        else
-        {
-            if (l1 != l2)
-                return l1 < l2;
-            if (e1 != e2)
-                return e1 < e2;
-        }
-    }
-    if (sort_labor != unit_labor::NONE)
+    // Units without a soul have a key of -1 and sort below everyone
+    int64_t k1 = d1->skill_key[sort_column];
+    int64_t k2 = d2->skill_key[sort_column];
+    if (k1 != k2)
+        return descending ? (k1 > k2) : (k1 < k2);
+
+    df::unit_labor labor = columns[sort_column].labor;
+    if (labor != unit_labor::NONE)
     {
         if (descending)
-            return d1->unit->status.labors[sort_labor] > d2->unit->status.labors[sort_labor];
+            return d1->unit->status.labors[labor] > d2->unit->status.labors[labor];
         else
-            return d1->unit->status.labors[sort_labor] < d2->unit->status.labors[sort_labor];
+            return d1->unit->status.labors[labor] < d2->unit->status.labors[labor];
     }
     return false;
 }
@@ -466,6 +452,51 @@ bool sortBySelected (const UnitInfo *d1, const UnitInfo *d2)
     return descending ? (d1->selected > d2->selected) : (d1->selected < d2->selected);
 }
 
+static void refreshSkills (UnitInfo *cur)
+{
+    // columns that show each skill, built once
+    static vector<vector<size_t>> skill_columns;
+    if (skill_columns.empty())
+    {
+        skill_columns.resize(ENUM_LAST_ITEM(job_skill) + 1);
+        for (size_t col = 0; col < NUM_COLUMNS; col++)
+        {
+            if (columns[col].skill != job_skill::NONE)
+                skill_columns[columns[col].skill].push_back(col);
+        }
+    }
+
+    auto soul = cur->unit->status.current_soul;
+    for (size_t col = 0; col < NUM_COLUMNS; col++)
+    {
+        bool has_skill = columns[col].skill != job_skill::NONE;
+        cur->skill_key[col] = (has_skill && !soul) ? -1 : 0;
+        cur->skill_char[col] = has_skill ? '-' : 0xFA;
+    }
+    if (!soul)
+        return;
+
+    for (auto skill : soul->skills)
+    {
+        if (size_t(skill->id) >= skill_columns.size())
+            continue;
+        int64_t key = (int64_t(skill->rating) << 32) | uint32_t(skill->experience);
+        uint8_t c = '-';
+        if (skill->rating || skill->experience)
+        {
+            size_t level = skill->rating;
+            if (level > NUM_SKILL_LEVELS - 1)
+                level = NUM_SKILL_LEVELS - 1;
+            c = skill_levels[level].abbrev;
+        }
+        for (size_t col : skill_columns[skill->id])
+        {
+            cur->skill_key[col] = key;
+            cur->skill_char[col] = c;
+        }
+    }
+}
+
 template<typename T>
 class StringFormatter {
 public:
@@ -1136,6 +1167,11 @@ protected:
     vector<UnitInfo *> units;
     altsort_mode altsort;
 
+    // last sort applied, repeated when the names are refreshed
+    bool (*cur_sort)(const UnitInfo *, const UnitInfo *);
+    bool cur_sort_descending;
+    size_t cur_sort_column;
+
     bool do_refresh_names;
     int detail_mode;
     int first_row, sel_row, num_rows;
@@ -1148,6 +1184,8 @@ protected:
     void refreshNames();
     void calcIDs();
     void calcSize ();
+    void sortUnits(bool (*sort_fn)(const UnitInfo *, const UnitInfo *));
+    void resortUnits();
 };
 
 viewscreen_unitlaborsst::viewscreen_unitlaborsst(vector<df::unit*> &src, int cursor_pos)
@@ -1200,6 +1238,7 @@ viewscreen_unitlaborsst::viewscreen_unitlaborsst(vector<df::unit*> &src, int cur
     altsort = ALTSORT_NAME;
     detail_mode = DETAIL_MODE_PROFESSION;
     first_column = sel_column = 0;
+    cur_sort = NULL;
 
     refreshNames();
     calcIDs();
@@ -1262,6 +1301,7 @@ void viewscreen_unitlaborsst::refreshNames()
         cur->profession = Units::getProfessionName(unit);
         cur->goal = Units::getGoalName(unit);
         df::goal_type goal = Units::getGoalType(unit);
+        cur->goal_type = goal;
         if (goal == df::goal_type::START_A_FAMILY) {
             cur->goal_gender = unit->sex;
         } else {
@@ -1290,10 +1330,54 @@ void viewscreen_unitlaborsst::refreshNames()
             cur->squad_effective_name = "";
             cur->squad_info = "";
         }
+        cur->stress = unit->status.current_soul ? unit->status.current_soul->personality.stress_level : 0;
+        refreshSkills(cur);
     }
+    resortUnits();
     calcSize();
 }
 
+void viewscreen_unitlaborsst::sortUnits(bool (*sort_fn)(const UnitInfo *, const UnitInfo *))
+{
+    cur_sort = sort_fn;
+    cur_sort_descending = descending;
+    cur_sort_column = sort_column;
+    std::stable_sort(units.begin(), units.end(), sort_fn);
+    calcIDs();
+}
+
+void viewscreen_unitlaborsst::resortUnits()
+{
+    if (!cur_sort || units.empty())
+        return;
+
+    descending = cur_sort_descending;
+    sort_column = cur_sort_column;
+    if (std::is_sorted(units.begin(), units.end(), cur_sort))
+        return;
+
+    // Only a few keys change between refreshes, so an insertion sort
+    // is close to linear here, and it keeps equal units in place.
+    UnitInfo *sel = vector_get(units, sel_row);
+    for (size_t i = 1; i < units.size(); i++)
+    {
+        UnitInfo *cur = units[i];
+        size_t j = i;
+        for (; j > 0 && cur_sort(cur, units[j - 1]); j--)
+            units[j] = units[j - 1];
+        units[j] = cur;
+    }
+
+    // keep the cursor on the same unit
+    if (sel)
+        sel_row = std::find(units.begin(), units.end(), sel) - units.begin();
+    if (sel_row < first_row)
+        first_row = sel_row;
+    if (first_row < sel_row - num_rows + 1)
+        first_row = sel_row - num_rows + 1;
+    calcIDs();
+}
+
 void viewscreen_unitlaborsst::calcSize()
 {
     auto dim = Screen::getWindowSize();
@@ -1747,10 +1831,8 @@ void viewscreen_unitlaborsst::feed(set<df::interface_key> *events)
     if (events->count(interface_key::SECONDSCROLL_UP) || events->count(interface_key::SECONDSCROLL_DOWN))
     {
         descending = events->count(interface_key::SECONDSCROLL_UP);
-        sort_skill = columns[input_column].skill;
-        sort_labor = columns[input_column].labor;
-        std::stable_sort(units.begin(), units.end(), sortBySkill);
-        calcIDs();
+        sort_column = input_column;
+        sortUnits(sortBySkill);
     }
 
     if (events->count(interface_key::SECONDSCROLL_PAGEUP) || events->count(interface_key::SECONDSCROLL_PAGEDOWN))
@@ -1759,30 +1841,29 @@ void viewscreen_unitlaborsst::feed(set<df::interface_key> *events)
         switch (input_sort)
         {
         case ALTSORT_NAME:
-            std::stable_sort(units.begin(), units.end(), sortByName);
+            sortUnits(sortByName);
             break;
         case ALTSORT_SELECTED:
-            std::stable_sort(units.begin(), units.end(), sortBySelected);
+            sortUnits(sortBySelected);
             break;
         case ALTSORT_DETAIL:
             if (detail_mode == DETAIL_MODE_SQUAD) {
-                std::stable_sort(units.begin(), units.end(), sortBySquad);
+                sortUnits(sortBySquad);
             } else if (detail_mode == DETAIL_MODE_JOB) {
-                std::stable_sort(units.begin(), units.end(), sortByJob);
+                sortUnits(sortByJob);
             } else if (detail_mode == DETAIL_MODE_PROFESSION) {
-                std::stable_sort(units.begin(), units.end(), sortByProfession);
+                sortUnits(sortByProfession);
             } else {
-                std::stable_sort(units.begin(), units.end(), sortByGoal);
+                sortUnits(sortByGoal);
             }
             break;
         case ALTSORT_STRESS:
-            std::stable_sort(units.begin(), units.end(), sortByStress);
+            sortUnits(sortByStress);
             break;
         case ALTSORT_ARRIVAL:
-            std::stable_sort(units.begin(), units.end(), sortByArrival);
+            sortUnits(sortByArrival);
             break;
         }
-        calcIDs();
     }
     if (events->count(interface_key::CHANGETAB))
     {
@@ -1933,6 +2014,7 @@ void viewscreen_unitlaborsst::render()
     }
     Screen::paintString(Screen::Pen(' ', 7, 0), col_offsets[DISP_COLUMN_DETAIL], 2, detail_str);
 
+    df::creature_raw *race = (ui->race_id != -1) ? vector_get(world->raws.creatures.all, ui->race_id) : NULL;
     for (int col = 0; col < col_widths[DISP_COLUMN_LABORS]; col++)
     {
         int col_offset = col + first_column;
@@ -1951,9 +2033,9 @@ void viewscreen_unitlaborsst::render()
         Screen::paintTile(Screen::Pen(columns[col_offset].label[0], fg, bg), col_offsets[DISP_COLUMN_LABORS] + col, 1);
         Screen::paintTile(Screen::Pen(columns[col_offset].label[1], fg, bg), col_offsets[DISP_COLUMN_LABORS] + col, 2);
         df::profession profession = columns[col_offset].profession;
-        if ((profession != profession::NONE) && (ui->race_id != -1))
+        if ((profession != profession::NONE) && race)
         {
-            auto graphics = world->raws.creatures.all[ui->race_id]->graphics;
+            auto &graphics = race->graphics;
             Screen::paintTile(
                 Screen::Pen(' ', fg, 0,
                     graphics.profession_add_color[creature_graphics_role::DEFAULT][profession],
@@ -1972,8 +2054,8 @@ void viewscreen_unitlaborsst::render()
         df::unit *unit = cur->unit;
         int8_t fg = 15, bg = 0;
 
-        int stress_lvl = unit->status.current_soul ? unit->status.current_soul->personality.stress_level : 0;
-        const vector<UIColor> stress_colors {
+        int stress_lvl = cur->stress;
+        static const vector<UIColor> stress_colors {
             13, // 5:1
             12, // 4:1
             14, // 6:1
@@ -2048,30 +2130,17 @@ void viewscreen_unitlaborsst::render()
         detail_str.resize(col_widths[DISP_COLUMN_DETAIL]);
         Screen::paintString(Screen::Pen(' ', fg, bg), col_offsets[DISP_COLUMN_DETAIL], 4 + row, detail_str);
 
-        // Print unit's skills and labor assignments
+        // Print unit's skills and labor assignments, for visible columns only
         for (int col = 0; col < col_widths[DISP_COLUMN_LABORS]; col++)
         {
             int col_offset = col + first_column;
+            if (size_t(col_offset) >= NUM_COLUMNS)
+                break;
             fg = 15;
             bg = 0;
-            uint8_t c = 0xFA;
+            uint8_t c = cur->skill_char[col_offset];
             if ((col_offset == sel_column) && (row_offset == sel_row))
                 fg = 9;
-            if (columns[col_offset].skill != job_skill::NONE)
-            {
-                df::unit_skill *skill = NULL;
-                if (unit->status.current_soul)
-                    skill = binsearch_in_vector<df::unit_skill,df::job_skill>(unit->status.current_soul->skills, &df::unit_skill::id, columns[col_offset].skill);
-                if ((skill != NULL) && (skill->rating || skill->experience))
-                {
-                    size_t level = skill->rating;
-                    if (level > NUM_SKILL_LEVELS - 1)
-                        level = NUM_SKILL_LEVELS - 1;
-                    c = skill_levels[level].abbrev;
-                }
-                else
-                    c = '-';
-            }
             if (columns[col_offset].labor != unit_labor::NONE)
             {
                 if (unit->status.labors[columns[col_offset].labor])
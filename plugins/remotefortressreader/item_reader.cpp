@@ -53,6 +53,7 @@
 #include "modules/Materials.h"
 #include "MiscUtils.h"
 
+#include <unordered_map>
 
 using namespace DFHack;
 using namespace df::enums;
@@ -62,6 +63,38 @@ using namespace std;
 using namespace df::global;
 
 
+// Art image chunks by id, for when the game's own lookup function is unknown.
+// Chunks are only loaded, not freed, while a world is loaded, so the index
+// is rebuilt whenever the size of the vector changes.
+static std::unordered_map<int32_t, df::art_image_chunk *> art_image_chunk_index;
+static size_t art_image_chunk_count = 0;
+
+void ClearArtImageChunks()
+{
+    art_image_chunk_index.clear();
+    art_image_chunk_count = 0;
+}
+
+df::art_image_chunk * FindArtImageChunk(int32_t id)
+{
+    static GET_ART_IMAGE_CHUNK GetArtImageChunk = reinterpret_cast<GET_ART_IMAGE_CHUNK>(Core::getInstance().vinfo->getAddress("get_art_image_chunk"));
+    if (GetArtImageChunk)
+        return GetArtImageChunk(&(world->art_image_chunks), id);
+
+    auto &chunks = world->art_image_chunks;
+    if (chunks.size() != art_image_chunk_count)
+    {
+        art_image_chunk_index.clear();
+        for (size_t i = 0; i < chunks.size(); i++)
+            art_image_chunk_index[chunks[i]->id] = chunks[i];
+        art_image_chunk_count = chunks.size();
+    }
+    auto it = art_image_chunk_index.find(id);
+    if (it == art_image_chunk_index.end())
+        return NULL;
+    return it->second;
+}
+
 void CopyImage(const df::art_image * image, ArtImage * netImage)
 {
     auto id = netImage->mutable_id();
@@ -234,20 +267,7 @@ void CopyItem(RemoteFortressReader::Item * NetItem, df::item * DfItem)
     {
         VIRTUAL_CAST_VAR(statue, df::item_statuest, DfItem);
 
-        df::art_image_chunk * chunk = NULL;
-        GET_ART_IMAGE_CHUNK GetArtImageChunk = reinterpret_cast<GET_ART_IMAGE_CHUNK>(Core::getInstance().vinfo->getAddress("get_art_image_chunk"));
-        if (GetArtImageChunk)
-        {
-            chunk = GetArtImageChunk(&(world->art_image_chunks), statue->image.id);
-        }
-        else
-        {
-            for (size_t i = 0; i < world->art_image_chunks.size(); i++)
-            {
-                if (world->art_image_chunks[i]->id == statue->image.id)
-                    chunk = world->art_image_chunks[i];
-            }
-        }
+        df::art_image_chunk * chunk = FindArtImageChunk(statue->image.id);
         if (chunk)
         {
             CopyImage(chunk->images[statue->image.subid], NetItem->mutable_image());
@@ -28,5 +28,7 @@ void ConvertDFColorDescriptor(int16_t index, RemoteFortressReader::ColorDefiniti
 typedef df::art_image_chunk * (*GET_ART_IMAGE_CHUNK)(std::vector<df::art_image_chunk* > *, int);
 
 void CopyImage(const df::art_image * image, RemoteFortressReader::ArtImage * netImage);
+df::art_image_chunk * FindArtImageChunk(int32_t id);
+void ClearArtImageChunks();
 
 #endif // !ITEM_READER_H
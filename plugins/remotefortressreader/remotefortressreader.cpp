@@ -1,7 +1,11 @@
 #include "df_version_int.h"
 #define RFR_VERSION "0.21.0"
 
+#include <algorithm>
 #include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
 #include <time.h>
 #include <vector>
 
@@ -122,6 +126,7 @@
 #include "building_reader.h"
 #include "dwarf_control.h"
 #include "item_reader.h"
+#include "world_snapshot.h"
 
 using namespace DFHack;
 using namespace df::enums;
@@ -151,6 +156,7 @@ static command_result GetPlantList(color_ostream &stream, const BlockRequest *in
 static command_result CheckHashes(color_ostream &stream, const EmptyMessage *in);
 static command_result GetUnitList(color_ostream &stream, const EmptyMessage *in, UnitList *out);
 static command_result GetUnitListInside(color_ostream &stream, const BlockRequest *in, UnitList *out);
+static command_result GetUnitStream(color_ostream &stream, const UnitStreamRequest *in, UnitStreamReply *out);
 static command_result GetViewInfo(color_ostream &stream, const EmptyMessage *in, ViewInfo *out);
 static command_result GetMapInfo(color_ostream &stream, const EmptyMessage *in, MapInfo *out);
 static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in);
@@ -164,12 +170,17 @@ static command_result GetPartialCreatureRaws(color_ostream &stream, const ListRe
 static command_result GetPlantRaws(color_ostream &stream, const EmptyMessage *in, PlantRawList *out);
 static command_result GetPartialPlantRaws(color_ostream &stream, const ListRequest *in, PlantRawList *out);
 static command_result CopyScreen(color_ostream &stream, const EmptyMessage *in, ScreenCapture *out);
+static command_result GetScreenDiff(color_ostream &stream, const ScreenDiffRequest *in, ScreenDiff *out);
 static command_result PassKeyboardEvent(color_ostream &stream, const KeyboardEvent *in);
 static command_result GetPauseState(color_ostream & stream, const EmptyMessage * in, SingleBool * out);
 static command_result GetVersionInfo(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::VersionInfo * out);
 static command_result GetReports(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Status * out);
 static command_result GetLanguage(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Language * out);
 static command_result GetGameValidity(color_ostream &stream, const EmptyMessage * in, SingleBool *out);
+static command_result GetCachedCatalog(color_ostream &stream, const CatalogRequest *in, CatalogReply *out);
+static void ClearCatalogs();
+static void ClearUnitStreams();
+static void ClearEngravingIndex();
 
 void CopyBlock(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBlock, MapExtras::MapCache * MC, DFCoord pos);
 
@@ -227,6 +238,18 @@ DFhackCExport command_result plugin_init(color_ostream &out, std::vector <Plugin
         "Gets an art image chunk by index, loading from disk if necessary",
         loadArtImageChunk, false,
         "Usage: load_art_image_chunk N, where N is the id of the chunk to get."));
+    commands.push_back(PluginCommand(
+        "remote-snapshot",
+        "Periodically copy parts of the world for RPC readers",
+        RemoteSnapshotCommand, false,
+        "Usage:\n"
+        "  remote-snapshot\n"
+        "    Show the snapshot settings and the size of the last snapshot.\n"
+        "  remote-snapshot TICKS [blocks] [units] [buildings] [reports]\n"
+        "    Take a snapshot every TICKS game ticks, with the given parts\n"
+        "    (all of them if none are given).\n"
+        "  remote-snapshot off\n"
+        "    Stop taking snapshots.\n"));
     enableUpdates = true;
     return CR_OK;
 }
@@ -246,6 +269,7 @@ DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
     svc->addFunction("GetPlantList", GetPlantList, SF_ALLOW_REMOTE);
     svc->addFunction("GetUnitList", GetUnitList, SF_ALLOW_REMOTE);
     svc->addFunction("GetUnitListInside", GetUnitListInside, SF_ALLOW_REMOTE);
+    svc->addFunction("GetUnitStream", GetUnitStream, SF_ALLOW_REMOTE);
     svc->addFunction("GetViewInfo", GetViewInfo, SF_ALLOW_REMOTE);
     svc->addFunction("GetMapInfo", GetMapInfo, SF_ALLOW_REMOTE);
     svc->addFunction("ResetMapHashes", ResetMapHashes, SF_ALLOW_REMOTE);
@@ -261,6 +285,7 @@ DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
     svc->addFunction("GetPlantRaws", GetPlantRaws, SF_ALLOW_REMOTE);
     svc->addFunction("GetPartialPlantRaws", GetPartialPlantRaws, SF_ALLOW_REMOTE);
     svc->addFunction("CopyScreen", CopyScreen, SF_ALLOW_REMOTE);
+    svc->addFunction("GetScreenDiff", GetScreenDiff, SF_ALLOW_REMOTE);
     svc->addFunction("PassKeyboardEvent", PassKeyboardEvent, SF_ALLOW_REMOTE);
     svc->addFunction("SendDigCommand", SendDigCommand, SF_ALLOW_REMOTE);
     svc->addFunction("SetPauseState", SetPauseState, SF_ALLOW_REMOTE);
@@ -276,6 +301,8 @@ DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
     svc->addFunction("GetSideMenu", GetSideMenu, SF_ALLOW_REMOTE);
     svc->addFunction("SetSideMenu", SetSideMenu, SF_ALLOW_REMOTE);
     svc->addFunction("GetGameValidity", GetGameValidity, SF_ALLOW_REMOTE);
+    svc->addFunction("GetCachedCatalog", GetCachedCatalog, SF_ALLOW_REMOTE | SF_DONT_SUSPEND);
+    svc->addFunction("GetWorldSnapshot", GetWorldSnapshot, SF_ALLOW_REMOTE | SF_DONT_SUSPEND);
     return svc;
 }
 
@@ -293,6 +320,20 @@ DFhackCExport command_result plugin_onupdate(color_ostream &out)
     if (!enableUpdates)
         return CR_OK;
     KeyUpdate();
+    UpdateWorldSnapshot();
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_change_event event)
+{
+    if (event == SC_WORLD_LOADED || event == SC_WORLD_UNLOADED)
+    {
+        ClearCatalogs();
+        ClearUnitStreams();
+        ClearWorldSnapshot();
+        ClearEngravingIndex();
+        ClearArtImageChunks();
+    }
     return CR_OK;
 }
 
@@ -761,19 +802,88 @@ bool areItemsChanged(vector<int> * items)
     return result;
 }
 
-map<int, int> engravingHashes;
+// Engravings that were already sent, with the art they were sent with.
+map<df::engraving *, int32_t> engravingHashes;
 
-bool isEngravingNew(int index)
+bool isEngravingNew(df::engraving * engraving)
 {
-    if (engravingHashes[index])
+    auto it = engravingHashes.find(engraving);
+    if (it != engravingHashes.end() && it->second == engraving->art_id)
         return false;
-    engravingHashes[index] = true;
+    engravingHashes[engraving] = engraving->art_id;
     return true;
 }
 
-void engravingIsNotNew(int index)
+void engravingIsNotNew(df::engraving * engraving)
+{
+    engravingHashes.erase(engraving);
+}
+
+// Engravings by the map block they are in. The index is rebuilt when
+// world->engravings no longer matches the copy it was built from. Each
+// call only compares the size, both ends and a rolling slice of the
+// vector, so a change in the middle is noticed within a few calls. The
+// positions are compared too, since a freed engraving's address can be
+// reused by a new one in the same slot.
+map<DFCoord, vector<df::engraving *> > engravingBlocks;
+vector<std::pair<df::engraving *, DFCoord> > indexedEngravings;
+size_t engravingCheckPos = 0;
+static const size_t ENGRAVING_CHECK_SLICE = 256;
+
+static void ClearEngravingIndex()
+{
+    engravingBlocks.clear();
+    indexedEngravings.clear();
+    engravingHashes.clear();
+    engravingCheckPos = 0;
+}
+
+static bool isEngravingIndexCurrent()
 {
-    engravingHashes[index] = false;
+    auto &engravings = world->engravings;
+    size_t count = engravings.size();
+    if (count != indexedEngravings.size())
+        return false;
+    if (count == 0)
+        return true;
+    if (engravings.front() != indexedEngravings.front().first ||
+        engravings.back() != indexedEngravings.back().first)
+        return false;
+    for (size_t n = std::min(count, ENGRAVING_CHECK_SLICE); n > 0; n--)
+    {
+        if (engravingCheckPos >= count)
+            engravingCheckPos = 0;
+        size_t i = engravingCheckPos++;
+        if (engravings[i] != indexedEngravings[i].first || engravings[i]->pos != indexedEngravings[i].second)
+            return false;
+    }
+    return true;
+}
+
+static void UpdateEngravingIndex()
+{
+    if (isEngravingIndexCurrent())
+        return;
+
+    auto &engravings = world->engravings;
+    engravingBlocks.clear();
+    indexedEngravings.clear();
+    for (auto engraving : engravings)
+    {
+        engravingBlocks[DFCoord(engraving->pos.x / 16, engraving->pos.y / 16, engraving->pos.z)].push_back(engraving);
+        indexedEngravings.push_back(std::make_pair(engraving, engraving->pos));
+    }
+
+    // Forget the ones that are gone, so a new engraving that
+    // gets the same address is sent again.
+    std::set<df::engraving *> current(engravings.begin(), engravings.end());
+    for (auto it = engravingHashes.begin(); it != engravingHashes.end();)
+    {
+        if (current.count(it->first))
+            ++it;
+        else
+            it = engravingHashes.erase(it);
+    }
 }
 
 static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in)
@@ -797,7 +907,7 @@ df::matter_state GetState(df::material * mat, uint16_t temp = 10015)
     return state;
 }
 
-static command_result GetMaterialList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
+static command_result BuildMaterialList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
 {
     if (!Core::getInstance().isWorldLoaded()) {
         //out->set_available(false);
@@ -903,7 +1013,7 @@ static command_result GetMaterialList(color_ostream &stream, const EmptyMessage
     return CR_OK;
 }
 
-static command_result GetGrowthList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
+static command_result BuildGrowthList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
 {
     if (!Core::getInstance().isWorldLoaded()) {
         //out->set_available(false);
@@ -1517,35 +1627,31 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
         }
     }
 
-    for (size_t i = 0; i < world->engravings.size(); i++)
+    UpdateEngravingIndex();
+    vector<df::engraving *> engravings;
+    for (int block_x = min_x; block_x <= max_x; block_x++)
+        for (int block_y = min_y; block_y <= max_y; block_y++)
+        {
+            auto it = engravingBlocks.lower_bound(DFCoord(block_x, block_y, min_z));
+            for (; it != engravingBlocks.end() && it->first.x == block_x && it->first.y == block_y && it->first.z <= max_z; ++it)
+                engravings.insert(engravings.end(), it->second.begin(), it->second.end());
+        }
+
+    for (auto engraving : engravings)
     {
-        auto engraving = world->engravings[i];
         if (engraving->pos.x < (min_x * 16) || engraving->pos.x >(max_x * 16))
             continue;
         if (engraving->pos.y < (min_y * 16) || engraving->pos.y >(max_y * 16))
             continue;
         if (engraving->pos.z < min_z || engraving->pos.z > max_z)
             continue;
-        if (!isEngravingNew(i))
+        if (!isEngravingNew(engraving))
             continue;
 
-        df::art_image_chunk * chunk = NULL;
-        GET_ART_IMAGE_CHUNK GetArtImageChunk = reinterpret_cast<GET_ART_IMAGE_CHUNK>(Core::getInstance().vinfo->getAddress("get_art_image_chunk"));
-        if (GetArtImageChunk)
-        {
-            chunk = GetArtImageChunk(&(world->art_image_chunks), engraving->art_id);
-        }
-        else
-        {
-            for (size_t i = 0; i < world->art_image_chunks.size(); i++)
-            {
-                if (world->art_image_chunks[i]->id == engraving->art_id)
-                    chunk = world->art_image_chunks[i];
-            }
-        }
+        df::art_image_chunk * chunk = FindArtImageChunk(engraving->art_id);
         if (!chunk)
         {
-            engravingIsNotNew(i);
+            engravingIsNotNew(engraving);
             continue;
         }
         auto netEngraving = out->add_engravings();
@@ -1575,7 +1681,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
     return CR_OK;
 }
 
-static command_result GetTiletypeList(color_ostream &stream, const EmptyMessage *in, TiletypeList *out)
+static command_result BuildTiletypeList(color_ostream &stream, const EmptyMessage *in, TiletypeList *out)
 {
     int count = 0;
     FOR_ENUM_ITEMS(tiletype, tt)
@@ -1669,6 +1775,184 @@ void GetWounds(df::unit_wound * wound, UnitWound * send_wound)
     send_wound->set_severed_part(wound->flags.bits.severed_part);
 }
 
+static bool IsUnitInside(df::unit * unit, const BlockRequest *in)
+{
+    if (unit->pos.z < in->min_z() || unit->pos.z >= in->max_z())
+        return false;
+    if (unit->pos.x < in->min_x() * 16 || unit->pos.x >= in->max_x() * 16)
+        return false;
+    if (unit->pos.y < in->min_y() * 16 || unit->pos.y >= in->max_y() * 16)
+        return false;
+    return true;
+}
+
+static void CopyUnitAppearance(df::unit * unit, UnitDefinition * send_unit)
+{
+    send_unit->mutable_race()->set_mat_type(unit->race);
+    send_unit->mutable_race()->set_mat_index(unit->caste);
+
+    using df::global::cur_year;
+    using df::global::cur_year_tick;
+
+    send_unit->set_age(Units::getAge(unit, false));
+
+    ConvertDfColor(Units::getProfessionColor(unit), send_unit->mutable_profession_color());
+    send_unit->set_flags1(unit->flags1.whole);
+    send_unit->set_flags2(unit->flags2.whole);
+    send_unit->set_flags3(unit->flags3.whole);
+    send_unit->set_is_soldier(ENUM_ATTR(profession, military, unit->profession));
+    auto size_info = send_unit->mutable_size_info();
+    size_info->set_size_cur(unit->body.size_info.size_cur);
+    size_info->set_size_base(unit->body.size_info.size_base);
+    size_info->set_area_cur(unit->body.size_info.area_cur);
+    size_info->set_area_base(unit->body.size_info.area_base);
+    size_info->set_length_cur(unit->body.size_info.length_cur);
+    size_info->set_length_base(unit->body.size_info.length_base);
+    if (unit->name.has_name)
+    {
+        send_unit->set_name(DF2UTF(Translation::TranslateName(Units::getVisibleName(unit))));
+    }
+
+    auto appearance = send_unit->mutable_appearance();
+    for (size_t j = 0; j < unit->appearance.body_modifiers.size(); j++)
+        appearance->add_body_modifiers(unit->appearance.body_modifiers[j]);
+    for (size_t j = 0; j < unit->appearance.bp_modifiers.size(); j++)
+        appearance->add_bp_modifiers(unit->appearance.bp_modifiers[j]);
+    for (size_t j = 0; j < unit->appearance.colors.size(); j++)
+        appearance->add_colors(unit->appearance.colors[j]);
+    appearance->set_size_modifier(unit->appearance.size_modifier);
+
+    appearance->set_physical_description(Units::getPhysicalDescription(unit));
+
+    send_unit->set_profession_id(unit->profession);
+
+    std::vector<Units::NoblePosition> pvec;
+
+    if (Units::getNoblePositions(&pvec, unit))
+    {
+        for (size_t j = 0; j < pvec.size(); j++)
+        {
+            auto noble_positon = pvec[j];
+            send_unit->add_noble_positions(noble_positon.position->code);
+        }
+    }
+
+    auto creatureRaw = world->raws.creatures.all[unit->race];
+    auto casteRaw = creatureRaw->caste[unit->caste];
+
+    for (size_t j = 0; j < unit->appearance.tissue_style_type.size(); j++)
+    {
+        auto type = unit->appearance.tissue_style_type[j];
+        if (type < 0)
+            continue;
+        int style_raw_index = binsearch_index(casteRaw->tissue_styles, &df::tissue_style_raw::id, type);
+        auto styleRaw = casteRaw->tissue_styles[style_raw_index];
+        if (styleRaw->token == "HAIR")
+        {
+            auto send_style = appearance->mutable_hair();
+            send_style->set_length(unit->appearance.tissue_length[j]);
+            send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
+        }
+        else if (styleRaw->token == "BEARD")
+        {
+            auto send_style = appearance->mutable_beard();
+            send_style->set_length(unit->appearance.tissue_length[j]);
+            send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
+        }
+        else if (styleRaw->token == "MOUSTACHE")
+        {
+            auto send_style = appearance->mutable_moustache();
+            send_style->set_length(unit->appearance.tissue_length[j]);
+            send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
+        }
+        else if (styleRaw->token == "SIDEBURNS")
+        {
+            auto send_style = appearance->mutable_sideburns();
+            send_style->set_length(unit->appearance.tissue_length[j]);
+            send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
+        }
+    }
+}
+
+static void CopyUnitInventory(df::unit * unit, UnitDefinition * send_unit)
+{
+    for (size_t j = 0; j < unit->inventory.size(); j++)
+    {
+        auto inventory_item = unit->inventory[j];
+        auto sent_item = send_unit->add_inventory();
+        sent_item->set_mode((InventoryMode)inventory_item->mode);
+        sent_item->set_body_part_id(inventory_item->body_part_id);
+        CopyItem(sent_item->mutable_item(), inventory_item->item);
+    }
+}
+
+static void CopyUnitMotion(df::unit * unit, UnitDefinition * send_unit)
+{
+    send_unit->set_rider_id(unit->relationship_ids[df::unit_relationship_type::RiderMount]);
+
+    if (unit->flags1.bits.projectile)
+    {
+        for (auto proj = world->proj_list.next; proj != NULL; proj = proj->next)
+        {
+            STRICT_VIRTUAL_CAST_VAR(item, df::proj_unitst, proj->item);
+            if (item == NULL)
+                continue;
+            if (item->unit != unit)
+                continue;
+            send_unit->set_subpos_x(item->pos_x / 100000.0);
+            send_unit->set_subpos_y(item->pos_y / 100000.0);
+            send_unit->set_subpos_z(item->pos_z / 140000.0);
+            auto facing = send_unit->mutable_facing();
+            facing->set_x(item->speed_x);
+            facing->set_y(item->speed_x);
+            facing->set_z(item->speed_x);
+            break;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < unit->actions.size(); i++)
+        {
+            auto action = unit->actions[i];
+            switch (action->type)
+            {
+            case unit_action_type::Move:
+                if (unit->path.path.x.size() > 0)
+                {
+                    send_unit->set_subpos_x(lerp(0, unit->path.path.x[0] - unit->pos.x, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
+                    send_unit->set_subpos_y(lerp(0, unit->path.path.y[0] - unit->pos.y, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
+                    send_unit->set_subpos_z(lerp(0, unit->path.path.z[0] - unit->pos.z, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
+                }
+                break;
+            case unit_action_type::Job:
+                {
+                auto facing = send_unit->mutable_facing();
+                facing->set_x(action->data.job.x - unit->pos.x);
+                facing->set_y(action->data.job.y - unit->pos.y);
+                facing->set_z(action->data.job.z - unit->pos.z);
+                }
+            default:
+                break;
+            }
+        }
+        if (unit->path.path.x.size() > 0)
+        {
+            auto facing = send_unit->mutable_facing();
+            facing->set_x(unit->path.path.x[0] - unit->pos.x);
+            facing->set_y(unit->path.path.y[0] - unit->pos.y);
+            facing->set_z(unit->path.path.z[0] - unit->pos.z);
+        }
+    }
+}
+
+static void CopyUnitWounds(df::unit * unit, UnitDefinition * send_unit)
+{
+    for (size_t i = 0; i < unit->body.wounds.size(); i++)
+    {
+        GetWounds(unit->body.wounds[i], send_unit->add_wounds());
+    }
+}
+
 static command_result GetUnitListInside(color_ostream &stream, const BlockRequest *in, UnitList *out)
 {
     auto world = df::global::world;
@@ -1682,167 +1966,292 @@ static command_result GetUnitListInside(color_ostream &stream, const BlockReques
         send_unit->set_pos_z(unit->pos.z);
         send_unit->mutable_race()->set_mat_type(unit->race);
         send_unit->mutable_race()->set_mat_index(unit->caste);
-        if (in != NULL)
-        {
-            if (unit->pos.z < in->min_z() || unit->pos.z >= in->max_z())
-                continue;
-            if (unit->pos.x < in->min_x() * 16 || unit->pos.x >= in->max_x() * 16)
-                continue;
-            if (unit->pos.y < in->min_y() * 16 || unit->pos.y >= in->max_y() * 16)
-                continue;
-        }
+        if (in != NULL && !IsUnitInside(unit, in))
+            continue;
 
-        using df::global::cur_year;
-        using df::global::cur_year_tick;
-
-        send_unit->set_age(Units::getAge(unit, false));
-
-        ConvertDfColor(Units::getProfessionColor(unit), send_unit->mutable_profession_color());
-        send_unit->set_flags1(unit->flags1.whole);
-        send_unit->set_flags2(unit->flags2.whole);
-        send_unit->set_flags3(unit->flags3.whole);
-        send_unit->set_is_soldier(ENUM_ATTR(profession, military, unit->profession));
-        auto size_info = send_unit->mutable_size_info();
-        size_info->set_size_cur(unit->body.size_info.size_cur);
-        size_info->set_size_base(unit->body.size_info.size_base);
-        size_info->set_area_cur(unit->body.size_info.area_cur);
-        size_info->set_area_base(unit->body.size_info.area_base);
-        size_info->set_length_cur(unit->body.size_info.length_cur);
-        size_info->set_length_base(unit->body.size_info.length_base);
-        if (unit->name.has_name)
-        {
-            send_unit->set_name(DF2UTF(Translation::TranslateName(Units::getVisibleName(unit))));
-        }
+        CopyUnitAppearance(unit, send_unit);
+        CopyUnitInventory(unit, send_unit);
+        CopyUnitMotion(unit, send_unit);
+        CopyUnitWounds(unit, send_unit);
+    }
+    return CR_OK;
+}
+
+/*
+ * Unit streams send only what changed since the previous reply on the same
+ * stream. Each call takes a cheap fingerprint of every active unit per field
+ * group, and remembers the stream version at which each group last changed.
+ * Building the protobuf data, which is the expensive part, is then only done
+ * for groups newer than the client's copy, and for units entering the box.
+ */
+enum UnitField
+{
+    UNIT_POSITION,
+    UNIT_APPEARANCE,
+    UNIT_INVENTORY,
+    UNIT_WOUNDS,
+    UNIT_FIELD_COUNT
+};
+
+struct UnitTrack
+{
+    uint32_t hash[UNIT_FIELD_COUNT];
+    int32_t version[UNIT_FIELD_COUNT];
+};
+
+// Finds the stream a client asked for, or starts a new one, dropping the
+// least recently used stream when there are already max_streams. reset is
+// set when the client's copy is missing or out of date and it has to start
+// over. Stream types need an int32_t version, the last version sent.
+template<typename T>
+static typename std::map<int32_t, T>::iterator FindStream(std::map<int32_t, T> &streams,
+    size_t max_streams, int32_t &next_id, int32_t stream_id, int32_t version, bool &reset)
+{
+    auto it = streams.find(stream_id);
+    reset = (it == streams.end() || it->second.version != version);
+    if (it != streams.end())
+        return it;
 
-        auto appearance = send_unit->mutable_appearance();
-        for (size_t j = 0; j < unit->appearance.body_modifiers.size(); j++)
-            appearance->add_body_modifiers(unit->appearance.body_modifiers[j]);
-        for (size_t j = 0; j < unit->appearance.bp_modifiers.size(); j++)
-            appearance->add_bp_modifiers(unit->appearance.bp_modifiers[j]);
-        for (size_t j = 0; j < unit->appearance.colors.size(); j++)
-            appearance->add_colors(unit->appearance.colors[j]);
-        appearance->set_size_modifier(unit->appearance.size_modifier);
+    if (streams.size() >= max_streams)
+    {
+        // Drop the one that was used least recently
+        auto oldest = streams.begin();
+        for (auto jt = streams.begin(); jt != streams.end(); ++jt)
+            if (jt->second.version < oldest->second.version)
+                oldest = jt;
+        streams.erase(oldest);
+    }
+    return streams.insert(std::make_pair(next_id++, T())).first;
+}
 
-        appearance->set_physical_description(Units::getPhysicalDescription(unit));
+struct UnitStream
+{
+    int32_t version = 0;
+    std::set<int32_t> units;
+};
 
-        send_unit->set_profession_id(unit->profession);
+static const size_t MAX_UNIT_STREAMS = 32;
 
-        std::vector<Units::NoblePosition> pvec;
+static int32_t unit_stream_version = 0;
+static int32_t next_unit_stream_id = 1;
+static std::map<int32_t, UnitTrack> unit_tracks;
+static std::map<int32_t, UnitStream> unit_streams;
 
-        if (Units::getNoblePositions(&pvec, unit))
-        {
-            for (size_t j = 0; j < pvec.size(); j++)
-            {
-                auto noble_positon = pvec[j];
-                send_unit->add_noble_positions(noble_positon.position->code);
-            }
-        }
+static void ClearUnitStreams()
+{
+    unit_tracks.clear();
+    unit_streams.clear();
+}
 
-        send_unit->set_rider_id(unit->relationship_ids[df::unit_relationship_type::RiderMount]);
+static inline void HashUnitValue(uint32_t &hash, int32_t value)
+{
+    // FNV-1a, one 32-bit word at a time
+    hash = (hash ^ uint32_t(value)) * 16777619u;
+}
+
+static inline void HashUnitString(uint32_t &hash, const std::string &value)
+{
+    for (unsigned char c : value)
+        HashUnitValue(hash, c);
+    HashUnitValue(hash, -1);
+}
 
-        auto creatureRaw = world->raws.creatures.all[unit->race];
-        auto casteRaw = creatureRaw->caste[unit->caste];
+template<typename T>
+static inline void HashUnitVector(uint32_t &hash, const std::vector<T> &values)
+{
+    HashUnitValue(hash, values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        HashUnitValue(hash, values[i]);
+}
 
-        for (size_t j = 0; j < unit->appearance.tissue_style_type.size(); j++)
+static void HashUnit(df::unit * unit, uint32_t hash[UNIT_FIELD_COUNT], int32_t version)
+{
+    for (int i = 0; i < UNIT_FIELD_COUNT; i++)
+        hash[i] = 2166136261u;
+
+    uint32_t &pos = hash[UNIT_POSITION];
+    HashUnitValue(pos, unit->pos.x);
+    HashUnitValue(pos, unit->pos.y);
+    HashUnitValue(pos, unit->pos.z);
+    HashUnitValue(pos, unit->relationship_ids[df::unit_relationship_type::RiderMount]);
+    if (unit->flags1.bits.projectile)
+        HashUnitValue(pos, version); // moves every tick
+    for (size_t i = 0; i < unit->actions.size(); i++)
+    {
+        auto action = unit->actions[i];
+        HashUnitValue(pos, action->type);
+        if (action->type == unit_action_type::Move)
+            HashUnitValue(pos, action->data.move.timer);
+        else if (action->type == unit_action_type::Job)
         {
-            auto type = unit->appearance.tissue_style_type[j];
-            if (type < 0)
-                continue;
-            int style_raw_index = binsearch_index(casteRaw->tissue_styles, &df::tissue_style_raw::id, type);
-            auto styleRaw = casteRaw->tissue_styles[style_raw_index];
-            if (styleRaw->token == "HAIR")
-            {
-                auto send_style = appearance->mutable_hair();
-                send_style->set_length(unit->appearance.tissue_length[j]);
-                send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
-            }
-            else if (styleRaw->token == "BEARD")
-            {
-                auto send_style = appearance->mutable_beard();
-                send_style->set_length(unit->appearance.tissue_length[j]);
-                send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
-            }
-            else if (styleRaw->token == "MOUSTACHE")
-            {
-                auto send_style = appearance->mutable_moustache();
-                send_style->set_length(unit->appearance.tissue_length[j]);
-                send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
-            }
-            else if (styleRaw->token == "SIDEBURNS")
-            {
-                auto send_style = appearance->mutable_sideburns();
-                send_style->set_length(unit->appearance.tissue_length[j]);
-                send_style->set_style((HairStyle)unit->appearance.tissue_style[j]);
-            }
+            HashUnitValue(pos, action->data.job.x);
+            HashUnitValue(pos, action->data.job.y);
+            HashUnitValue(pos, action->data.job.z);
         }
-
-        for (size_t j = 0; j < unit->inventory.size(); j++)
+    }
+    if (unit->path.path.x.size() > 0)
+    {
+        HashUnitValue(pos, unit->path.path.x[0]);
+        HashUnitValue(pos, unit->path.path.y[0]);
+        HashUnitValue(pos, unit->path.path.z[0]);
+    }
+
+    uint32_t &app = hash[UNIT_APPEARANCE];
+    HashUnitValue(app, unit->race);
+    HashUnitValue(app, unit->caste);
+    HashUnitValue(app, int32_t(Units::getAge(unit, false)));
+    HashUnitValue(app, unit->profession);
+    HashUnitValue(app, unit->flags1.whole);
+    HashUnitValue(app, unit->flags2.whole);
+    HashUnitValue(app, unit->flags3.whole);
+    HashUnitValue(app, unit->body.size_info.size_cur);
+    HashUnitValue(app, unit->body.size_info.size_base);
+    HashUnitValue(app, unit->body.size_info.area_cur);
+    HashUnitValue(app, unit->body.size_info.length_cur);
+    if (unit->name.has_name)
+    {
+        auto name = Units::getVisibleName(unit);
+        HashUnitString(app, name->first_name);
+        HashUnitString(app, name->nickname);
+        for (int i = 0; i < 7; i++)
+            HashUnitValue(app, name->words[i]);
+    }
+    HashUnitVector(app, unit->appearance.body_modifiers);
+    HashUnitVector(app, unit->appearance.bp_modifiers);
+    HashUnitVector(app, unit->appearance.colors);
+    HashUnitValue(app, unit->appearance.size_modifier);
+    HashUnitVector(app, unit->appearance.tissue_style_type);
+    HashUnitVector(app, unit->appearance.tissue_style);
+    HashUnitVector(app, unit->appearance.tissue_length);
+
+    std::vector<Units::NoblePosition> pvec;
+    if (Units::getNoblePositions(&pvec, unit))
+    {
+        for (size_t j = 0; j < pvec.size(); j++)
+            HashUnitValue(app, pvec[j].position->id);
+    }
+
+    uint32_t &inv = hash[UNIT_INVENTORY];
+    for (size_t j = 0; j < unit->inventory.size(); j++)
+    {
+        auto inventory_item = unit->inventory[j];
+        HashUnitValue(inv, inventory_item->mode);
+        HashUnitValue(inv, inventory_item->body_part_id);
+        HashUnitValue(inv, inventory_item->item->id);
+        HashUnitValue(inv, inventory_item->item->flags.whole);
+        HashUnitValue(inv, inventory_item->item->flags2.whole);
+    }
+
+    uint32_t &wounds = hash[UNIT_WOUNDS];
+    for (size_t i = 0; i < unit->body.wounds.size(); i++)
+    {
+        auto wound = unit->body.wounds[i];
+        HashUnitValue(wounds, wound->id);
+        HashUnitValue(wounds, wound->flags.bits.severed_part);
+        for (size_t j = 0; j < wound->parts.size(); j++)
         {
-            auto inventory_item = unit->inventory[j];
-            auto sent_item = send_unit->add_inventory();
-            sent_item->set_mode((InventoryMode)inventory_item->mode);
-            sent_item->set_body_part_id(inventory_item->body_part_id);
-            CopyItem(sent_item->mutable_item(), inventory_item->item);
+            HashUnitValue(wounds, wound->parts[j]->global_layer_idx);
+            HashUnitValue(wounds, wound->parts[j]->body_part_id);
+            HashUnitValue(wounds, wound->parts[j]->layer_idx);
         }
+    }
+}
 
-        if (unit->flags1.bits.projectile)
+// Refreshes the fingerprints of all active units, and forgets the rest.
+static void UpdateUnitTracks(int32_t version)
+{
+    std::map<int32_t, UnitTrack> tracks;
+
+    for (auto unit : world->units.active)
+    {
+        uint32_t hash[UNIT_FIELD_COUNT];
+        HashUnit(unit, hash, version);
+
+        auto it = unit_tracks.find(unit->id);
+        UnitTrack &track = tracks[unit->id];
+        for (int i = 0; i < UNIT_FIELD_COUNT; i++)
         {
-            for (auto proj = world->proj_list.next; proj != NULL; proj = proj->next)
-            {
-                STRICT_VIRTUAL_CAST_VAR(item, df::proj_unitst, proj->item);
-                if (item == NULL)
-                    continue;
-                if (item->unit != unit)
-                    continue;
-                send_unit->set_subpos_x(item->pos_x / 100000.0);
-                send_unit->set_subpos_y(item->pos_y / 100000.0);
-                send_unit->set_subpos_z(item->pos_z / 140000.0);
-                auto facing = send_unit->mutable_facing();
-                facing->set_x(item->speed_x);
-                facing->set_y(item->speed_x);
-                facing->set_z(item->speed_x);
-                break;
-            }
+            track.hash[i] = hash[i];
+            if (it != unit_tracks.end() && it->second.hash[i] == hash[i])
+                track.version[i] = it->second.version[i];
+            else
+                track.version[i] = version;
         }
-        else
+    }
+
+    unit_tracks.swap(tracks);
+}
+
+static command_result GetUnitStream(color_ostream &stream, const UnitStreamRequest *in, UnitStreamReply *out)
+{
+    if (!Core::getInstance().isWorldLoaded())
+        return CR_FAILURE;
+
+    int32_t version = ++unit_stream_version;
+    UpdateUnitTracks(version);
+
+    bool reset;
+    auto it = FindStream(unit_streams, MAX_UNIT_STREAMS, next_unit_stream_id,
+        in->stream_id(), in->version(), reset);
+
+    UnitStream &unit_stream = it->second;
+    if (reset)
+        unit_stream.units.clear();
+
+    out->set_stream_id(it->first);
+    out->set_version(version);
+    out->set_reset(reset);
+
+    std::set<int32_t> inside;
+
+    for (auto unit : world->units.active)
+    {
+        if (in->has_box() && !IsUnitInside(unit, &in->box()))
+            continue;
+
+        inside.insert(unit->id);
+
+        bool known = unit_stream.units.count(unit->id) > 0;
+        const UnitTrack &track = unit_tracks[unit->id];
+        uint32_t changed = 0;
+
+        for (int i = 0; i < UNIT_FIELD_COUNT; i++)
         {
-            for (size_t i = 0; i < unit->actions.size(); i++)
-            {
-                auto action = unit->actions[i];
-                switch (action->type)
-                {
-                case unit_action_type::Move:
-                    if (unit->path.path.x.size() > 0)
-                    {
-                        send_unit->set_subpos_x(lerp(0, unit->path.path.x[0] - unit->pos.x, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
-                        send_unit->set_subpos_y(lerp(0, unit->path.path.y[0] - unit->pos.y, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
-                        send_unit->set_subpos_z(lerp(0, unit->path.path.z[0] - unit->pos.z, (float)(action->data.move.timer_init - action->data.move.timer) / action->data.move.timer_init));
-                    }
-                    break;
-                case unit_action_type::Job:
-                    {
-                    auto facing = send_unit->mutable_facing();
-                    facing->set_x(action->data.job.x - unit->pos.x);
-                    facing->set_y(action->data.job.y - unit->pos.y);
-                    facing->set_z(action->data.job.z - unit->pos.z);
-                    }
-                default:
-                    break;
-                }
-            }
-            if (unit->path.path.x.size() > 0)
-            {
-                auto facing = send_unit->mutable_facing();
-                facing->set_x(unit->path.path.x[0] - unit->pos.x);
-                facing->set_y(unit->path.path.y[0] - unit->pos.y);
-                facing->set_z(unit->path.path.z[0] - unit->pos.z);
-            }
+            if (!known || track.version[i] > unit_stream.version)
+                changed |= 1 << i;
         }
-        for (size_t i = 0; i < unit->body.wounds.size(); i++)
+
+        if (!changed)
+            continue;
+
+        auto send_unit = out->add_creature_list();
+        send_unit->set_id(unit->id);
+        send_unit->set_changed_fields(changed);
+
+        if (changed & (1 << UNIT_POSITION))
         {
-            GetWounds(unit->body.wounds[i], send_unit->add_wounds());
+            send_unit->set_pos_x(unit->pos.x);
+            send_unit->set_pos_y(unit->pos.y);
+            send_unit->set_pos_z(unit->pos.z);
+            CopyUnitMotion(unit, send_unit);
         }
+        if (changed & (1 << UNIT_APPEARANCE))
+            CopyUnitAppearance(unit, send_unit);
+        if (changed & (1 << UNIT_INVENTORY))
+            CopyUnitInventory(unit, send_unit);
+        if (changed & (1 << UNIT_WOUNDS))
+            CopyUnitWounds(unit, send_unit);
+    }
+
+    for (auto id : unit_stream.units)
+    {
+        if (!inside.count(id))
+            out->add_removed_ids(id);
     }
+
+    unit_stream.units.swap(inside);
+    unit_stream.version = version;
+
     return CR_OK;
 }
 
@@ -2620,11 +3029,6 @@ static command_result GetRegionMapsNew(color_ostream &stream, const EmptyMessage
     return CR_OK;
 }
 
-static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, CreatureRawList *out)
-{
-    return GetPartialCreatureRaws(stream, NULL, out);
-}
-
 static command_result GetPartialCreatureRaws(color_ostream &stream, const ListRequest *in, CreatureRawList *out)
 {
     if (!df::global::world)
@@ -2829,12 +3233,6 @@ static command_result GetPartialCreatureRaws(color_ostream &stream, const ListRe
     return CR_OK;
 }
 
-static command_result GetPlantRaws(color_ostream &stream, const EmptyMessage *in, PlantRawList *out)
-{
-    GetPartialPlantRaws(stream, nullptr, out);
-    return CR_OK;
-}
-
 static command_result GetPartialPlantRaws(color_ostream &stream, const ListRequest *in, PlantRawList *out)
 {
     if (!df::global::world)
@@ -2909,6 +3307,141 @@ static command_result CopyScreen(color_ostream &stream, const EmptyMessage *in,
     return CR_OK;
 }
 
+struct ScreenCell
+{
+    uint32_t character;
+    uint32_t foreground;
+    uint32_t background;
+    int32_t texpos;
+
+    bool operator==(const ScreenCell &other) const
+    {
+        return character == other.character && foreground == other.foreground
+            && background == other.background && texpos == other.texpos;
+    }
+    bool operator!=(const ScreenCell &other) const { return !(*this == other); }
+};
+
+struct ScreenStream
+{
+    int32_t version = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<ScreenCell> cells;
+};
+
+static const size_t MAX_SCREEN_STREAMS = 8;
+// Unchanged tiles between two changed ones are sent along if there are
+// fewer than this many, instead of starting a new span.
+static const int SCREEN_SPAN_GAP = 4;
+// Runs of at least this many identical tiles get a span of their own.
+static const int SCREEN_MIN_RUN = 4;
+
+static int32_t screen_stream_version = 0;
+static int32_t next_screen_stream_id = 1;
+static std::map<int32_t, ScreenStream> screen_streams;
+
+static void AddScreenSpan(ScreenDiff *out, const std::vector<ScreenCell> &cells, int start, int length, bool repeat)
+{
+    auto span = out->add_spans();
+    span->set_start(start);
+    span->set_length(length);
+    for (int i = start; i < start + (repeat ? 1 : length); i++)
+    {
+        span->add_character(cells[i].character);
+        span->add_foreground(cells[i].foreground);
+        span->add_background(cells[i].background);
+        span->add_texpos(cells[i].texpos);
+    }
+}
+
+// Sends the tiles in [start, end), with runs of identical tiles collapsed.
+static void AddScreenSpans(ScreenDiff *out, const std::vector<ScreenCell> &cells, int start, int end)
+{
+    int literal = start;
+    int i = start;
+    while (i < end)
+    {
+        int run = 1;
+        while (i + run < end && cells[i + run] == cells[i])
+            run++;
+        if (run < SCREEN_MIN_RUN)
+        {
+            i += run;
+            continue;
+        }
+        if (literal < i)
+            AddScreenSpan(out, cells, literal, i - literal, false);
+        AddScreenSpan(out, cells, i, run, true);
+        i += run;
+        literal = i;
+    }
+    if (literal < end)
+        AddScreenSpan(out, cells, literal, end - literal, false);
+}
+
+static command_result GetScreenDiff(color_ostream &stream, const ScreenDiffRequest *in, ScreenDiff *out)
+{
+    df::graphic * gps = df::global::gps;
+    int32_t version = ++screen_stream_version;
+
+    bool keyframe;
+    auto it = FindStream(screen_streams, MAX_SCREEN_STREAMS, next_screen_stream_id,
+        in->stream_id(), in->version(), keyframe);
+
+    ScreenStream &screen = it->second;
+    if (screen.width != gps->dimx || screen.height != gps->dimy)
+        keyframe = true;
+
+    int size = gps->dimx * gps->dimy;
+    std::vector<ScreenCell> cells(size);
+    for (int i = 0; i < size; i++)
+    {
+        int index = i * 4;
+        cells[i].character = gps->screen[index];
+        cells[i].foreground = gps->screen[index + 1] | (gps->screen[index + 3] * 8);
+        cells[i].background = gps->screen[index + 2];
+        cells[i].texpos = gps->screentexpos ? gps->screentexpos[i] : 0;
+    }
+
+    out->set_stream_id(it->first);
+    out->set_version(version);
+    out->set_width(gps->dimx);
+    out->set_height(gps->dimy);
+    out->set_keyframe(keyframe);
+
+    if (keyframe)
+        AddScreenSpans(out, cells, 0, size);
+    else
+    {
+        int i = 0;
+        while (i < size)
+        {
+            if (cells[i] == screen.cells[i])
+            {
+                i++;
+                continue;
+            }
+            int start = i;
+            int end = i + 1;
+            for (i = end; i < size && i - end < SCREEN_SPAN_GAP; i++)
+            {
+                if (cells[i] != screen.cells[i])
+                    end = i + 1;
+            }
+            i = end;
+            AddScreenSpans(out, cells, start, end);
+        }
+    }
+
+    screen.version = version;
+    screen.width = gps->dimx;
+    screen.height = gps->dimy;
+    screen.cells.swap(cells);
+
+    return CR_OK;
+}
+
 static command_result PassKeyboardEvent(color_ostream &stream, const KeyboardEvent *in)
 {
 #if DF_VERSION_INT > 34011
@@ -2961,6 +3494,22 @@ static command_result GetVersionInfo(color_ostream & stream, const EmptyMessage
 
 int lastSentReportID = -1;
 
+void CopyReport(df::report * local_rep, RemoteFortressReader::Report * send_rep)
+{
+    send_rep->set_type(local_rep->type);
+    send_rep->set_text(DF2UTF(local_rep->text));
+    ConvertDfColor(local_rep->color | (local_rep->bright ? 8 : 0), send_rep->mutable_color());
+    send_rep->set_duration(local_rep->duration);
+    send_rep->set_continuation(local_rep->flags.bits.continuation);
+    send_rep->set_unconscious(local_rep->flags.bits.unconscious);
+    send_rep->set_announcement(local_rep->flags.bits.announcement);
+    send_rep->set_repeat_count(local_rep->repeat_count);
+    ConvertDFCoord(local_rep->pos, send_rep->mutable_pos());
+    send_rep->set_id(local_rep->id);
+    send_rep->set_year(local_rep->year);
+    send_rep->set_time(local_rep->time);
+}
+
 static command_result GetReports(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Status * out)
 {
     //First find the last report we sent, so it doesn't get resent.
@@ -2979,25 +3528,13 @@ static command_result GetReports(color_ostream & stream, const EmptyMessage * in
         auto local_rep = world->status.reports[i];
         if (!local_rep)
             continue;
-        auto send_rep = out->add_reports();
-        send_rep->set_type(local_rep->type);
-        send_rep->set_text(DF2UTF(local_rep->text));
-        ConvertDfColor(local_rep->color | (local_rep->bright ? 8 : 0), send_rep->mutable_color());
-        send_rep->set_duration(local_rep->duration);
-        send_rep->set_continuation(local_rep->flags.bits.continuation);
-        send_rep->set_unconscious(local_rep->flags.bits.unconscious);
-        send_rep->set_announcement(local_rep->flags.bits.announcement);
-        send_rep->set_repeat_count(local_rep->repeat_count);
-        ConvertDFCoord(local_rep->pos, send_rep->mutable_pos());
-        send_rep->set_id(local_rep->id);
-        send_rep->set_year(local_rep->year);
-        send_rep->set_time(local_rep->time);
+        CopyReport(local_rep, out->add_reports());
         lastSentReportID = local_rep->id;
     }
     return CR_OK;
 }
 
-static command_result GetLanguage(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Language * out)
+static command_result BuildLanguage(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Language * out)
 {
     if (!world)
         return CR_FAILURE;
@@ -3011,3 +3548,177 @@ static command_result GetLanguage(color_ostream & stream, const EmptyMessage * i
     }
     return CR_OK;
 }
+
+/*
+ * The raw catalogs only change when a world is loaded, but take a while to
+ * build, so they are kept serialized until the next load. Clients that
+ * remember the hash of their copy can skip downloading it again with
+ * GetCachedCatalog.
+ */
+struct RawCatalog
+{
+    bool valid = false;
+    command_result result = CR_FAILURE;
+    uint64_t hash = 0;
+    std::string data;
+};
+
+static RawCatalog raw_catalogs[CatalogType_ARRAYSIZE];
+static std::mutex catalog_mutex;
+
+static void ClearCatalogs()
+{
+    std::lock_guard<std::mutex> lock(catalog_mutex);
+    for (auto &catalog : raw_catalogs)
+        catalog = RawCatalog();
+}
+
+static uint64_t HashCatalog(const std::string &data)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template<typename T>
+static command_result BuildCatalogData(color_ostream &stream, std::string *data,
+    command_result (*builder)(color_ostream &, const EmptyMessage *, T *))
+{
+    T msg;
+    command_result result = builder(stream, nullptr, &msg);
+    if (result == CR_OK)
+        msg.SerializeToString(data);
+    return result;
+}
+
+template<typename T>
+static command_result BuildCatalogData(color_ostream &stream, std::string *data,
+    command_result (*builder)(color_ostream &, const ListRequest *, T *))
+{
+    T msg;
+    command_result result = builder(stream, nullptr, &msg);
+    if (result == CR_OK)
+        msg.SerializeToString(data);
+    return result;
+}
+
+static void BuildCatalog(color_ostream &stream, CatalogType type, RawCatalog *catalog)
+{
+    switch (type)
+    {
+    case MaterialCatalog:
+        catalog->result = BuildCatalogData(stream, &catalog->data, BuildMaterialList);
+        break;
+    case GrowthCatalog:
+        catalog->result = BuildCatalogData(stream, &catalog->data, BuildGrowthList);
+        break;
+    case CreatureRawCatalog:
+        catalog->result = BuildCatalogData(stream, &catalog->data, GetPartialCreatureRaws);
+        break;
+    case PlantRawCatalog:
+        // GetPlantRaws has always ignored the result
+        BuildCatalogData(stream, &catalog->data, GetPartialPlantRaws);
+        catalog->result = CR_OK;
+        break;
+    case TiletypeCatalog:
+        catalog->result = BuildCatalogData(stream, &catalog->data, BuildTiletypeList);
+        break;
+    case LanguageCatalog:
+        catalog->result = BuildCatalogData(stream, &catalog->data, BuildLanguage);
+        break;
+    }
+
+    catalog->hash = HashCatalog(catalog->data);
+
+    // Without a world, the lists are empty and must not be kept
+    catalog->valid = (catalog->result == CR_OK) &&
+        (type == TiletypeCatalog || Core::getInstance().isWorldLoaded());
+}
+
+// Calls fn with the catalog, building it first if it isn't cached.
+template<typename F>
+static command_result WithCatalog(color_ostream &stream, CatalogType type, F fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(catalog_mutex);
+        if (raw_catalogs[type].valid)
+            return fn(raw_catalogs[type]);
+    }
+
+    // The core must be taken before catalog_mutex, since ClearCatalogs
+    // is called from the core thread.
+    CoreSuspender suspend;
+
+    RawCatalog catalog;
+    BuildCatalog(stream, type, &catalog);
+
+    std::lock_guard<std::mutex> lock(catalog_mutex);
+    if (!catalog.valid)
+        return fn(catalog);
+
+    std::swap(raw_catalogs[type], catalog);
+    return fn(raw_catalogs[type]);
+}
+
+static command_result GetCatalogMessage(color_ostream &stream, CatalogType type, google::protobuf::MessageLite *out)
+{
+    return WithCatalog(stream, type, [out](const RawCatalog &catalog) {
+        if (catalog.result == CR_OK && !out->ParseFromString(catalog.data))
+            return CR_FAILURE;
+        return catalog.result;
+    });
+}
+
+static command_result GetMaterialList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
+{
+    return GetCatalogMessage(stream, MaterialCatalog, out);
+}
+
+static command_result GetGrowthList(color_ostream &stream, const EmptyMessage *in, MaterialList *out)
+{
+    return GetCatalogMessage(stream, GrowthCatalog, out);
+}
+
+static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, CreatureRawList *out)
+{
+    return GetCatalogMessage(stream, CreatureRawCatalog, out);
+}
+
+static command_result GetPlantRaws(color_ostream &stream, const EmptyMessage *in, PlantRawList *out)
+{
+    return GetCatalogMessage(stream, PlantRawCatalog, out);
+}
+
+static command_result GetTiletypeList(color_ostream &stream, const EmptyMessage *in, TiletypeList *out)
+{
+    return GetCatalogMessage(stream, TiletypeCatalog, out);
+}
+
+static command_result GetLanguage(color_ostream & stream, const EmptyMessage * in, RemoteFortressReader::Language * out)
+{
+    return GetCatalogMessage(stream, LanguageCatalog, out);
+}
+
+static command_result GetCachedCatalog(color_ostream &stream, const CatalogRequest *in, CatalogReply *out)
+{
+    if (!CatalogType_IsValid(in->type()))
+        return CR_WRONG_USAGE;
+
+    return WithCatalog(stream, in->type(), [in, out](const RawCatalog &catalog) {
+        out->set_type(in->type());
+        if (catalog.result != CR_OK)
+            return catalog.result;
+
+        out->set_hash(catalog.hash);
+        if (in->has_hash() && in->hash() == catalog.hash)
+            out->set_unchanged(true);
+        else
+            out->set_data(catalog.data);
+        return CR_OK;
+    });
+}
@@ -0,0 +1,337 @@
+#include "world_snapshot.h"
+#include "building_reader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "Core.h"
+#include "DataDefs.h"
+#include "MiscUtils.h"
+
+#include "df/building.h"
+#include "df/map_block.h"
+#include "df/report.h"
+#include "df/unit.h"
+#include "df/world.h"
+
+using namespace DFHack;
+using namespace RemoteFortressReader;
+
+using df::global::world;
+
+/*
+ * A copy of the parts of the world that remote viewers poll most, taken every
+ * few ticks from the core thread. Readers get it through a shared pointer and
+ * never touch the live world, so GetWorldSnapshot runs without suspending the
+ * game. Tile data of blocks that did not change is shared with the previous
+ * snapshot instead of being copied again.
+ */
+namespace
+{
+    struct SnapshotBlock
+    {
+        df::coord map_pos;
+        df::tiletype tiletype[16][16];
+        df::tile_designation designation[16][16];
+    };
+
+    struct SnapshotData
+    {
+        int32_t frame;
+        int32_t year;
+        int32_t year_tick;
+        uint32_t contents;
+        std::vector<std::shared_ptr<const SnapshotBlock>> blocks;
+        std::vector<UnitDefinition> units;
+        std::vector<BuildingInstance> buildings;
+        std::vector<Report> reports;
+    };
+
+    const uint32_t ALL_CONTENTS = SnapshotBlocks | SnapshotUnits | SnapshotBuildings | SnapshotReports;
+    const size_t MAX_SNAPSHOT_REPORTS = 100;
+
+    std::mutex snapshot_mutex;
+    std::shared_ptr<const SnapshotData> current_snapshot;
+
+    // Only used from the core thread
+    int snapshot_interval = 0;
+    uint32_t snapshot_contents = ALL_CONTENTS;
+    int32_t last_snapshot_frame = 0;
+}
+
+static std::shared_ptr<const SnapshotData> GetCurrentSnapshot()
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    return current_snapshot;
+}
+
+void ClearWorldSnapshot()
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    current_snapshot.reset();
+}
+
+static void SaveBlocks(SnapshotData *data, const SnapshotData *prev)
+{
+    auto &map_blocks = world->map.map_blocks;
+    bool same_layout = prev && prev->blocks.size() == map_blocks.size();
+
+    data->blocks.reserve(map_blocks.size());
+
+    for (size_t i = 0; i < map_blocks.size(); i++)
+    {
+        df::map_block *block = map_blocks[i];
+
+        if (same_layout)
+        {
+            auto &old_block = prev->blocks[i];
+            if (old_block->map_pos == block->map_pos &&
+                !memcmp(old_block->tiletype, block->tiletype, sizeof(block->tiletype)) &&
+                !memcmp(old_block->designation, block->designation, sizeof(block->designation)))
+            {
+                data->blocks.push_back(old_block);
+                continue;
+            }
+        }
+
+        auto copy = std::make_shared<SnapshotBlock>();
+        copy->map_pos = block->map_pos;
+        memcpy(copy->tiletype, block->tiletype, sizeof(block->tiletype));
+        memcpy(copy->designation, block->designation, sizeof(block->designation));
+        data->blocks.push_back(copy);
+    }
+}
+
+static void SaveUnits(SnapshotData *data)
+{
+    data->units.reserve(world->units.active.size());
+
+    for (auto unit : world->units.active)
+    {
+        data->units.emplace_back();
+        auto &send_unit = data->units.back();
+        send_unit.set_id(unit->id);
+        send_unit.set_pos_x(unit->pos.x);
+        send_unit.set_pos_y(unit->pos.y);
+        send_unit.set_pos_z(unit->pos.z);
+        send_unit.mutable_race()->set_mat_type(unit->race);
+        send_unit.mutable_race()->set_mat_index(unit->caste);
+        send_unit.set_flags1(unit->flags1.whole);
+        send_unit.set_flags2(unit->flags2.whole);
+        send_unit.set_flags3(unit->flags3.whole);
+        send_unit.set_profession_id(unit->profession);
+    }
+}
+
+static void SaveBuildings(SnapshotData *data)
+{
+    data->buildings.resize(world->buildings.all.size());
+
+    for (size_t i = 0; i < world->buildings.all.size(); i++)
+        CopyBuilding(i, &data->buildings[i]);
+}
+
+static void SaveReports(SnapshotData *data)
+{
+    auto &reports = world->status.reports;
+    size_t start = reports.size() > MAX_SNAPSHOT_REPORTS ? reports.size() - MAX_SNAPSHOT_REPORTS : 0;
+
+    for (size_t i = start; i < reports.size(); i++)
+    {
+        if (!reports[i])
+            continue;
+        data->reports.emplace_back();
+        CopyReport(reports[i], &data->reports.back());
+    }
+}
+
+void UpdateWorldSnapshot()
+{
+    if (snapshot_interval <= 0 || !Core::getInstance().isMapLoaded())
+        return;
+
+    int32_t frame = world->frame_counter;
+    auto prev = GetCurrentSnapshot();
+
+    // The frame counter goes back when a different save is loaded
+    if (prev && frame >= last_snapshot_frame && frame - last_snapshot_frame < snapshot_interval)
+        return;
+
+    last_snapshot_frame = frame;
+
+    auto data = std::make_shared<SnapshotData>();
+    data->frame = frame;
+    data->year = df::global::cur_year ? *df::global::cur_year : 0;
+    data->year_tick = df::global::cur_year_tick ? *df::global::cur_year_tick : 0;
+    data->contents = snapshot_contents;
+
+    if (snapshot_contents & SnapshotBlocks)
+        SaveBlocks(data.get(), prev.get());
+    if (snapshot_contents & SnapshotUnits)
+        SaveUnits(data.get());
+    if (snapshot_contents & SnapshotBuildings)
+        SaveBuildings(data.get());
+    if (snapshot_contents & SnapshotReports)
+        SaveReports(data.get());
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    current_snapshot = data;
+}
+
+static bool IsInside(const SnapshotRequest *in, int x, int y, int z)
+{
+    if (!in->has_box())
+        return true;
+    auto &box = in->box();
+    return z >= box.min_z() && z < box.max_z() &&
+        x >= box.min_x() * 16 && x < box.max_x() * 16 &&
+        y >= box.min_y() * 16 && y < box.max_y() * 16;
+}
+
+static bool IsOverlapping(const SnapshotRequest *in, const BuildingInstance &building)
+{
+    if (!in->has_box())
+        return true;
+    auto &box = in->box();
+    return building.pos_z_max() >= box.min_z() && building.pos_z_min() < box.max_z() &&
+        building.pos_x_max() >= box.min_x() * 16 && building.pos_x_min() < box.max_x() * 16 &&
+        building.pos_y_max() >= box.min_y() * 16 && building.pos_y_min() < box.max_y() * 16;
+}
+
+static void CopySnapshotBlock(const SnapshotBlock &block, MapBlock *NetBlock)
+{
+    NetBlock->set_map_x(block.map_pos.x);
+    NetBlock->set_map_y(block.map_pos.y);
+    NetBlock->set_map_z(block.map_pos.z);
+
+    for (int yy = 0; yy < 16; yy++)
+        for (int xx = 0; xx < 16; xx++)
+        {
+            df::tile_designation designation = block.designation[xx][yy];
+            int lava = 0;
+            int water = 0;
+            if (designation.bits.liquid_type == df::enums::tile_liquid::Magma)
+                lava = designation.bits.flow_size;
+            else
+                water = designation.bits.flow_size;
+            NetBlock->add_tiles(block.tiletype[xx][yy]);
+            NetBlock->add_magma(lava);
+            NetBlock->add_water(water);
+            NetBlock->add_aquifer(designation.bits.water_table);
+            NetBlock->add_light(designation.bits.light);
+            NetBlock->add_outside(designation.bits.outside);
+            NetBlock->add_subterranean(designation.bits.subterranean);
+            NetBlock->add_water_salt(designation.bits.water_salt);
+            NetBlock->add_water_stagnant(designation.bits.water_stagnant);
+            NetBlock->add_hidden(designation.bits.hidden);
+        }
+}
+
+command_result GetWorldSnapshot(color_ostream &stream, const SnapshotRequest *in, WorldSnapshot *out)
+{
+    auto data = GetCurrentSnapshot();
+    if (!data)
+    {
+        stream.printerr("No world snapshot available; see remote-snapshot.\n");
+        return CR_NOT_FOUND;
+    }
+
+    out->set_frame(data->frame);
+    out->set_year(data->year);
+    out->set_year_tick(data->year_tick);
+    out->set_contents(data->contents);
+
+    if (in->has_known_frame() && in->known_frame() == data->frame)
+        return CR_OK;
+
+    uint32_t contents = in->has_contents() ? in->contents() : ALL_CONTENTS;
+
+    if (contents & SnapshotBlocks)
+    {
+        for (auto &block : data->blocks)
+        {
+            if (IsInside(in, block->map_pos.x, block->map_pos.y, block->map_pos.z))
+                CopySnapshotBlock(*block, out->add_map_blocks());
+        }
+    }
+    if (contents & SnapshotUnits)
+    {
+        for (auto &unit : data->units)
+        {
+            if (IsInside(in, unit.pos_x(), unit.pos_y(), unit.pos_z()))
+                out->add_units()->CopyFrom(unit);
+        }
+    }
+    if (contents & SnapshotBuildings)
+    {
+        for (auto &building : data->buildings)
+        {
+            if (IsOverlapping(in, building))
+                out->add_buildings()->CopyFrom(building);
+        }
+    }
+    if (contents & SnapshotReports)
+    {
+        for (auto &report : data->reports)
+            out->add_reports()->CopyFrom(report);
+    }
+
+    return CR_OK;
+}
+
+command_result RemoteSnapshotCommand(color_ostream &out, std::vector<std::string> &parameters)
+{
+    if (parameters.empty())
+    {
+        auto data = GetCurrentSnapshot();
+        if (snapshot_interval <= 0)
+            out.print("World snapshots are disabled.\n");
+        else
+            out.print("Taking a world snapshot every %d ticks.\n", snapshot_interval);
+        if (data)
+        {
+            out.print("Last snapshot: frame %d, %zu blocks, %zu units, %zu buildings, %zu reports.\n",
+                      data->frame, data->blocks.size(), data->units.size(),
+                      data->buildings.size(), data->reports.size());
+        }
+        return CR_OK;
+    }
+
+    if (parameters[0] == "off")
+    {
+        if (parameters.size() > 1)
+            return CR_WRONG_USAGE;
+        snapshot_interval = 0;
+        ClearWorldSnapshot();
+        return CR_OK;
+    }
+
+    char *end = NULL;
+    long interval = strtol(parameters[0].c_str(), &end, 10);
+    if (!end || *end || interval <= 0)
+        return CR_WRONG_USAGE;
+
+    uint32_t contents = 0;
+    for (size_t i = 1; i < parameters.size(); i++)
+    {
+        if (parameters[i] == "blocks")
+            contents |= SnapshotBlocks;
+        else if (parameters[i] == "units")
+            contents |= SnapshotUnits;
+        else if (parameters[i] == "buildings")
+            contents |= SnapshotBuildings;
+        else if (parameters[i] == "reports")
+            contents |= SnapshotReports;
+        else
+            return CR_WRONG_USAGE;
+    }
+
+    snapshot_interval = interval;
+    snapshot_contents = contents ? contents : ALL_CONTENTS;
+
+    // Take the next one right away, with the new contents
+    ClearWorldSnapshot();
+    return CR_OK;
+}
@@ -0,0 +1,24 @@
+#ifndef WORLD_SNAPSHOT_H
+#define WORLD_SNAPSHOT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "RemoteClient.h"
+#include "RemoteFortressReader.pb.h"
+
+namespace df
+{
+    struct report;
+}
+
+DFHack::command_result GetWorldSnapshot(DFHack::color_ostream &stream, const RemoteFortressReader::SnapshotRequest *in, RemoteFortressReader::WorldSnapshot *out);
+DFHack::command_result RemoteSnapshotCommand(DFHack::color_ostream &out, std::vector<std::string> &parameters);
+
+// Called from the core thread.
+void UpdateWorldSnapshot();
+void ClearWorldSnapshot();
+
+void CopyReport(df::report * local_rep, RemoteFortressReader::Report * send_rep);
+
+#endif // !WORLD_SNAPSHOT_H
@@ -18,6 +18,9 @@
 #include <cstdio>
 #include <stack>
 #include <string>
+#include <map>
+#include <memory>
+#include <unordered_map>
 #include <cmath>
 #include <string.h>
 
@@ -41,6 +44,7 @@
 #include "df/job.h"
 #include "df/job.h"
 #include "df/job_item.h"
+#include "df/map_block.h"
 #include "df/material.h"
 #include "df/physical_attribute_type.h"
 #include "df/proj_itemst.h"
@@ -327,6 +331,8 @@ static bool apply_impact_damage(df::item *item, int minv, int maxv)
 
 static bool enable_plugin();
 
+struct EngineTargetMap;
+
 struct EngineInfo {
     int id;
     df::building_siegeenginest *bld;
@@ -352,6 +358,9 @@ struct EngineInfo {
     df::stockpile_links links;
     df::workshop_profile profile;
 
+    // Cached ray tracing results, see get_target_map()
+    std::shared_ptr<EngineTargetMap> target_map;
+
     bool hasTarget() { return is_range_valid(target); }
     bool onTarget(df::coord pos) { return is_in_range(target, pos); }
     df::coord getTargetSize() { return target.second - target.first; }
@@ -962,13 +971,39 @@ struct PathMetrics {
 
     bool hits() const { return collision_step > goal_step; }
 
-    PathMetrics(const ProjectilePath &path)
+    PathMetrics() {}
+    PathMetrics(const ProjectilePath &path, std::set<df::coord> *blocks = NULL)
     {
-        compute(path);
+        compute(path, blocks);
     }
 
-    void compute(const ProjectilePath &path)
+    // Remembers the last map block, since consecutive ray steps are
+    // nearly always in the same one. Optionally records visited blocks.
+    struct TileCursor {
+        std::set<df::coord> *blocks;
+        df::coord block_pos;
+        df::map_block *block;
+
+        TileCursor(std::set<df::coord> *blocks) : blocks(blocks), block(NULL) {}
+
+        df::tiletype *get(df::coord pos)
+        {
+            df::coord bpos(pos.x>>4, pos.y>>4, pos.z);
+            if (!(bpos == block_pos))
+            {
+                block_pos = bpos;
+                block = Maps::getTileBlock(pos);
+                if (blocks)
+                    blocks->insert(bpos);
+            }
+            return block ? &block->tiletype[pos.x&15][pos.y&15] : NULL;
+        }
+    };
+
+    void compute(const ProjectilePath &path, std::set<df::coord> *blocks = NULL)
     {
+        TileCursor tiles(blocks);
+
         hit_type = Impassable;
         collision_step = goal_step = goal_z_step = 1000000;
         collision_z_step = 0;
@@ -996,9 +1031,13 @@ struct PathMetrics {
                 break;
             }
 
-            if (!isPassableTile(cur_pos))
+            auto ctile = tiles.get(cur_pos);
+            if (ctile && !FlowPassable(*ctile))
             {
-                if (isTreeTile(cur_pos))
+                auto shape = tileShape(*ctile);
+                if (shape == tiletype_shape::BRANCH ||
+                    shape == tiletype_shape::TRUNK_BRANCH ||
+                    shape == tiletype_shape::TWIG)
                 {
                     // The projectile code has a bug where it will
                     // hit a tree on the same tick as a Z level change.
@@ -1018,7 +1057,7 @@ struct PathMetrics {
             if (cur_pos.z != prev_pos.z)
             {
                 int top_z = std::max(prev_pos.z, cur_pos.z);
-                auto ptile = Maps::getTileType(cur_pos.x, cur_pos.y, top_z);
+                auto ptile = tiles.get(df::coord(cur_pos.x, cur_pos.y, top_z));
 
                 if (ptile && !LowPassable(*ptile))
                 {
@@ -1056,12 +1095,144 @@ static TargetTileStatus calcTileStatus(EngineInfo *engine, const PathMetrics &ra
         return TARGET_BLOCKED;
 }
 
+/*
+ * Per-engine target map: ray tracing results for the engine's current
+ * position and range, kept until a tile on any of the traced paths
+ * changes. The tiletypes of every visited map block are checksummed,
+ * and the checksums are compared once per game tick, or on every aim
+ * screen render so that edits made while paused show up at once.
+ */
+
+struct EngineTargetMap {
+    df::coord center;
+    std::pair<int, int> fire_range;
+
+    std::unordered_map<uint64_t, PathMetrics> paths;
+    std::map<int, std::vector<int8_t> > status; // per z level, TargetTileStatus+1 or 0
+    std::set<df::coord> new_blocks;
+    std::map<df::coord, uint64_t> blocks;       // visited block -> tiletype checksum
+    int checked_frame;
+
+    static const size_t MAX_PATHS = 200000;
+
+    EngineTargetMap(EngineInfo *engine) { reset(engine); }
+
+    void reset(EngineInfo *engine)
+    {
+        center = engine->center;
+        fire_range = engine->fire_range;
+        paths.clear();
+        status.clear();
+        new_blocks.clear();
+        blocks.clear();
+        checked_frame = world->frame_counter;
+    }
+
+    static uint64_t block_checksum(df::coord bpos)
+    {
+        auto block = Maps::getBlock(bpos.x, bpos.y, bpos.z);
+        if (!block)
+            return 0;
+
+        uint64_t sum = 14695981039346656037ULL;
+        auto data = &block->tiletype[0][0];
+        for (int i = 0; i < 16*16; i++)
+            sum = (sum ^ uint16_t(data[i])) * 1099511628211ULL;
+        return sum;
+    }
+
+    void check(EngineInfo *engine, bool force)
+    {
+        if (!(center == engine->center) || fire_range != engine->fire_range)
+        {
+            reset(engine);
+            return;
+        }
+
+        if (!force && checked_frame == world->frame_counter)
+            return;
+        checked_frame = world->frame_counter;
+
+        for (auto it = blocks.begin(); it != blocks.end(); ++it)
+        {
+            if (block_checksum(it->first) != it->second)
+            {
+                reset(engine);
+                return;
+            }
+        }
+    }
+
+    void add_blocks()
+    {
+        for (auto it = new_blocks.begin(); it != new_blocks.end(); ++it)
+        {
+            if (!blocks.count(*it))
+                blocks[*it] = block_checksum(*it);
+        }
+        new_blocks.clear();
+    }
+
+    const PathMetrics &metrics(const ProjectilePath &path, PathMetrics *tmp)
+    {
+        // Only the paths generated by the plugin itself are cached
+        int dz = path.fudge_delta.z + 2048;
+        if (path.fudge_delta.x || path.fudge_delta.y ||
+            dz < 0 || dz >= 4096 || path.fudge_factor < 0 || path.fudge_factor > 255 ||
+            path.goal.x < 0 || path.goal.x >= 4096 ||
+            path.goal.y < 0 || path.goal.y >= 4096 ||
+            path.goal.z < 0 || path.goal.z >= 4096)
+        {
+            tmp->compute(path);
+            return *tmp;
+        }
+
+        uint64_t key = uint64_t(path.goal.x) | (uint64_t(path.goal.y) << 12) |
+                       (uint64_t(path.goal.z) << 24) | (uint64_t(dz) << 36) |
+                       (uint64_t(path.fudge_factor) << 48);
+
+        auto it = paths.find(key);
+        if (it != paths.end())
+            return it->second;
+
+        if (paths.size() >= MAX_PATHS)
+            paths.clear();
+
+        auto &info = paths[key];
+        info.compute(path, &new_blocks);
+        add_blocks();
+        return info;
+    }
+
+    int8_t *status_slot(df::coord pos)
+    {
+        if (!Maps::isValidTilePos(pos))
+            return NULL;
+
+        auto &level = status[pos.z];
+        if (level.empty())
+            level.resize(world->map.x_count * world->map.y_count, 0);
+        return &level[pos.y * world->map.x_count + pos.x];
+    }
+};
+
+static EngineTargetMap *get_target_map(EngineInfo *engine, bool force_check = false)
+{
+    if (!engine->target_map)
+        engine->target_map = std::make_shared<EngineTargetMap>(engine);
+    else
+        engine->target_map->check(engine, force_check);
+
+    return engine->target_map.get();
+}
+
 static int projPathMetrics(lua_State *L)
 {
     auto engine = find_engine(L, 1);
     auto path = decode_path(L, 2, engine->center);
 
-    PathMetrics info(path);
+    PathMetrics tmp;
+    const PathMetrics &info = get_target_map(engine)->metrics(path, &tmp);
 
     lua_createtable(L, 0, 7);
     Lua::SetField(L, hit_type_names[info.hit_type], -1, "hit_type");
@@ -1076,26 +1247,30 @@ static int projPathMetrics(lua_State *L)
     return 1;
 }
 
-static TargetTileStatus calcTileStatus(EngineInfo *engine, df::coord target, float zdelta)
+static TargetTileStatus calcTileStatus(EngineTargetMap *map, EngineInfo *engine, df::coord target, float zdelta)
 {
     ProjectilePath path(engine->center, target, zdelta);
-    PathMetrics raytrace(path);
-    return calcTileStatus(engine, raytrace);
+    PathMetrics tmp;
+    return calcTileStatus(engine, map->metrics(path, &tmp));
 }
 
-static TargetTileStatus calcTileStatus(EngineInfo *engine, df::coord target)
+static TargetTileStatus calcTileStatus(EngineTargetMap *map, EngineInfo *engine, df::coord target)
 {
-    auto status = calcTileStatus(engine, target, 0.0f);
+    auto slot = map->status_slot(target);
+    if (slot && *slot)
+        return TargetTileStatus(*slot - 1);
+
+    auto status = calcTileStatus(map, engine, target, 0.0f);
 
     if (status == TARGET_BLOCKED)
     {
-        if (calcTileStatus(engine, target, 0.5f) < TARGET_BLOCKED)
-            return TARGET_SEMIBLOCKED;
-
-        if (calcTileStatus(engine, target, -0.5f) < TARGET_BLOCKED)
-            return TARGET_SEMIBLOCKED;
+        if (calcTileStatus(map, engine, target, 0.5f) < TARGET_BLOCKED ||
+            calcTileStatus(map, engine, target, -0.5f) < TARGET_BLOCKED)
+            status = TARGET_SEMIBLOCKED;
     }
 
+    if (slot)
+        *slot = int8_t(status + 1);
     return status;
 }
 
@@ -1105,7 +1280,7 @@ static std::string getTileStatus(df::building_siegeenginest *bld, df::coord tile
     if (!engine)
         return "invalid";
 
-    return target_tile_type_names[calcTileStatus(engine, tile_pos)];
+    return target_tile_type_names[calcTileStatus(get_target_map(engine), engine, tile_pos)];
 }
 
 static void paintAimScreen(df::building_siegeenginest *bld, df::coord view, df::coord2d ltop, df::coord2d size)
@@ -1113,6 +1288,8 @@ static void paintAimScreen(df::building_siegeenginest *bld, df::coord view, df::
     auto engine = find_engine(bld, true);
     CHECK_NULL_POINTER(engine);
 
+    auto map = get_target_map(engine, true);
+
     for (int x = 0; x < size.x; x++)
     {
         for (int y = 0; y < size.y; y++)
@@ -1127,7 +1304,7 @@ static void paintAimScreen(df::building_siegeenginest *bld, df::coord view, df::
 
             int color = COLOR_YELLOW;
 
-            switch (calcTileStatus(engine, tile_pos))
+            switch (calcTileStatus(map, engine, tile_pos))
             {
                 case TARGET_OK:
                     color = COLOR_GREEN;
@@ -1536,7 +1713,8 @@ struct projectile_hook : df::proj_itemst {
         if (debug_mode)
             set_arrow_color(path.goal, COLOR_LIGHTMAGENTA);
 
-        PathMetrics raytrace(path);
+        PathMetrics tmp;
+        const PathMetrics &raytrace = get_target_map(engine)->metrics(path, &tmp);
 
         // Materialize map blocks, or the projectile will crash into them
         for (int i = 0; i < raytrace.collision_step; i++)
@@ -1620,7 +1798,8 @@ struct projectile_hook : df::proj_itemst {
                 continue;
 
             ProjectilePath path(engine->center, target, engine->is_catapult ? 0.5f : 0.0f);
-            PathMetrics raytrace(path);
+            PathMetrics tmp;
+            const PathMetrics &raytrace = get_target_map(engine)->metrics(path, &tmp);
 
             if (raytrace.hits() && engine->isInRange(raytrace.goal_step))
             {
@@ -60,6 +60,8 @@ struct tiletypes_options {
     // whether to display help
     bool help = false;
     bool quiet = false;
+    // count the tiles that would be painted without changing the map
+    bool dry_run = false;
 
     // if set, then use this position instead of the active game cursor
     df::coord cursor;
@@ -69,6 +71,7 @@ struct tiletypes_options {
 static const struct_field_info tiletypes_options_fields[] = {
     { struct_field_info::PRIMITIVE, "help",   offsetof(tiletypes_options, help),   &df::identity_traits<bool>::identity, 0, 0 },
     { struct_field_info::PRIMITIVE, "quiet",  offsetof(tiletypes_options, quiet),  &df::identity_traits<bool>::identity, 0, 0 },
+    { struct_field_info::PRIMITIVE, "dry_run", offsetof(tiletypes_options, dry_run), &df::identity_traits<bool>::identity, 0, 0 },
     { struct_field_info::SUBSTRUCT, "cursor", offsetof(tiletypes_options, cursor), &df::coord::_identity,                0, 0 },
     { struct_field_info::END }
 };
@@ -736,7 +739,8 @@ bool processTileType(color_ostream & out, TileType &paint, std::vector<std::stri
 }
 
 command_result executePaintJob(color_ostream &out,
-                               const tiletypes_options &opts)
+                               const tiletypes_options &opts,
+                               size_t *painted = nullptr)
 {
     if (paint.empty())
     {
@@ -775,145 +779,162 @@ command_result executePaintJob(color_ostream &out,
                   cursor.x, cursor.y, cursor.z);
 
     MapExtras::MapCache map;
-    coord_vec all_tiles = brush->points(map, cursor);
     if (!opts.quiet)
-        out.print("working...\n");
+        out.print(opts.dry_run ? "counting...\n" : "working...\n");
 
     // Force the game to recompute its walkability cache
-    world->reindex_pathfinding = true;
+    if (!opts.dry_run)
+        world->reindex_pathfinding = true;
 
     int failures = 0;
+    size_t matched = 0;
+    size_t num_tiles = 0;
 
-    for (coord_vec::iterator iter = all_tiles.begin(); iter != all_tiles.end(); ++iter)
+    size_t num_blocks = brush->forEachBlock(map, cursor,
+        [&](MapExtras::Block *blk, coord_vec::const_iterator first, coord_vec::const_iterator last)
     {
-        MapExtras::Block *blk = map.BlockAtTile(*iter);
-        if (!blk)
-            continue;
+        for (auto iter = first; iter != last; ++iter)
+        {
+            df::tiletype source = blk->tiletypeAt(*iter);
+            df::tile_designation des = blk->DesignationAt(*iter);
 
-        df::tiletype source = map.tiletypeAt(*iter);
-        df::tile_designation des = map.designationAt(*iter);
+            // Stone painting operates on the base layer
+            if (paint.stone_material >= 0)
+                source = blk->baseTiletypeAt(*iter);
 
-        // Stone painting operates on the base layer
-        if (paint.stone_material >= 0)
-            source = blk->baseTiletypeAt(*iter);
+            t_matpair basemat = blk->baseMaterialAt(*iter);
 
-        t_matpair basemat = blk->baseMaterialAt(*iter);
+            if (!filter.matches(source, des, basemat))
+            {
+                continue;
+            }
 
-        if (!filter.matches(source, des, basemat))
-        {
-            continue;
-        }
+            matched++;
+            if (opts.dry_run)
+                continue;
 
-        df::tiletype_shape shape = paint.shape;
-        if (shape == tiletype_shape::NONE)
-        {
-            shape = tileShape(source);
-        }
+            df::tiletype_shape shape = paint.shape;
+            if (shape == tiletype_shape::NONE)
+            {
+                shape = tileShape(source);
+            }
 
-        df::tiletype_material material = paint.material;
-        if (material == tiletype_material::NONE)
-        {
-            material = tileMaterial(source);
-        }
+            df::tiletype_material material = paint.material;
+            if (material == tiletype_material::NONE)
+            {
+                material = tileMaterial(source);
+            }
 
-        df::tiletype_special special = paint.special;
-        if (special == tiletype_special::NONE)
-        {
-            special = tileSpecial(source);
-        }
-        df::tiletype_variant variant = paint.variant;
-        /*
-         * FIXME: variant should be:
-         * 1. If user variant:
-         * 2.   If user variant \belongs target variants
-         * 3.     use user variant
-         * 4.   Else
-         * 5.     use variant 0
-         * 6. If the source variant \belongs target variants
-         * 7    use source variant
-         * 8  ElseIf num target shape/material variants > 1
-         * 9.   pick one randomly
-         * 10.Else
-         * 11.  use variant 0
-         *
-         * The following variant check has been disabled because it's severely limiting
-         * the usefullness of the tool.
-         */
-        /*
-        if (variant == tiletype_variant::NONE)
-        {
-            variant = tileVariant(source);
-        }
-        */
-        // Remove direction from directionless tiles
-        DFHack::TileDirection direction = tileDirection(source);
-        if (!(material == tiletype_material::RIVER || shape == tiletype_shape::BROOK_BED || special == tiletype_special::TRACK || (shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))))
-        {
-            direction.whole = 0;
-        }
+            df::tiletype_special special = paint.special;
+            if (special == tiletype_special::NONE)
+            {
+                special = tileSpecial(source);
+            }
+            df::tiletype_variant variant = paint.variant;
+            /*
+             * FIXME: variant should be:
+             * 1. If user variant:
+             * 2.   If user variant \belongs target variants
+             * 3.     use user variant
+             * 4.   Else
+             * 5.     use variant 0
+             * 6. If the source variant \belongs target variants
+             * 7    use source variant
+             * 8  ElseIf num target shape/material variants > 1
+             * 9.   pick one randomly
+             * 10.Else
+             * 11.  use variant 0
+             *
+             * The following variant check has been disabled because it's severely limiting
+             * the usefullness of the tool.
+             */
+            /*
+            if (variant == tiletype_variant::NONE)
+            {
+                variant = tileVariant(source);
+            }
+            */
+            // Remove direction from directionless tiles
+            DFHack::TileDirection direction = tileDirection(source);
+            if (!(material == tiletype_material::RIVER || shape == tiletype_shape::BROOK_BED || special == tiletype_special::TRACK || (shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))))
+            {
+                direction.whole = 0;
+            }
 
-        df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
-        // hack for empty space
-        if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0)
-        {
-            type = tiletype::OpenSpace;
-        }
-        // make sure it's not invalid
-        if(type != tiletype::Void)
-        {
-            if (paint.stone_material >= 0)
+            df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
+            // hack for empty space
+            if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0)
             {
-                if (!blk->setStoneAt(*iter, type, paint.stone_material, paint.vein_type, true, true))
-                    failures++;
+                type = tiletype::OpenSpace;
+            }
+            // make sure it's not invalid
+            if(type != tiletype::Void)
+            {
+                if (paint.stone_material >= 0)
+                {
+                    if (!blk->setStoneAt(*iter, type, paint.stone_material, paint.vein_type, true, true))
+                        failures++;
+                }
+                else
+                    blk->setTiletypeAt(*iter, type);
             }
-            else
-                map.setTiletypeAt(*iter, type);
-        }
 
-        if (paint.hidden > -1)
-        {
-            des.bits.hidden = paint.hidden;
-        }
+            if (paint.hidden > -1)
+            {
+                des.bits.hidden = paint.hidden;
+            }
 
-        if (paint.light > -1)
-        {
-            des.bits.light = paint.light;
-        }
+            if (paint.light > -1)
+            {
+                des.bits.light = paint.light;
+            }
 
-        if (paint.subterranean > -1)
-        {
-            des.bits.subterranean = paint.subterranean;
-        }
+            if (paint.subterranean > -1)
+            {
+                des.bits.subterranean = paint.subterranean;
+            }
 
-        if (paint.skyview > -1)
-        {
-            des.bits.outside = paint.skyview;
-        }
+            if (paint.skyview > -1)
+            {
+                des.bits.outside = paint.skyview;
+            }
 
-        if (paint.aquifer > -1)
-        {
-            des.bits.water_table = paint.aquifer;
-        }
+            if (paint.aquifer > -1)
+            {
+                des.bits.water_table = paint.aquifer;
+            }
 
-        // Remove liquid from walls, etc
-        if (type != (df::tiletype)-1 && !DFHack::FlowPassable(type))
-        {
-            des.bits.flow_size = 0;
-            //des.bits.liquid_type = DFHack::liquid_water;
-            //des.bits.water_table = 0;
-            des.bits.flow_forbid = 0;
-            //des.bits.liquid_static = 0;
-            //des.bits.water_stagnant = 0;
-            //des.bits.water_salt = 0;
+            // Remove liquid from walls, etc
+            if (type != (df::tiletype)-1 && !DFHack::FlowPassable(type))
+            {
+                des.bits.flow_size = 0;
+                //des.bits.liquid_type = DFHack::liquid_water;
+                //des.bits.water_table = 0;
+                des.bits.flow_forbid = 0;
+                //des.bits.liquid_static = 0;
+                //des.bits.water_stagnant = 0;
+                //des.bits.water_salt = 0;
+            }
+
+            blk->setDesignationAt(*iter, des);
         }
+    }, &num_tiles);
+
+    if (painted)
+        *painted = matched;
 
-        map.setDesignationAt(*iter, des);
+    if (opts.dry_run)
+    {
+        if (!opts.quiet)
+            out.print("Would paint %zu of %zu tiles in %zu blocks.\n",
+                      matched, num_tiles, num_blocks);
+        return CR_OK;
     }
 
     if (failures > 0)
-        out.printerr("Could not update %d tiles of %zu.\n", failures, all_tiles.size());
+        out.printerr("Could not update %d tiles of %zu.\n", failures, num_tiles);
     else if (!opts.quiet)
-        out.print("Processed %zu tiles.\n", all_tiles.size());
+        out.print("Processed %zu tiles in %zu blocks.\n", num_tiles, num_blocks);
 
     if (map.WriteAll())
     {
@@ -1135,3 +1156,27 @@ command_result df_tiletypes_here_point (color_ostream &out, vector <string> & pa
     brush = old;
     return rv;
 }
+
+static int tiletypes_paint(lua_State *L)
+{
+    tiletypes_options opts;
+    opts.quiet = true;
+
+    lua_settop(L, 2);
+    Lua::CheckDFAssign(L, &opts.cursor, 1);
+    if (!opts.cursor.isValid())
+        luaL_argerror(L, 1, "invalid cursor position");
+    opts.dry_run = lua_toboolean(L, 2);
+
+    size_t painted = 0;
+    if (executePaintJob(*Lua::GetOutput(L), opts, &painted) != CR_OK)
+        lua_pushnil(L);
+    else
+        lua_pushinteger(L, painted);
+    return 1;
+}
+
+DFHACK_PLUGIN_LUA_COMMANDS {
+    DFHACK_LUA_COMMAND(tiletypes_paint),
+    DFHACK_LUA_END
+};
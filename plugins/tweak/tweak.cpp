@@ -755,36 +755,31 @@ struct military_training_id_hook : df::activity_event_individual_skill_drillst {
 IMPLEMENT_VMETHOD_INTERPOSE(military_training_id_hook, process);
 */
 
-static void enable_hook(color_ostream &out, VMethodInterposeLinkBase &hook, vector <string> &parameters)
-{
-    if (vector_get(parameters, 1) == "disable")
-    {
-        hook.remove();
-        fprintf(stderr, "Disabled tweak %s (%s)\n", parameters[0].c_str(), hook.name());
-        fflush(stderr);
-    }
-    else
-    {
-        if (hook.apply())
-        {
-            fprintf(stderr, "Enabled tweak %s (%s)\n", parameters[0].c_str(), hook.name());
-            fflush(stderr);
-        }
-        else
-            out.printerr("Could not activate tweak %s (%s)\n", parameters[0].c_str(), hook.name());
-    }
-}
-
 static command_result enable_tweak(string tweak, color_ostream &out, vector <string> &parameters)
 {
     bool recognized = false;
     string cmd = parameters[0];
+    vector<VMethodInterposeLinkBase*> hooks;
     for (auto it = tweak_hooks.begin(); it != tweak_hooks.end(); ++it)
     {
         if (it->first == cmd)
+            hooks.push_back(&it->second);
+    }
+    if (!hooks.empty())
+    {
+        // Patch all vtables of the tweak in one go
+        recognized = true;
+        bool enable = (vector_get(parameters, 1) != "disable");
+        VMethodInterposeLinkBase::apply_all(hooks, enable);
+        for (auto hook : hooks)
         {
-            recognized = true;
-            enable_hook(out, it->second, parameters);
+            if (hook->is_applied() != enable)
+                out.printerr("Could not activate tweak %s (%s)\n", cmd.c_str(), hook->name());
+            else
+            {
+                fprintf(stderr, "%s tweak %s (%s)\n", enable ? "Enabled" : "Disabled", cmd.c_str(), hook->name());
+                fflush(stderr);
+            }
         }
     }
     for (auto it = tweak_onupdate_hooks.begin(); it != tweak_onupdate_hooks.end(); ++it)
@@ -428,27 +428,21 @@ public:
 static int fix_job_postings (color_ostream *out, bool dry_run)
 {
     int count = 0;
-    df::job_list_link *link = &world->jobs.list;
-    while (link)
+    for (size_t i = 0; i < world->jobs.postings.size(); ++i)
     {
-        df::job *job = link->item;
-        if (job)
+        df::job_handler::T_postings *posting = world->jobs.postings[i];
+        df::job *job = posting->job;
+        if (posting->flags.bits.dead || !Job::isInWorld(job))
+            continue;
+        if (i != size_t(job->posting_index))
         {
-            for (size_t i = 0; i < world->jobs.postings.size(); ++i)
-            {
-                df::job_handler::T_postings *posting = world->jobs.postings[i];
-                if (posting->job == job && i != size_t(job->posting_index) && !posting->flags.bits.dead)
-                {
-                    ++count;
-                    if (out)
-                        *out << "Found extra job posting: Job " << job->id << ": "
-                            << Job::getName(job) << endl;
-                    if (!dry_run)
-                        posting->flags.bits.dead = true;
-                }
-            }
+            ++count;
+            if (out)
+                *out << "Found extra job posting: Job " << job->id << ": "
+                    << Job::getName(job) << endl;
+            if (!dry_run)
+                posting->flags.bits.dead = true;
         }
-        link = link->next;
     }
     return count;
 }
@@ -706,13 +700,11 @@ static void check_lost_jobs(color_ostream &out, int ticks)
 
 static void update_job_data(color_ostream &out)
 {
-    df::job_list_link *p = world->jobs.list.next;
-    for (; p; p = p->next)
+    for (auto it = known_jobs.begin(); it != known_jobs.end(); ++it)
     {
-        ProtectedJob *pj = get_known(p->item->id);
-        if (!pj)
-            continue;
-        pj->update(p->item);
+        df::job *job = Job::findJob(it->first);
+        if (job)
+            it->second->update(job);
     }
 }
 
@@ -0,0 +1,41 @@
+-- tests switching the console to asynchronous output and back
+
+local console = dfhack.console
+
+-- runs fn with asynchronous output, if the console supports it
+local function with_async(fn)
+    local was_async = console.isAsyncOutput()
+    if not console.setAsyncOutput(true) then
+        return
+    end
+    return dfhack.with_finalize(
+        function() console.setAsyncOutput(was_async) end,
+        fn
+    )
+end
+
+function test.async_flush()
+    with_async(function()
+        expect.true_(console.isAsyncOutput())
+        local dropped = console.getDroppedOutput()
+        for i = 1, 100 do
+            dfhack.print('.')
+        end
+        dfhack.print('\n')
+        console.flush()
+        expect.eq(dropped, console.getDroppedOutput())
+    end)
+end
+
+function test.async_toggle()
+    with_async(function()
+        expect.true_(console.setAsyncOutput(false))
+        expect.false_(console.isAsyncOutput())
+        dfhack.print('.\n')
+        console.flush()
+        expect.true_(console.setAsyncOutput(true))
+        expect.true_(console.isAsyncOutput())
+        dfhack.print('.\n')
+        console.flush()
+    end)
+end
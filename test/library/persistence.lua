@@ -0,0 +1,136 @@
+-- tests saving and loading persistent data in the binary and JSON formats
+
+config.mode = 'fortress'
+
+local TMP_BINARY = 'dfhack-config/tmp-test-persistence.dat'
+local TMP_JSON = 'dfhack-config/tmp-test-persistence.json'
+local TMP_BACKUP = 'dfhack-config/tmp-test-persistence-backup.json'
+local PREFIX = 'test-persistence/'
+
+-- returns all entries, by entry_id
+local function snapshot()
+    local entries = {}
+    for _, entry in ipairs(dfhack.persistent.get_all('', true) or {}) do
+        entries[entry.entry_id] = {key=entry.key, value=entry.value,
+                                   ints=copyall(entry.ints)}
+    end
+    return entries
+end
+
+local function delete_test_entries()
+    for _, entry in ipairs(dfhack.persistent.get_all(PREFIX:sub(1, -2), true) or {}) do
+        entry:delete()
+    end
+end
+
+local function file_size(path)
+    local f = io.open(path, 'rb')
+    if not f then return nil end
+    local size = f:seek('end')
+    f:close()
+    return size
+end
+
+-- runs fn, then puts the persistent data of the world back as it was
+local function with_backup(fn)
+    expect.true_(dfhack.persistent.exportJSON(TMP_BACKUP))
+    return dfhack.with_finalize(
+        function()
+            dfhack.persistent.importJSON(TMP_BACKUP)
+            os.remove(TMP_BACKUP)
+            os.remove(TMP_BINARY)
+            os.remove(TMP_JSON)
+        end,
+        fn
+    )
+end
+
+local function add_test_entries()
+    dfhack.persistent.save({key=PREFIX..'a', value='first', ints={1, 2, 3, 4, 5, 6, 7}}, true)
+    dfhack.persistent.save({key=PREFIX..'b', value='', ints={-1, -2, -3, 0, 0, 0, 2147483647}}, true)
+    dfhack.persistent.save({key=PREFIX..'b', value='same key', ints={}}, true)
+    dfhack.persistent.save({key=PREFIX..'c', value='bytes \0\1\255 end'}, true)
+end
+
+function test.binary_round_trip()
+    with_backup(function()
+        add_test_entries()
+        expect.true_(dfhack.persistent.exportBinary(TMP_BINARY))
+        local full_size = file_size(TMP_BINARY)
+
+        -- exporting again to the same file only appends the changes
+        dfhack.persistent.save({key=PREFIX..'a', value='changed'})
+        dfhack.persistent.delete(PREFIX..'c')
+        dfhack.persistent.save({key=PREFIX..'d', value='new'}, true)
+        local expected = snapshot()
+        expect.true_(dfhack.persistent.exportBinary(TMP_BINARY))
+        local appended = file_size(TMP_BINARY) - full_size
+        expect.lt(0, appended)
+        expect.lt(appended, full_size)
+
+        delete_test_entries()
+        expect.true_(dfhack.persistent.importBinary(TMP_BINARY))
+        expect.table_eq(expected, snapshot())
+    end)
+end
+
+function test.binary_incomplete_batch()
+    with_backup(function()
+        add_test_entries()
+        local expected = snapshot()
+        expect.true_(dfhack.persistent.exportBinary(TMP_BINARY))
+
+        -- the start of a record without a commit marker after it
+        local f = io.open(TMP_BINARY, 'ab')
+        f:write('\1\0\0\0\0\5\0')
+        f:close()
+
+        delete_test_entries()
+        expect.true_(dfhack.persistent.importBinary(TMP_BINARY))
+        expect.table_eq(expected, snapshot())
+    end)
+end
+
+function test.binary_compaction()
+    with_backup(function()
+        add_test_entries()
+        expect.true_(dfhack.persistent.exportBinary(TMP_BINARY))
+        for i = 1, 1000 do
+            dfhack.persistent.save({key=PREFIX..'a', value=('%d'):format(i):rep(100)})
+            expect.true_(dfhack.persistent.exportBinary(TMP_BINARY))
+        end
+        local expected = snapshot()
+        -- without compaction, the file would hold every version of the entry
+        expect.lt(file_size(TMP_BINARY), 1000 * 100)
+
+        delete_test_entries()
+        expect.true_(dfhack.persistent.importBinary(TMP_BINARY))
+        expect.table_eq(expected, snapshot())
+    end)
+end
+
+function test.binary_corrupt()
+    with_backup(function()
+        add_test_entries()
+        local expected = snapshot()
+
+        local f = io.open(TMP_BINARY, 'wb')
+        f:write('not a persistent data store')
+        f:close()
+
+        expect.false_(dfhack.persistent.importBinary(TMP_BINARY))
+        expect.table_eq(expected, snapshot())
+    end)
+end
+
+function test.json_round_trip()
+    with_backup(function()
+        add_test_entries()
+        local expected = snapshot()
+        expect.true_(dfhack.persistent.exportJSON(TMP_JSON))
+
+        delete_test_entries()
+        expect.true_(dfhack.persistent.importJSON(TMP_JSON))
+        expect.table_eq(expected, snapshot())
+    end)
+end
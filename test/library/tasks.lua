@@ -0,0 +1,124 @@
+-- tests the dfhack.tasks scheduler
+
+local tasks = dfhack.tasks
+
+-- runs fn with the tasks it spawns cancelled afterwards
+local function with_tasks(fn)
+    local ids = {}
+    local function spawn(...)
+        local id = tasks.spawn(...)
+        table.insert(ids, id)
+        return id
+    end
+    return dfhack.with_finalize(
+        function()
+            for _, id in ipairs(ids) do tasks.cancel(id) end
+        end,
+        function() fn(spawn) end
+    )
+end
+
+function test.spawn_args()
+    with_tasks(function(spawn)
+        local got
+        local id = spawn(function(a, b) got = {a, b} end, 1, 'two')
+        expect.eq('ready', tasks.status(id))
+        delay_until(function() return got end)
+        expect.table_eq({1, 'two'}, got)
+        expect.nil_(tasks.status(id))
+    end)
+end
+
+function test.sleep_frames()
+    with_tasks(function(spawn)
+        local result
+        local id = spawn(function() result = tasks.sleep(5) end)
+        delay(2)
+        expect.eq('sleeping', tasks.status(id))
+        expect.nil_(result)
+        delay_until(function() return result ~= nil end)
+        expect.true_(result)
+    end)
+end
+
+function test.wait_signal()
+    with_tasks(function(spawn)
+        local key = {}
+        local got
+        local id = spawn(function() got = {tasks.wait(key)} end)
+        delay_until(function() return tasks.status(id) == 'waiting' end)
+        expect.eq(0, tasks.signal({}, 'wrong key'))
+        expect.eq(1, tasks.signal(key, 'a', 2))
+        delay_until(function() return got end)
+        expect.table_eq({'a', 2}, got)
+    end)
+end
+
+function test.cancel_sleeping()
+    with_tasks(function(spawn)
+        local resumed = false
+        local id = spawn(function()
+            tasks.sleep(2)
+            resumed = true
+        end)
+        delay_until(function() return tasks.status(id) == 'sleeping' end)
+        expect.true_(tasks.cancel(id))
+        expect.nil_(tasks.status(id))
+        expect.false_(tasks.cancel(id))
+        delay(5)
+        expect.false_(resumed)
+    end)
+end
+
+function test.cancel_self()
+    with_tasks(function(spawn)
+        local cancelled, resumed = nil, false
+        local id = spawn(function()
+            cancelled = tasks.cancel(tasks.current())
+            tasks.sleep(1)
+            resumed = true
+        end)
+        delay(5)
+        expect.true_(cancelled)
+        expect.nil_(tasks.status(id))
+        expect.false_(resumed)
+    end)
+end
+
+function test.invalid_sleep()
+    with_tasks(function(spawn)
+        local results
+        spawn(function()
+            results = {
+                (pcall(tasks.sleep, 0)),
+                (pcall(tasks.sleep, -1, 'ticks')),
+                (pcall(tasks.sleep, 0x7fffffff, 'years')),
+                (pcall(tasks.sleep, 0x7fffffff, 'days')),
+            }
+        end)
+        delay_until(function() return results end)
+        expect.table_eq({false, false, false, false}, results)
+    end)
+end
+
+function test.outside_task()
+    expect.nil_(tasks.current())
+    expect.error_match('can only be called from a task', function()
+        tasks.sleep(1)
+    end)
+    expect.error_match('can only be called from a task', function()
+        tasks.wait('key')
+    end)
+end
+
+function test.budget()
+    local old = tasks.budget()
+    dfhack.with_finalize(
+        function() tasks.budget(old) end,
+        function()
+            expect.eq(old, tasks.budget(2))
+            expect.eq(2, tasks.budget())
+            expect.error(function() tasks.budget(0) end)
+        end
+    )
+end
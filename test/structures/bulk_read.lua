@@ -0,0 +1,70 @@
+local function check_units(vec)
+    local cols, count, indices = df.bulk_read(vec, {'id', 'pos.x', 'flags1.inactive'})
+    expect.eq(count, #vec)
+    for i = 1, count do
+        local unit = vec[indices[i]]
+        expect.eq(cols.id[i], unit.id)
+        expect.eq(cols['pos.x'][i], unit.pos.x)
+        expect.eq(cols['flags1.inactive'][i], unit.flags1.inactive)
+    end
+end
+
+function test.units()
+    check_units(df.global.world.units.all)
+    check_units(df.global.world.units.active)
+end
+
+function test.filter_table()
+    local vec = df.global.world.units.all
+    local cols, count, indices = df.bulk_read(vec, {'id'}, {['flags1.inactive'] = false})
+    local expected = 0
+    for _, unit in ipairs(vec) do
+        if not unit.flags1.inactive then expected = expected + 1 end
+    end
+    expect.eq(count, expected)
+    for i = 1, count do
+        expect.false_(vec[indices[i]].flags1.inactive)
+        expect.eq(cols.id[i], vec[indices[i]].id)
+    end
+end
+
+function test.filter_function()
+    local vec = df.global.world.units.all
+    local _, count, indices = df.bulk_read(vec, {'id'}, function(id) return id % 2 == 0 end)
+    local expected = 0
+    for _, unit in ipairs(vec) do
+        if unit.id % 2 == 0 then expected = expected + 1 end
+    end
+    expect.eq(count, expected)
+    for i = 1, count do
+        expect.eq(vec[indices[i]].id % 2, 0)
+    end
+end
+
+function test.subclass_fields()
+    local vec = df.global.world.items.all
+    local cols, count, indices = df.bulk_read(vec, {'id', 'stack_size'})
+    expect.eq(count, #vec)
+    for i = 1, count do
+        local item = vec[indices[i]]
+        expect.eq(cols.id[i], item.id)
+        if df.item_actual:is_instance(item) then
+            expect.eq(cols.stack_size[i], item.stack_size)
+        end
+    end
+end
+
+function test.bad_fields()
+    expect.error_match('no field', function()
+        df.bulk_read(df.global.world.units.all, {'nonexistent_field'})
+    end)
+    expect.error_match('needs a member name', function()
+        df.bulk_read(df.global.world.units.all, {'flags1'})
+    end)
+    expect.error_match('no field', function()
+        df.bulk_read(df.global.world.items.all, {'nonexistent_field'})
+    end)
+    expect.error_match('container expected', function()
+        df.bulk_read(df.global.world.units, {'id'})
+    end)
+end
@@ -0,0 +1,58 @@
+function test.get_set()
+    local get_x, set_x = df.fieldhandle(df.coord, 'x')
+    local pos = df.coord:new()
+    pos.x = 12
+    expect.eq(get_x(pos), 12)
+    set_x(pos, 34)
+    expect.eq(pos.x, 34)
+    expect.eq(get_x(pos), 34)
+    pos:delete()
+end
+
+function test.nested_and_bits()
+    local get_x, set_x = df.fieldhandle(df.unit, 'pos.x')
+    local get_dead, set_dead = df.fieldhandle(df.unit, 'flags1.inactive')
+    local unit = df.unit:new()
+    set_x(unit, 5)
+    expect.eq(unit.pos.x, 5)
+    set_dead(unit, true)
+    expect.true_(unit.flags1.inactive)
+    expect.true_(get_dead(unit))
+    expect.eq(get_x(unit), 5)
+    unit:delete()
+end
+
+function test.wrong_type()
+    local get_x = df.fieldhandle(df.coord, 'x')
+    local pos2d = df.coord2d:new()
+    expect.error_match('different type', function() get_x(pos2d) end)
+    pos2d:delete()
+    expect.error_match('no field', function() df.fieldhandle(df.coord, 'w') end)
+end
+
+-- Microbenchmark: compares regular field access with field handles.
+-- Only the results are checked; the timings are printed for reference.
+function test.benchmark()
+    local N = 1000000
+    local get_x = df.fieldhandle(df.coord, 'x')
+    local pos = df.coord:new()
+    pos.x = 1
+
+    local sum, start = 0, os.clock()
+    for _ = 1, N do
+        sum = sum + pos.x
+    end
+    local field_time = os.clock() - start
+    expect.eq(sum, N)
+
+    sum, start = 0, os.clock()
+    for _ = 1, N do
+        sum = sum + get_x(pos)
+    end
+    local handle_time = os.clock() - start
+    expect.eq(sum, N)
+
+    print(('%d reads: field access %.3fs, field handle %.3fs'):format(
+        N, field_time, handle_time))
+    pos:delete()
+end